@@ -83,6 +83,7 @@ struct _PixelProcessor
   gint                 num_regions;
   PixelRegion         *regions[5];
 
+  gint                 tiles_per_thread;
   gulong               progress;
 };
 
@@ -295,10 +296,10 @@ pixel_regions_do_parallel (PixelProcessor             *processor,
   gulong tiles  = pixels / (TILE_WIDTH * TILE_HEIGHT);
 
 #ifdef ENABLE_MP
-  if (pool && tiles > TILES_PER_THREAD)
+  if (pool && tiles > processor->tiles_per_thread)
     {
       GError *error = NULL;
-      gint    tasks = MIN (tiles / TILES_PER_THREAD,
+      gint    tasks = MIN (tiles / processor->tiles_per_thread,
                            g_thread_pool_get_max_threads (pool));
 
       /*
@@ -370,6 +371,7 @@ pixel_regions_process_parallel_valist (PixelProcessorFunc         func,
                                        gpointer                   data,
                                        PixelProcessorProgressFunc progress_func,
                                        gpointer                   progress_data,
+                                       gint                       tiles_per_thread,
                                        gint                       num_regions,
                                        va_list                    ap)
 {
@@ -429,6 +431,8 @@ pixel_regions_process_parallel_valist (PixelProcessorFunc         func,
   processor.data        = data;
   processor.num_regions = num_regions;
 
+  processor.tiles_per_thread = MAX (tiles_per_thread, 1);
+
 #ifdef ENABLE_MP
   processor.threads     = 0;
 #endif
@@ -510,6 +514,7 @@ pixel_regions_process_parallel (PixelProcessorFunc  func,
 
   pixel_regions_process_parallel_valist (func, data,
                                          NULL, NULL,
+                                         TILES_PER_THREAD,
                                          num_regions, va);
 
   va_end (va);
@@ -529,6 +534,30 @@ pixel_regions_process_parallel_progress (PixelProcessorFunc          func,
 
   pixel_regions_process_parallel_valist (func, data,
                                          progress_func, progress_data,
+                                         TILES_PER_THREAD,
+                                         num_regions, va);
+
+  va_end (va);
+}
+
+/*  Like pixel_regions_process_parallel(), but for functions which do
+ *  a lot of work per tile. Threads are used as soon as the regions
+ *  span more than tiles_per_thread tiles.
+ */
+void
+pixel_regions_process_parallel_tiles (PixelProcessorFunc  func,
+                                      gpointer            data,
+                                      gint                tiles_per_thread,
+                                      gint                num_regions,
+                                      ...)
+{
+  va_list va;
+
+  va_start (va, num_regions);
+
+  pixel_regions_process_parallel_valist (func, data,
+                                         NULL, NULL,
+                                         tiles_per_thread,
                                          num_regions, va);
 
   va_end (va);
@@ -45,5 +45,12 @@ void  pixel_regions_process_parallel_progress
                                        gint                        num_regions,
                                        ...);
 
+void  pixel_regions_process_parallel_tiles
+                                      (PixelProcessorFunc          func,
+                                       gpointer                    data,
+                                       gint                        tiles_per_thread,
+                                       gint                        num_regions,
+                                       ...);
+
 
 #endif /* __PIXEL_PROCESSOR_H__ */
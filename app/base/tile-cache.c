@@ -28,6 +28,25 @@
 #include "tile-private.h"
 
 
+/*  The cache is split into shards, each with its own lock and its own
+ *  list of tiles, so that threads releasing and locking different tiles
+ *  do not serialize on a single lock. A tile always goes to the shard
+ *  picked by the hash of its address.
+ *
+ *  Each shard keeps its tiles in the order they were released, and
+ *  tiles leave the cache while they are locked, so the first tile of a
+ *  shard is its least recently used one. Room is made by evicting from
+ *  the shards in turn, which approximates a global LRU order. The size
+ *  of the cache is kept in one atomic counter, so max_cache_size is
+ *  still a limit for all shards together.
+ */
+
+#define TILE_CACHE_SHARD_BITS           4
+#define TILE_CACHE_N_SHARDS             (1 << TILE_CACHE_SHARD_BITS)
+
+/*  number of tiles evicted from a shard while its lock is held  */
+#define TILE_CACHE_ZORCH_BATCH          8
+
 #define IDLE_SWAPPER_START              1000
 #define IDLE_SWAPPER_INTERVAL_MS        20
 #define IDLE_SWAPPER_TILES_PER_INTERVAL 10
@@ -39,14 +58,24 @@ typedef struct _TileList
   Tile *last;
 } TileList;
 
+typedef struct _TileCacheShard
+{
+  TileList  list;
+  Tile     *idle_scan_last;   /*  the next tile to check for a write    */
+  guint64   dirty;            /*  size of the tiles with pending writes */
+#ifdef ENABLE_MP
+  GMutex   *mutex;
+#endif
+} TileCacheShard;
 
-static guint64       cur_cache_size   = 0;
-static guint64       max_cache_size   = 0;
-static guint64       cur_cache_dirty  = 0;
-static TileList      tile_list        = { NULL, NULL };
-static guint         idle_swapper     = 0;
-static guint         idle_delay       = 0;
-static Tile         *idle_scan_last   = NULL;
+
+static volatile gsize  cur_cache_size   = 0;
+static guint64         max_cache_size   = 0;
+static TileCacheShard  shards[TILE_CACHE_N_SHARDS];
+static volatile gint   zorch_shard      = 0;
+static guint           idle_swapper     = 0;
+static guint           idle_delay       = 0;
+static gint            idle_shard       = 0;
 
 #ifdef TILE_PROFILING
 extern gulong        tile_idle_swapout;
@@ -59,40 +88,79 @@ extern gint          tile_exist_count;
 
 #ifdef ENABLE_MP
 
-static GMutex       *tile_cache_mutex = NULL;
+/*  tile_swap_out() is not thread safe, the idle swapper and the shards
+ *  evicting tiles take turns
+ */
+static GMutex       *tile_swap_mutex = NULL;
+static GMutex       *idle_mutex      = NULL;
 
-#define TILE_CACHE_LOCK    g_mutex_lock (tile_cache_mutex)
-#define TILE_CACHE_UNLOCK  g_mutex_unlock (tile_cache_mutex)
+#define TILE_CACHE_LOCK(shard)    g_mutex_lock ((shard)->mutex)
+#define TILE_CACHE_UNLOCK(shard)  g_mutex_unlock ((shard)->mutex)
+#define TILE_SWAP_LOCK            g_mutex_lock (tile_swap_mutex)
+#define TILE_SWAP_UNLOCK          g_mutex_unlock (tile_swap_mutex)
+#define IDLE_LOCK                 g_mutex_lock (idle_mutex)
+#define IDLE_UNLOCK               g_mutex_unlock (idle_mutex)
 
 #else
 
-#define TILE_CACHE_LOCK   /* nothing */
-#define TILE_CACHE_UNLOCK /* nothing */
+#define TILE_CACHE_LOCK(shard)    /* nothing */
+#define TILE_CACHE_UNLOCK(shard)  /* nothing */
+#define TILE_SWAP_LOCK            /* nothing */
+#define TILE_SWAP_UNLOCK          /* nothing */
+#define IDLE_LOCK                 /* nothing */
+#define IDLE_UNLOCK               /* nothing */
 
 #endif
 
 #define PENDING_WRITE(t) ((t)->dirty || (t)->swap_offset == -1)
 
+#define CACHE_SIZE ((guint64) (gsize) g_atomic_pointer_get (&cur_cache_size))
 
-static gboolean  tile_cache_zorch_next     (void);
-static void      tile_cache_flush_internal (Tile     *tile);
-static gboolean  tile_idle_preswap         (gpointer  data);
+
+static gboolean  tile_cache_make_room      (void);
+static gint      tile_cache_zorch_shard    (TileCacheShard *shard);
+static gboolean  tile_cache_zorch_next     (TileCacheShard *shard);
+static void      tile_cache_flush_internal (TileCacheShard *shard,
+                                            Tile           *tile);
+static void      tile_cache_start_idle_swapper (void);
+static gboolean  tile_idle_preswap         (gpointer        data);
 #ifdef TILE_PROFILING
 static void      tile_verify               (void);
 #endif
 
 
+static inline TileCacheShard *
+tile_cache_get_shard (const Tile *tile)
+{
+  guint32 hash = (guint32) ((gsize) tile >> 4) * 2654435761u;
+
+  return &shards[hash >> (32 - TILE_CACHE_SHARD_BITS)];
+}
+
 void
 tile_cache_init (guint64 tile_cache_size)
 {
+  gint i;
+
 #ifdef ENABLE_MP
-  g_return_if_fail (tile_cache_mutex == NULL);
+  g_return_if_fail (tile_swap_mutex == NULL);
 
-  tile_cache_mutex = g_mutex_new ();
+  tile_swap_mutex = g_mutex_new ();
+  idle_mutex      = g_mutex_new ();
 #endif
 
-  tile_list.first = tile_list.last = NULL;
-  idle_scan_last = NULL;
+  for (i = 0; i < TILE_CACHE_N_SHARDS; i++)
+    {
+      TileCacheShard *shard = &shards[i];
+
+      shard->list.first     = shard->list.last = NULL;
+      shard->idle_scan_last = NULL;
+      shard->dirty          = 0;
+
+#ifdef ENABLE_MP
+      shard->mutex = g_mutex_new ();
+#endif
+    }
 
   max_cache_size = tile_cache_size;
 }
@@ -100,21 +168,34 @@ tile_cache_init (guint64 tile_cache_size)
 void
 tile_cache_exit (void)
 {
+#ifdef ENABLE_MP
+  gint i;
+#endif
+
   if (idle_swapper)
     {
       g_source_remove (idle_swapper);
       idle_swapper = 0;
     }
 
-  if (cur_cache_size > 0)
+  if (CACHE_SIZE > 0)
     g_warning ("tile cache not empty (%"G_GUINT64_FORMAT" bytes left)",
-               cur_cache_size);
+               CACHE_SIZE);
 
   tile_cache_set_size (0);
 
 #ifdef ENABLE_MP
-  g_mutex_free (tile_cache_mutex);
-  tile_cache_mutex = NULL;
+  for (i = 0; i < TILE_CACHE_N_SHARDS; i++)
+    {
+      g_mutex_free (shards[i].mutex);
+      shards[i].mutex = NULL;
+    }
+
+  g_mutex_free (tile_swap_mutex);
+  tile_swap_mutex = NULL;
+
+  g_mutex_free (idle_mutex);
+  idle_mutex = NULL;
 #endif
 }
 
@@ -127,188 +208,235 @@ tile_cache_suspend_idle_swapper(void)
 void
 tile_cache_insert (Tile *tile)
 {
-
-  TILE_CACHE_LOCK;
+  TileCacheShard *shard;
+  gboolean        counted = FALSE;
 
   if (! tile->data)
-    goto out;
-
-  /* First check and see if the tile is already
-   *  in the cache. In that case we will simply place
-   *  it at the end of the tile list to indicate that
-   *  it was the most recently accessed tile.
+    return;
+
+  shard = tile_cache_get_shard (tile);
+
+  /* If the tile was not in the cache, first check and see
+   *  if there is room in the cache. If not then we'll have
+   *  to make room first. Note: it might be the case that the
+   *  cache is smaller than the size of a tile in which case
+   *  it won't be possible to put it in the cache.
+   *
+   *  The tile is counted before the room is made, so that threads
+   *  inserting at the same time do not all claim the same room. The
+   *  room is made without holding the lock of the tile's shard, only
+   *  one shard is locked at a time.
    */
-
-  if (tile->cached)
+  if (! tile->cached)
     {
-      /* Tile is in the cache.  Remove it from the list. */
+#ifdef TILE_PROFILING
+      GTimeVal now;
+      GTimeVal later;
 
-      if (tile->next)
-        tile->next->prev = tile->prev;
-      else
-        tile_list.last = tile->prev;
+      g_get_current_time (&now);
+#endif
 
-      if(tile->prev){
-	tile->prev->next = tile->next;
-      }else{
-	tile_list.first = tile->next;
-      }
+      g_atomic_pointer_add (&cur_cache_size, tile->size);
 
-      if (PENDING_WRITE(tile))
-	cur_cache_dirty -= tile->size;
+      if (! tile_cache_make_room ())
+        {
+          g_atomic_pointer_add (&cur_cache_size, - (gssize) tile->size);
 
-      if(tile == idle_scan_last)
-	idle_scan_last = tile->next;
-//      g_print("E:");
+          g_warning ("cache: unable to find room for a tile");
+          return;
+        }
 
-    }
-  else
-    {
-      /* The tile was not in the cache. First check and see
-       *  if there is room in the cache. If not then we'll have
-       *  to make room first. Note: it might be the case that the
-       *  cache is smaller than the size of a tile in which case
-       *  it won't be possible to put it in the cache.
-       */
+      counted = TRUE;
 
 #ifdef TILE_PROFILING
-      if ((cur_cache_size + tile->size) > max_cache_size)
+      g_get_current_time (&later);
+      tile_total_interactive_usec += later.tv_usec - now.tv_usec;
+      tile_total_interactive_sec += later.tv_sec - now.tv_sec;
+
+      if (tile_total_interactive_usec < 0)
         {
-          GTimeVal now;
-          GTimeVal later;
+          tile_total_interactive_usec += 1000000;
+          tile_total_interactive_sec--;
+        }
 
-          g_get_current_time(&now);
+      if (tile_total_interactive_usec > 1000000)
+        {
+          tile_total_interactive_usec -= 1000000;
+          tile_total_interactive_sec++;
+        }
 #endif
-          while ((cur_cache_size + tile->size) > max_cache_size)
-            {
-              if (! tile_cache_zorch_next ())
-                {
-                  g_warning ("cache: unable to find room for a tile");
-                  goto out;
-                }
-            }
+    }
 
-#ifdef TILE_PROFILING
-          g_get_current_time (&later);
-          tile_total_interactive_usec += later.tv_usec - now.tv_usec;
-          tile_total_interactive_sec += later.tv_sec - now.tv_sec;
+  TILE_CACHE_LOCK (shard);
 
-          if (tile_total_interactive_usec < 0)
-            {
-              tile_total_interactive_usec += 1000000;
-              tile_total_interactive_sec--;
-            }
+  /* If the tile is already in the cache, we will simply
+   *  place it at the end of the tile list to indicate that
+   *  it was the most recently accessed tile.
+   */
+  if (tile->cached)
+    {
+      /* Tile is in the cache.  Remove it from the list. */
 
-          if (tile_total_interactive_usec > 1000000)
-            {
-              tile_total_interactive_usec -= 1000000;
-              tile_total_interactive_sec++;
-            }
-        }
-#endif
+      if (tile->next)
+        tile->next->prev = tile->prev;
+      else
+        shard->list.last = tile->prev;
+
+      if (tile->prev)
+        tile->prev->next = tile->next;
+      else
+        shard->list.first = tile->next;
 
-      cur_cache_size += tile->size;
-//      g_print("I(%d) ", cur_cache_size);
+      if (PENDING_WRITE (tile))
+        shard->dirty -= tile->size;
+
+      if (tile == shard->idle_scan_last)
+        shard->idle_scan_last = tile->next;
+
+      if (counted)
+        g_atomic_pointer_add (&cur_cache_size, - (gssize) tile->size);
+    }
+  else if (! counted)
+    {
+      g_atomic_pointer_add (&cur_cache_size, tile->size);
     }
 
   /* Put the tile at the end of the proper list */
 
   tile->next = NULL;
-  tile->prev = tile_list.last;
+  tile->prev = shard->list.last;
 
-  if (tile_list.last)
-    tile_list.last->next = tile;
+  if (shard->list.last)
+    shard->list.last->next = tile;
   else
-    tile_list.first = tile;
+    shard->list.first = tile;
 
-  tile_list.last = tile;
+  shard->list.last = tile;
   tile->cached = TRUE;
   idle_delay = 1;
 
-  if (PENDING_WRITE(tile))
+  if (PENDING_WRITE (tile))
     {
-      cur_cache_dirty += tile->size;
+      shard->dirty += tile->size;
+
+      if (! shard->idle_scan_last)
+        shard->idle_scan_last = tile;
 
-      if (! idle_scan_last)
-	idle_scan_last=tile;
+      TILE_CACHE_UNLOCK (shard);
 
       if (! idle_swapper)
-        {
-#ifdef TILE_PROFILING
-	  g_printerr("idle swapper -> started\n");
-	  g_printerr("idle swapper -> waiting");
-#endif
-	  idle_delay = 0;
-          idle_swapper = g_timeout_add_full (G_PRIORITY_LOW,
-                                             IDLE_SWAPPER_START,
-                                             tile_idle_preswap,
-                                             NULL, NULL);
-        }
+        tile_cache_start_idle_swapper ();
+    }
+  else
+    {
+      TILE_CACHE_UNLOCK (shard);
     }
-
-out:
-  TILE_CACHE_UNLOCK;
 }
 
 void
 tile_cache_flush (Tile *tile)
 {
-  TILE_CACHE_LOCK;
+  TileCacheShard *shard = tile_cache_get_shard (tile);
+
+  /* always take the lock, even for a tile which does not look cached:
+   *  an eviction clears tile->cached before it swaps out and frees the
+   *  tile data, and returns the shard lock only when that is done
+   */
+  TILE_CACHE_LOCK (shard);
 
   if (tile->cached)
-    tile_cache_flush_internal (tile);
+    tile_cache_flush_internal (shard, tile);
 
-  TILE_CACHE_UNLOCK;
+  TILE_CACHE_UNLOCK (shard);
 }
 
 void
 tile_cache_set_size (guint64 cache_size)
 {
-  TILE_CACHE_LOCK;
-
   idle_delay = 1;
   max_cache_size = cache_size;
 
-  while (cur_cache_size > max_cache_size)
+  tile_cache_make_room ();
+}
+
+/* Evicts tiles from the shards in turn until the cache fits into
+ * max_cache_size. Returns FALSE if no shard has a tile left to evict.
+ */
+static gboolean
+tile_cache_make_room (void)
+{
+  gint failures = 0;
+
+  while (CACHE_SIZE > max_cache_size)
+    {
+      gint            i     = g_atomic_int_add (&zorch_shard, 1);
+      TileCacheShard *shard = &shards[i & (TILE_CACHE_N_SHARDS - 1)];
+      gint            count;
+
+      TILE_CACHE_LOCK (shard);
+      count = tile_cache_zorch_shard (shard);
+      TILE_CACHE_UNLOCK (shard);
+
+      if (count > 0)
+        failures = 0;
+      else if (++failures >= TILE_CACHE_N_SHARDS)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Evicts up to TILE_CACHE_ZORCH_BATCH of the least recently used tiles
+ * of shard, stopping early once the cache fits into max_cache_size.
+ */
+static gint
+tile_cache_zorch_shard (TileCacheShard *shard)
+{
+  gint count = 0;
+
+  while (count < TILE_CACHE_ZORCH_BATCH &&
+         CACHE_SIZE > max_cache_size)
     {
-      if (! tile_cache_zorch_next ())
+      if (! tile_cache_zorch_next (shard))
         break;
+
+      count++;
     }
 
-  TILE_CACHE_UNLOCK;
+  return count;
 }
 
 static void
-tile_cache_flush_internal (Tile *tile)
+tile_cache_flush_internal (TileCacheShard *shard,
+                           Tile           *tile)
 {
   tile->cached = FALSE;
 
-  if (PENDING_WRITE(tile))
-    cur_cache_dirty -= tile->size;
+  if (PENDING_WRITE (tile))
+    shard->dirty -= tile->size;
 
-  cur_cache_size -= tile->size;
+  g_atomic_pointer_add (&cur_cache_size, - (gssize) tile->size);
 
   if (tile->next)
     tile->next->prev = tile->prev;
   else
-    tile_list.last = tile->prev;
+    shard->list.last = tile->prev;
 
   if (tile->prev)
     tile->prev->next = tile->next;
   else
-    tile_list.first = tile->next;
+    shard->list.first = tile->next;
 
-  if (tile == idle_scan_last)
-    idle_scan_last = tile->next;
+  if (tile == shard->idle_scan_last)
+    shard->idle_scan_last = tile->next;
 
   tile->next = tile->prev = NULL;
 }
 
 static gboolean
-tile_cache_zorch_next (void)
+tile_cache_zorch_next (TileCacheShard *shard)
 {
-
-  Tile *tile = tile_list.first;
+  Tile *tile = shard->list.first;
 
   if (! tile)
     return FALSE;
@@ -324,17 +452,19 @@ tile_cache_zorch_next (void)
     }
 #endif
 
-  tile_cache_flush_internal (tile);
+  tile_cache_flush_internal (shard, tile);
 
   if (PENDING_WRITE (tile))
     {
       idle_delay = 1;
+
+      TILE_SWAP_LOCK;
       tile_swap_out (tile);
+      TILE_SWAP_UNLOCK;
     }
 
   if (! tile->dirty)
     {
-//      g_print("Z:");
       g_free (tile->data);
       tile->data = NULL;
 
@@ -348,11 +478,35 @@ tile_cache_zorch_next (void)
   return FALSE;
 }
 
+/* Starts the idle swapper, which can be asked for by any thread
+ * inserting a tile.
+ */
+static void
+tile_cache_start_idle_swapper (void)
+{
+  IDLE_LOCK;
+
+  if (! idle_swapper)
+    {
+#ifdef TILE_PROFILING
+      g_printerr("idle swapper -> started\n");
+      g_printerr("idle swapper -> waiting");
+#endif
+      idle_delay = 0;
+      idle_swapper = g_timeout_add_full (G_PRIORITY_LOW,
+                                         IDLE_SWAPPER_START,
+                                         tile_idle_preswap,
+                                         NULL, NULL);
+    }
+
+  IDLE_UNLOCK;
+}
+
 static gboolean
 tile_idle_preswap_run (gpointer data)
 {
-  Tile *tile;
-  int count = 0;
+  gint count = 0;
+  gint i;
 
   if (idle_delay)
     {
@@ -360,60 +514,76 @@ tile_idle_preswap_run (gpointer data)
       g_printerr("\nidle swapper -> waiting");
 #endif
 
+      IDLE_LOCK;
       idle_delay = 0;
       idle_swapper = g_timeout_add_full (G_PRIORITY_LOW,
                                          IDLE_SWAPPER_START,
                                          tile_idle_preswap,
                                          NULL, NULL);
+      IDLE_UNLOCK;
       return FALSE;
     }
 
-  TILE_CACHE_LOCK;
-
 #ifdef TILE_PROFILING
   g_printerr(".");
 #endif
 
-  tile = idle_scan_last;
-
-  while (tile)
+  /* continue with the shard where the last interval stopped */
+  for (i = 0; i < TILE_CACHE_N_SHARDS; i++)
     {
-      if (PENDING_WRITE (tile))
+      TileCacheShard *shard = &shards[idle_shard];
+      Tile           *tile;
+
+      TILE_CACHE_LOCK (shard);
+
+      tile = shard->idle_scan_last;
+
+      while (tile)
         {
-          idle_scan_last = tile->next;
+          if (PENDING_WRITE (tile))
+            {
+              shard->idle_scan_last = tile->next;
 
 #ifdef TILE_PROFILING
-          tile_idle_swapout++;
+              tile_idle_swapout++;
 #endif
-          tile_swap_out (tile);
+              TILE_SWAP_LOCK;
+              tile_swap_out (tile);
+              TILE_SWAP_UNLOCK;
 
-          if (! PENDING_WRITE(tile))
-            cur_cache_dirty -= tile->size;
+              if (! PENDING_WRITE (tile))
+                shard->dirty -= tile->size;
 
-          count++;
-          if (count >= IDLE_SWAPPER_TILES_PER_INTERVAL)
-            {
-              TILE_CACHE_UNLOCK;
-              return TRUE;
+              count++;
+              if (count >= IDLE_SWAPPER_TILES_PER_INTERVAL)
+                {
+                  TILE_CACHE_UNLOCK (shard);
+                  return TRUE;
+                }
             }
+
+          tile = tile->next;
         }
 
-      tile = tile->next;
+      shard->idle_scan_last = NULL;
+
+      TILE_CACHE_UNLOCK (shard);
+
+      idle_shard = (idle_shard + 1) % TILE_CACHE_N_SHARDS;
     }
 
 #ifdef TILE_PROFILING
   g_printerr ("\nidle swapper -> stopped\n");
 #endif
 
-  idle_scan_last = NULL;
+  IDLE_LOCK;
   idle_swapper = 0;
+  IDLE_UNLOCK;
 
 #ifdef TILE_PROFILING
   tile_verify ();
 #endif
 
-  TILE_CACHE_UNLOCK;
-
   return FALSE;
 }
 
@@ -434,10 +604,12 @@ tile_idle_preswap (gpointer data)
   g_printerr("\nidle swapper -> running");
 #endif
 
+  IDLE_LOCK;
   idle_swapper = g_timeout_add_full (G_PRIORITY_LOW,
 				     IDLE_SWAPPER_INTERVAL_MS,
 				     tile_idle_preswap_run,
 				     NULL, NULL);
+  IDLE_UNLOCK;
   return FALSE;
 }
 
@@ -445,40 +617,50 @@ tile_idle_preswap (gpointer data)
 static void
 tile_verify (void)
 {
-  /* scan list linearly, count metrics, compare to running totals */
-  const Tile *t;
-  guint64     local_size  = 0;
-  guint64     local_dirty = 0;
-  guint64     acc         = 0;
+  /* scan the lists linearly, count metrics, compare to running totals */
+  guint64 local_size = 0;
+  gint    i;
 
-  for (t = tile_list.first; t; t = t->next)
+  for (i = 0; i < TILE_CACHE_N_SHARDS; i++)
     {
-      local_size += t->size;
+      TileCacheShard *shard       = &shards[i];
+      const Tile     *t;
+      guint64         local_dirty = 0;
+      guint64         acc         = 0;
 
-      if (PENDING_WRITE (t))
-        local_dirty += t->size;
-    }
+      TILE_CACHE_LOCK (shard);
 
-  if (local_size != cur_cache_size)
-    g_printerr ("\nCache size mismatch: running=%"G_GUINT64_FORMAT
-                ", tested=%"G_GUINT64_FORMAT"\n",
-                cur_cache_size,local_size);
+      for (t = shard->list.first; t; t = t->next)
+        {
+          local_size += t->size;
 
-  if (local_dirty != cur_cache_dirty)
-    g_printerr ("\nCache dirty mismatch: running=%"G_GUINT64_FORMAT
-                ", tested=%"G_GUINT64_FORMAT"\n",
-                cur_cache_dirty,local_dirty);
+          if (PENDING_WRITE (t))
+            local_dirty += t->size;
+        }
 
-  /* scan forward from scan list */
-  for (t = idle_scan_last; t; t = t->next)
-    {
-      if (PENDING_WRITE (t))
-        acc += t->size;
+      if (local_dirty != shard->dirty)
+        g_printerr ("\nCache dirty mismatch in shard %d: running=%"G_GUINT64_FORMAT
+                    ", tested=%"G_GUINT64_FORMAT"\n",
+                    i, shard->dirty, local_dirty);
+
+      /* scan forward from scan list */
+      for (t = shard->idle_scan_last; t; t = t->next)
+        {
+          if (PENDING_WRITE (t))
+            acc += t->size;
+        }
+
+      if (acc != local_dirty)
+        g_printerr ("\nDirty scan follower mismatch in shard %d: running=%"G_GUINT64_FORMAT
+                    ", tested=%"G_GUINT64_FORMAT"\n",
+                    i, acc, local_dirty);
+
+      TILE_CACHE_UNLOCK (shard);
     }
 
-  if (acc != local_dirty)
-    g_printerr ("\nDirty scan follower mismatch: running=%"G_GUINT64_FORMAT
+  if (local_size != CACHE_SIZE)
+    g_printerr ("\nCache size mismatch: running=%"G_GUINT64_FORMAT
                 ", tested=%"G_GUINT64_FORMAT"\n",
-                acc,local_dirty);
+                CACHE_SIZE, local_size);
 }
 #endif
@@ -34,9 +34,14 @@ struct _TileManager
   TileValidateProc   validate_proc; /*  this proc is called when an attempt  *
                                      *  to get an invalid tile is made       */
   gpointer           user_data;     /*  data to pass to the validate_proc    */
+  GDestroyNotify     user_data_destroy; /*  frees user_data                  */
 
   gint               cached_num;    /*  number of cached tile                */
   Tile              *cached_tile;   /*  the actual cached tile               */
+
+  guint8            *written;       /*  tiles written since tracking started */
+  gpointer           tracked_data;  /*  data kept with the tracking          */
+  GDestroyNotify     tracked_data_destroy;
 };
 
 
@@ -155,6 +155,14 @@ tile_manager_unref (TileManager *tm)
           g_free (tm->tiles);
         }
 
+      if (tm->user_data_destroy)
+        tm->user_data_destroy (tm->user_data);
+
+      if (tm->tracked_data_destroy)
+        tm->tracked_data_destroy (tm->tracked_data);
+
+      g_free (tm->written);
+
       g_slice_free (TileManager, tm);
     }
 //  g_print(">tile_manager_unref\n");
@@ -192,10 +200,73 @@ tile_manager_set_validate_proc (TileManager      *tm,
                                 TileValidateProc  proc,
                                 gpointer          user_data)
 {
+  tile_manager_set_validate_proc_full (tm, proc, user_data, NULL);
+}
+
+void
+tile_manager_set_validate_proc_full (TileManager      *tm,
+                                     TileValidateProc  proc,
+                                     gpointer          user_data,
+                                     GDestroyNotify    destroy)
+{
+  GDestroyNotify old_destroy;
+  gpointer       old_user_data;
+
   g_return_if_fail (tm != NULL);
 
-  tm->validate_proc = proc;
-  tm->user_data     = user_data;
+  old_destroy   = tm->user_data_destroy;
+  old_user_data = tm->user_data;
+
+  tm->validate_proc     = proc;
+  tm->user_data         = user_data;
+  tm->user_data_destroy = destroy;
+
+  if (old_destroy)
+    old_destroy (old_user_data);
+}
+
+void
+tile_manager_track_writes (TileManager    *tm,
+                           gpointer        data,
+                           GDestroyNotify  destroy)
+{
+  GDestroyNotify old_destroy;
+  gpointer       old_data;
+
+  g_return_if_fail (tm != NULL);
+
+  old_destroy = tm->tracked_data_destroy;
+  old_data    = tm->tracked_data;
+
+  g_free (tm->written);
+
+  tm->written              = g_new0 (guint8, tm->ntile_rows * tm->ntile_cols);
+  tm->tracked_data         = data;
+  tm->tracked_data_destroy = destroy;
+
+  if (old_destroy)
+    old_destroy (old_data);
+}
+
+gpointer
+tile_manager_get_tracked_data (TileManager *tm)
+{
+  g_return_val_if_fail (tm != NULL, NULL);
+
+  return tm->tracked_data;
+}
+
+gboolean
+tile_manager_tile_written (TileManager *tm,
+                           gint         tile_num)
+{
+  g_return_val_if_fail (tm != NULL, TRUE);
+
+  if (! tm->written ||
+      tile_num < 0 || tile_num >= tm->ntile_rows * tm->ntile_cols)
+    return TRUE;
+
+  return tm->written[tile_num];
 }
 
 Tile *
@@ -302,6 +373,9 @@ tile_manager_get (TileManager *tm,
 	  tile_lock (tile);
           tile->write_count++;
           tile->dirty = TRUE;
+
+          if (tm->written)
+            tm->written[tile_num] = TRUE;
         }
       else
         {
@@ -405,6 +479,9 @@ tile_manager_invalidate_tile (TileManager  *tm,
   if (! tile->valid)
     return;
 
+  if (tm->written)
+    tm->written[tile_num] = TRUE;
+
   if (tile_num == tm->cached_num)
     {
       tile_release (tm->cached_tile, FALSE);
@@ -501,6 +578,9 @@ tile_manager_map (TileManager *tm,
 
   tile = tm->tiles[tile_num];
 
+  if (tm->written)
+    tm->written[tile_num] = TRUE;
+
 #ifdef DEBUG_TILE_MANAGER
   g_printerr (")");
 #endif
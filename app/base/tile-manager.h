@@ -51,6 +51,28 @@ void          tile_manager_set_validate_proc (TileManager      *tm,
                                               TileValidateProc  proc,
                                               gpointer          user_data);
 
+/* Like tile_manager_set_validate_proc(), destroy is called on user_data
+ *  when the procedure is replaced or the tile manager is destroyed.
+ */
+void     tile_manager_set_validate_proc_full (TileManager      *tm,
+                                              TileValidateProc  proc,
+                                              gpointer          user_data,
+                                              GDestroyNotify    destroy);
+
+/* Start recording which tiles are written to, replacing an earlier
+ *  record.  data is kept with the record and destroyed along with it.
+ */
+void          tile_manager_track_writes      (TileManager      *tm,
+                                              gpointer          data,
+                                              GDestroyNotify    destroy);
+gpointer      tile_manager_get_tracked_data  (TileManager      *tm);
+
+/* Returns TRUE if the tile was written to, mapped or invalidated since
+ *  tile_manager_track_writes(), or if writes are not tracked.
+ */
+gboolean      tile_manager_tile_written      (TileManager      *tm,
+                                              gint              tile_num);
+
 /* Get a specified tile from a tile manager.
  */
 Tile        * tile_manager_get_tile          (TileManager *tm,
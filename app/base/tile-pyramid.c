@@ -26,9 +26,6 @@
 #include "tile-pyramid.h"
 
 
-#define PYRAMID_MAX_LEVELS  10
-
-
 struct _TilePyramid
 {
   GimpImageType  type;
@@ -19,6 +19,9 @@
 #define __TILE_PYRAMID_H__
 
 
+#define PYRAMID_MAX_LEVELS  10
+
+
 /* Creates a new tile pyramid with the specified size for the
  *  toplevel. The toplevel size is used to compute the number of
  *  levels and their size. Each level is 1/2 the width and height of
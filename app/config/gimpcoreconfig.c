@@ -104,6 +104,9 @@ enum
   PROP_COLOR_MANAGEMENT,
   PROP_COLOR_PROFILE_POLICY,
   PROP_SAVE_DOCUMENT_HISTORY,
+  PROP_XCF_FAST_COMPRESSION,
+  PROP_XCF_LAZY_LOADING,
+  PROP_XCF_INCREMENTAL_SAVE,
   PROP_QUICK_MASK_COLOR,
   PROP_USE_GEGL,
 
@@ -464,6 +467,21 @@ gimp_core_config_class_init (GimpCoreConfigClass *klass)
                                     SAVE_DOCUMENT_HISTORY_BLURB,
                                     TRUE,
                                     GIMP_PARAM_STATIC_STRINGS);
+  GIMP_CONFIG_INSTALL_PROP_BOOLEAN (object_class, PROP_XCF_FAST_COMPRESSION,
+                                    "xcf-fast-compression",
+                                    XCF_FAST_COMPRESSION_BLURB,
+                                    FALSE,
+                                    GIMP_PARAM_STATIC_STRINGS);
+  GIMP_CONFIG_INSTALL_PROP_BOOLEAN (object_class, PROP_XCF_LAZY_LOADING,
+                                    "xcf-lazy-loading",
+                                    XCF_LAZY_LOADING_BLURB,
+                                    FALSE,
+                                    GIMP_PARAM_STATIC_STRINGS);
+  GIMP_CONFIG_INSTALL_PROP_BOOLEAN (object_class, PROP_XCF_INCREMENTAL_SAVE,
+                                    "xcf-incremental-save",
+                                    XCF_INCREMENTAL_SAVE_BLURB,
+                                    FALSE,
+                                    GIMP_PARAM_STATIC_STRINGS);
   GIMP_CONFIG_INSTALL_PROP_RGB (object_class, PROP_QUICK_MASK_COLOR,
                                 "quick-mask-color", QUICK_MASK_COLOR_BLURB,
                                 TRUE, &red,
@@ -761,6 +779,15 @@ gimp_core_config_set_property (GObject      *object,
     case PROP_SAVE_DOCUMENT_HISTORY:
       core_config->save_document_history = g_value_get_boolean (value);
       break;
+    case PROP_XCF_FAST_COMPRESSION:
+      core_config->xcf_fast_compression = g_value_get_boolean (value);
+      break;
+    case PROP_XCF_LAZY_LOADING:
+      core_config->xcf_lazy_loading = g_value_get_boolean (value);
+      break;
+    case PROP_XCF_INCREMENTAL_SAVE:
+      core_config->xcf_incremental_save = g_value_get_boolean (value);
+      break;
     case PROP_QUICK_MASK_COLOR:
       gimp_value_get_rgb (value, &core_config->quick_mask_color);
       break;
@@ -944,6 +971,15 @@ gimp_core_config_get_property (GObject    *object,
     case PROP_SAVE_DOCUMENT_HISTORY:
       g_value_set_boolean (value, core_config->save_document_history);
       break;
+    case PROP_XCF_FAST_COMPRESSION:
+      g_value_set_boolean (value, core_config->xcf_fast_compression);
+      break;
+    case PROP_XCF_LAZY_LOADING:
+      g_value_set_boolean (value, core_config->xcf_lazy_loading);
+      break;
+    case PROP_XCF_INCREMENTAL_SAVE:
+      g_value_set_boolean (value, core_config->xcf_incremental_save);
+      break;
     case PROP_QUICK_MASK_COLOR:
       gimp_value_set_rgb (value, &core_config->quick_mask_color);
       break;
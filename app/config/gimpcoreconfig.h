@@ -91,6 +91,9 @@ struct _GimpCoreConfig
   GimpColorConfig        *color_management;
   GimpColorProfilePolicy  color_profile_policy;
   gboolean                save_document_history;
+  gboolean                xcf_fast_compression;
+  gboolean                xcf_lazy_loading;
+  gboolean                xcf_incremental_save;
   GimpRGB                 quick_mask_color;
   gboolean                use_gegl;
 };
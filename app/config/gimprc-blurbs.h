@@ -475,6 +475,19 @@ N_("When enabled, pressing F1 will open the help browser.")
 "The location of the online user manual. This is used if " \
 "'user-manual-online' is enabled."
 
+#define XCF_FAST_COMPRESSION_BLURB \
+N_("Save XCF files with a faster compression, which also makes most " \
+   "images smaller. Such files can not be opened by older versions of " \
+   "GIMP.")
+
+#define XCF_INCREMENTAL_SAVE_BLURB \
+N_("When saving XCF files, copy the tiles which did not change since the " \
+   "file was opened or saved instead of compressing them again.")
+
+#define XCF_LAZY_LOADING_BLURB \
+N_("Load the layers of XCF files only when they are used. The file must " \
+   "not be changed by other programs while the image is open.")
+
 #define ZOOM_QUALITY_BLURB \
 "There's a tradeoff between speed and quality of the zoomed-out display."
 
@@ -45,6 +45,8 @@ extern "C" {
 #include "gimp.h"
 #include "pdb/gimppdb.h"
 
+#include "gimparea.h"
+
 #include "gimpimage.h"
 #include "gimpimage-undo.h"
 #include "gimpitem.h"
@@ -92,6 +94,14 @@ struct CloneLayer : virtual public ImplBase, virtual public CloneLayerInterface
   CXXPointer<Delegators::Connection> update_conn;
   CString          source_name;
 
+  // Updates of the source are collected and propagated from an idle
+  // handler, which serves all clone layers at once.
+  GSList*          pending_areas;  // of GimpArea, in layer coords
+
+  static GList*    dirty_clones;
+  static guint     flush_idle_id;
+  static bool      flushing;
+
   static void class_init(Traits<GimpCloneLayer>::Class* klass);
   template<typename IFaceClass> static void iface_init(IFaceClass* klass);
 
@@ -165,8 +175,43 @@ struct CloneLayer : virtual public ImplBase, virtual public CloneLayerInterface
                                         gint          height);
 private:
   void                invalidate_layer ();
+  bool                can_share_tiles  (GimpDrawable* source);
+  void                share_tiles      (TileManager*  src_tiles,
+                                        TileManager*  dest_tiles,
+                                        gint          x,
+                                        gint          y,
+                                        gint          width,
+                                        gint          height);
+  void                add_pending_area (gint          x,
+                                        gint          y,
+                                        gint          width,
+                                        gint          height);
+  void                flush_pending    ();
+  void                drop_pending     ();
+  void                copy_from_source (GimpDrawable* source,
+                                        gint          x,
+                                        gint          y,
+                                        gint          width,
+                                        gint          height);
+
+  static gboolean     flush_idle       (gpointer      data);
+  static void       on_source_disposed (gpointer      data,
+                                        GObject*      source);
+  static bool         depends_on       (GimpLayer*    layer,
+                                        GimpLayer*    clone);
+  static bool         depends_on       (GimpLayer*    layer,
+                                        GimpLayer*    clone,
+                                        GHashTable*   visited);
 };
 
+GList* CloneLayer::dirty_clones  = NULL;
+guint  CloneLayer::flush_idle_id = 0;
+bool   CloneLayer::flushing      = false;
+
+// Same as GIMP_PROJECTION_IDLE_PRIORITY, so that a busy source can not
+// keep the projection from rendering
+const gint CLONE_LAYER_FLUSH_PRIORITY = G_PRIORITY_HIGH_IDLE + 50;
+
 
 extern const char gimp_clone_layer_name[] = "GimpCloneLayer";
 using Class = NewGClass<gimp_clone_layer_name,
@@ -252,14 +297,19 @@ void CloneLayer::iface_init<GimpPickableInterface>(GimpPickableInterface* klass)
 
 GLib::CloneLayer::~CloneLayer()
 {
+  if (source_layer)
+    g_object_weak_unref(G_OBJECT(source_layer), on_source_disposed, this);
+  drop_pending();
 }
 
 GLib::CloneLayer::CloneLayer(GObject* o) : ImplBase(o)
 {
 //  parent_changed_conn = g_signal_connect_delegator (G_OBJECT(g_object), "parent-changed",
 //                                                    Delegators::delegator(this, &GLib::CloneLayer::on_parent_changed));
+  source_layer        = NULL;
   reorder_conn        = NULL;
   update_conn         = NULL;
+  pending_areas       = NULL;
   prev_x              = 0;
   prev_y              = 0;
   prev_w              = 0;
@@ -274,14 +324,24 @@ void GLib::CloneLayer::constructed ()
 
 void GLib::CloneLayer::set_source(GimpLayer* layer)
 {
+  // a source made of the clone itself would update it forever
+  if (layer && depends_on(layer, GIMP_LAYER(g_object))) {
+    g_message("'%s' can not clone '%s', which is made from it.",
+              gimp_object_get_name(g_object), gimp_object_get_name(layer));
+    return;
+  }
+
   if (source_layer) {
+    g_object_weak_unref(G_OBJECT(source_layer), on_source_disposed, this);
     update_conn = NULL;
     source_layer = NULL;
+    drop_pending();
   }
   if (layer) {
     update_conn = g_signal_connect_delegator (G_OBJECT(layer), "update",
         Delegators::delegator(this, &GLib::CloneLayer::on_source_update));
     source_layer = layer;
+    g_object_weak_ref(G_OBJECT(layer), on_source_disposed, this);
     auto src  = ref(layer);
     gint w, h;
     w = src [gimp_item_get_width] ();
@@ -498,6 +558,81 @@ void GLib::CloneLayer::on_parent_changed (GimpViewable  *viewable,
   // Check for loop
 }
 
+// Whether projecting source with combine == FALSE gives its pixels
+// unchanged, so that the clone can use the tiles of source instead.
+bool GLib::CloneLayer::can_share_tiles (GimpDrawable* source)
+{
+  GimpDrawableClass* layer_class =
+    GIMP_DRAWABLE_CLASS(g_type_class_peek(GIMP_TYPE_LAYER));
+
+  // group and filter layers project something else than their tiles
+  if (GIMP_DRAWABLE_GET_CLASS(source)->project_region != layer_class->project_region)
+    return false;
+
+  GimpLayer*     layer = GIMP_LAYER(source);
+  GimpLayerMask* mask  = gimp_layer_get_mask(layer);
+  TileManager*   src   = gimp_drawable_get_tiles(source);
+  TileManager*   dest  = gimp_drawable_get_tiles(GIMP_DRAWABLE(g_object));
+
+  if (gimp_drawable_type(source) != gimp_drawable_type(GIMP_DRAWABLE(g_object)) ||
+      GIMP_IMAGE_TYPE_IS_INDEXED(gimp_drawable_type(source))                    ||
+      tile_manager_width(src)  != tile_manager_width(dest)                      ||
+      tile_manager_height(src) != tile_manager_height(dest))
+    return false;
+
+  if (mask && (gimp_layer_mask_get_apply(mask) || gimp_layer_mask_get_show(mask)))
+    return false;
+
+  if (gimp_layer_get_opacity(layer) != GIMP_OPACITY_OPAQUE ||
+      gimp_layer_get_mode(layer)    == GIMP_DISSOLVE_MODE  ||
+      gimp_drawable_get_floating_sel(source))
+    return false;
+
+  gboolean visible[MAX_CHANNELS];
+  gimp_image_get_visible_array(gimp_item_get_image(GIMP_ITEM(source)), visible);
+  for (gint i = 0; i < gimp_drawable_bytes(source); i ++)
+    if (!visible[i])
+      return false;
+
+  return true;
+}
+
+// Maps the tiles of src_tiles which intersect the area into dest_tiles.
+// The tiles are shared copy-on-write, the source gets a private copy of
+// a tile when it is painted on, and the following update maps it again.
+void GLib::CloneLayer::share_tiles (TileManager* src_tiles,
+                                    TileManager* dest_tiles,
+                                    gint         x,
+                                    gint         y,
+                                    gint         width,
+                                    gint         height)
+{
+  // the area may reach beyond the tile managers, whose tiles are NULL
+  if (!gimp_rectangle_intersect(x, y, width, height,
+                                0, 0,
+                                tile_manager_width(src_tiles),
+                                tile_manager_height(src_tiles),
+                                &x, &y, &width, &height) ||
+      !gimp_rectangle_intersect(x, y, width, height,
+                                0, 0,
+                                tile_manager_width(dest_tiles),
+                                tile_manager_height(dest_tiles),
+                                &x, &y, &width, &height))
+    return;
+
+  for (gint ty = y - y % TILE_HEIGHT; ty < y + height; ty += TILE_HEIGHT) {
+    for (gint tx = x - x % TILE_WIDTH; tx < x + width; tx += TILE_WIDTH) {
+      Tile* tile = tile_manager_get_tile(src_tiles, tx, ty, TRUE, FALSE);
+
+      if (!tile)
+        continue;
+
+      tile_manager_map_tile(dest_tiles, tx, ty, tile);
+      tile_release(tile, FALSE);
+    }
+  }
+}
+
 void GLib::CloneLayer::on_source_update (GimpDrawable* _source,
                                          gint            x,
                                          gint            y,
@@ -508,6 +643,11 @@ void GLib::CloneLayer::on_source_update (GimpDrawable* _source,
            G_STRFUNC, gimp_object_get_name (g_object),
            x, y, width, height);
 
+  // the clone was moved into the group it clones, its own updates
+  // come back through the group
+  if (depends_on(GIMP_LAYER(_source), GIMP_LAYER(g_object)))
+    return;
+
   auto self   = ref(g_object);
   auto source = ref(_source);
   gint src_width  = source [gimp_item_get_width]  ();
@@ -524,7 +664,6 @@ void GLib::CloneLayer::on_source_update (GimpDrawable* _source,
   gint src_offset_x = source [gimp_item_get_offset_x]();
   gint src_offset_y = source [gimp_item_get_offset_y]();
 
-  source_layer = source;
   if (prev_w != src_width || prev_h != src_height) {
     gint src_offset_diff_x = src_offset_x - prev_x;
     gint src_offset_diff_y = src_offset_y - prev_y;
@@ -535,16 +674,201 @@ void GLib::CloneLayer::on_source_update (GimpDrawable* _source,
   prev_x = src_offset_x;
   prev_y = src_offset_y;
 
+  add_pending_area(x, y, width, height);
+}
+
+void GLib::CloneLayer::add_pending_area (gint x,
+                                         gint y,
+                                         gint width,
+                                         gint height)
+{
+  if (width <= 0 || height <= 0)
+    return;
+
+  pending_areas = gimp_area_list_process(pending_areas,
+                                         gimp_area_new(x, y, x + width, y + height));
+
+  if (!g_list_find(dirty_clones, this))
+    dirty_clones = g_list_append(dirty_clones, this);
+
+  // a pass in progress picks the clone up by itself
+  if (!flush_idle_id && !flushing)
+    flush_idle_id = g_idle_add_full(CLONE_LAYER_FLUSH_PRIORITY,
+                                    flush_idle, NULL, NULL);
+}
+
+// Propagates the pending areas of all clone layers. Clones are visited
+// in topological order, a clone of a clone after its source, so that the
+// areas the source emits are picked up in the same pass. Each clone is
+// flushed at most once per pass, a clone dirtied again by a later one
+// waits for the next pass. Cycles of clones are refused, see
+// depends_on().
+gboolean GLib::CloneLayer::flush_idle (gpointer data)
+{
+  GHashTable* flushed = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  flush_idle_id = 0;
+  flushing      = true;
+
+  while (true) {
+    GList* ready = NULL;
+    GList* first = NULL;
+
+    for (GList* list = dirty_clones; list && !ready; list = g_list_next(list)) {
+      CloneLayer* clone  = (CloneLayer*) list->data;
+      GimpLayer*  source = clone->source_layer;
+
+      if (g_hash_table_lookup(flushed, clone))
+        continue;
+
+      if (!first)
+        first = list;
+
+      if (!source || !CloneLayerInterface::is_instance(source))
+        ready = list;
+      else {
+        CloneLayer* source_clone =
+          dynamic_cast<CloneLayer*>(CloneLayerInterface::cast(source));
+
+        if (!g_list_find(dirty_clones, source_clone) ||
+            g_hash_table_lookup(flushed, source_clone))
+          ready = list;
+      }
+    }
+
+    // only reached with a cycle depends_on() did not catch
+    if (!ready)
+      ready = first;
+
+    if (!ready)
+      break;
+
+    CloneLayer* clone = (CloneLayer*) ready->data;
+    dirty_clones = g_list_delete_link(dirty_clones, ready);
+    g_hash_table_insert(flushed, clone, clone);
+    clone->flush_pending();
+  }
+
+  flushing = false;
+
+  g_hash_table_destroy(flushed);
+
+  if (dirty_clones)
+    flush_idle_id = g_idle_add_full(CLONE_LAYER_FLUSH_PRIORITY,
+                                    flush_idle, NULL, NULL);
+
+  return FALSE;
+}
+
+void GLib::CloneLayer::flush_pending ()
+{
+  GSList* areas = pending_areas;
+  pending_areas = NULL;
+
+  // a source removed from the image, e.g. by an undo, is not copied
+  if (source_layer                                   &&
+      gimp_item_is_attached(GIMP_ITEM(g_object))     &&
+      gimp_item_is_attached(GIMP_ITEM(source_layer))) {
+    for (GSList* list = areas; list; list = g_slist_next(list)) {
+      GimpArea* area = (GimpArea*) list->data;
+
+      copy_from_source(GIMP_DRAWABLE(source_layer),
+                       area->x1, area->y1,
+                       area->x2 - area->x1, area->y2 - area->y1);
+    }
+  }
+
+  gimp_area_list_free(areas);
+}
+
+void GLib::CloneLayer::drop_pending ()
+{
+  gimp_area_list_free(pending_areas);
+  pending_areas = NULL;
+  dirty_clones  = g_list_remove(dirty_clones, this);
+
+  if (!dirty_clones && flush_idle_id) {
+    g_source_remove(flush_idle_id);
+    flush_idle_id = 0;
+  }
+}
+
+// The source is disposed, the signal handlers of it are gone already.
+void GLib::CloneLayer::on_source_disposed (gpointer data,
+                                           GObject* source)
+{
+  CloneLayer* clone = (CloneLayer*) data;
+
+  clone->update_conn  = NULL;
+  clone->source_layer = NULL;
+  clone->drop_pending();
+}
+
+// Whether the pixels of layer are made from the ones of clone, as they
+// are when layer is clone, a group containing it, or a clone of either.
+bool GLib::CloneLayer::depends_on (GimpLayer* layer,
+                                   GimpLayer* clone)
+{
+  GHashTable* visited = g_hash_table_new(g_direct_hash, g_direct_equal);
+  bool        result  = depends_on(layer, clone, visited);
+
+  g_hash_table_destroy(visited);
+  return result;
+}
+
+// visited holds the layers seen already, other clones moved into their
+// source group make cycles too
+bool GLib::CloneLayer::depends_on (GimpLayer*  layer,
+                                   GimpLayer*  clone,
+                                   GHashTable* visited)
+{
+  if (layer == clone)
+    return true;
+
+  if (g_hash_table_lookup(visited, layer))
+    return false;
+  g_hash_table_insert(visited, layer, layer);
+
+  if (CloneLayerInterface::is_instance(layer)) {
+    CloneLayer* layer_clone =
+      dynamic_cast<CloneLayer*>(CloneLayerInterface::cast(layer));
+
+    return layer_clone->source_layer &&
+           depends_on(layer_clone->source_layer, clone, visited);
+  }
+
+  GimpContainer* children = gimp_viewable_get_children(GIMP_VIEWABLE(layer));
+  if (children) {
+    gint n_children = gimp_container_get_n_children(children);
+
+    for (gint i = 0; i < n_children; i ++) {
+      GimpObject* child = gimp_container_get_child_by_index(children, i);
+
+      if (GIMP_IS_LAYER(child) && depends_on(GIMP_LAYER(child), clone, visited))
+        return true;
+    }
+  }
+  return false;
+}
+
+void GLib::CloneLayer::copy_from_source (GimpDrawable* _source,
+                                         gint          x,
+                                         gint          y,
+                                         gint          width,
+                                         gint          height)
+{
+  auto self   = ref(g_object);
+  auto source = ref(_source);
+
   PixelRegion destPR;
   gint swidth, sheight;
   swidth  = self [gimp_item_get_width] ();
   sheight = self [gimp_item_get_height] ();
 
-  if (swidth < width || sheight < height) {
-    g_print("src(w,h)=%d,%d, self(w,h)=%d,%d\n", width, height, swidth, sheight);
-    width  = MIN(width,  swidth);
-    height = MIN(height, sheight);
-  }
+  // merged areas may reach beyond a layer which shrank meanwhile
+  if (!gimp_rectangle_intersect(x, y, width, height, 0, 0, swidth, sheight,
+                                &x, &y, &width, &height))
+    return;
 
   TileManager* dest_tiles = self [gimp_drawable_get_tiles] ();
   if (dest_tiles->width != swidth || dest_tiles->height != sheight) {
@@ -556,25 +880,14 @@ void GLib::CloneLayer::on_source_update (GimpDrawable* _source,
     return;
   }
   g_print("Copy=%d,%d\n", width, height);
-  pixel_region_init (&destPR, dest_tiles, x, y, width, height, TRUE);
-/*
-  GimpImageType self_type   = self [gimp_drawable_type] ();
-  GimpImageType source_type = source [gimp_drawable_type] ();
-
-  if (self_type == source_type) {
-    PixelRegion srcPR;
-    TileManager* src_tiles  = source [gimp_drawable_get_tiles] ();
-    g_print("x,y,w,h=%d,%d,%d,%d\n", x, y, width, height);
-    if (src_tiles && dest_tiles) {
-      pixel_region_init (&srcPR,  src_tiles,  x, y, width, height, FALSE);
-      copy_region_nocow(&srcPR, &destPR);
-    }
 
+  if (can_share_tiles(_source)) {
+    share_tiles(source [gimp_drawable_get_tiles] (), dest_tiles,
+                x, y, width, height);
   } else {
+    pixel_region_init (&destPR, dest_tiles, x, y, width, height, TRUE);
     source [gimp_drawable_project_region] (x, y, width, height, &destPR, FALSE);
   }
-*/
-  source [gimp_drawable_project_region] (x, y, width, height, &destPR, FALSE);
 
   self [gimp_drawable_update] (x, y, width, height);
 }
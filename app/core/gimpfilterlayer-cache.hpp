@@ -0,0 +1,159 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GIMP_FILTER_LAYER_CACHE_HPP__
+#define __GIMP_FILTER_LAYER_CACHE_HPP__
+
+// Results of filter layers, keyed by the content of their input and the
+// procedure which filtered it.
+//
+// The cache is shared by all filter layers of all images, so toggling,
+// reordering or duplicating a filter layer finds the result of an
+// earlier run. Results are kept as tile managers sharing their tiles
+// copy-on-write with the layer, so neither storing nor restoring copies
+// pixels, and tiles which do not fit into the tile cache are swapped
+// out like any other tiles.
+
+// Upper bound of the tiles kept by the cache, least recently used
+// results are dropped first.
+const gint64 FILTER_RESULT_CACHE_MAX_MEMSIZE = G_GINT64_CONSTANT(1) << 30;
+
+class FilterResultCache {
+  struct Entry {
+    gchar*       key;
+    TileManager* tiles;
+    gint64       memsize;
+  };
+
+  GList* entries;  // most recently used first
+  gint64 memsize;
+
+  FilterResultCache() : entries(NULL), memsize(0) { }
+
+  static void free_entry(Entry* entry) {
+    tile_manager_unref(entry->tiles);
+    g_free(entry->key);
+    g_slice_free(Entry, entry);
+  }
+
+  static gboolean on_exit(Gimp* gimp, gboolean force, FilterResultCache* cache) {
+    cache->clear();
+    return FALSE;
+  }
+
+  static guint64 rotl(guint64 x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  static guint64 mix(guint64 x) {
+    x = (x ^ (x >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+  }
+
+public:
+  static FilterResultCache* get(Gimp* gimp) {
+    static FilterResultCache* cache = NULL;
+
+    // the tiles must be gone before the tile managers are shut down
+    if (!cache) {
+      cache = new FilterResultCache();
+      g_signal_connect(gimp, "exit", G_CALLBACK(on_exit), cache);
+    }
+    return cache;
+  }
+
+  // Returns the cached result for key, or NULL. The result is owned by
+  // the cache, copy_region() it into the layer to share its tiles.
+  TileManager* lookup(const gchar* key) {
+    for (GList* list = entries; list; list = g_list_next(list)) {
+      Entry* entry = (Entry*) list->data;
+
+      if (strcmp(entry->key, key) == 0) {
+        entries = g_list_remove_link(entries, list);
+        entries = g_list_concat(list, entries);
+        return entry->tiles;
+      }
+    }
+    return NULL;
+  }
+
+  // Keeps a copy-on-write duplicate of tiles as the result for key.
+  void insert(const gchar* key, TileManager* tiles) {
+    if (lookup(key))
+      return;
+
+    Entry* entry   = g_slice_new(Entry);
+    entry->key     = g_strdup(key);
+    entry->tiles   = tile_manager_duplicate(tiles);
+    entry->memsize = tile_manager_get_memsize(entry->tiles, FALSE);
+
+    entries  = g_list_prepend(entries, entry);
+    memsize += entry->memsize;
+
+    while (memsize > FILTER_RESULT_CACHE_MAX_MEMSIZE && g_list_next(entries)) {
+      GList* last = g_list_last(entries);
+
+      entry    = (Entry*) last->data;
+      memsize -= entry->memsize;
+      entries  = g_list_delete_link(entries, last);
+      free_entry(entry);
+    }
+  }
+
+  void clear() {
+    g_list_free_full(entries, (GDestroyNotify) free_entry);
+    entries = NULL;
+    memsize = 0;
+  }
+
+  // Hashes the pixels of PR tile by tile into two independent 64 bit
+  // lanes, each tile is mixed with its position.
+  static void hash_region(PixelRegion* PR, guint64 hash[2]) {
+    gpointer pr;
+
+    for (pr = pixel_regions_register(1, PR);
+         pr != NULL;
+         pr = pixel_regions_process(pr)) {
+      guint64       h1    = mix(((guint64) PR->x << 32) | (guint32) PR->y);
+      guint64       h2    = ~h1;
+      const guchar* row   = PR->data;
+      gsize         width = PR->w * PR->bytes;
+
+      for (gint y = 0; y < PR->h; y ++, row += PR->rowstride) {
+        gsize i = 0;
+
+        for (; i + sizeof(guint64) <= width; i += sizeof(guint64)) {
+          guint64 w;
+          memcpy(&w, row + i, sizeof(guint64));
+          h1 = rotl(h1 ^ (w * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15)), 31) *
+               G_GUINT64_CONSTANT(0xc2b2ae3d27d4eb4f);
+          h2 = rotl(h2 + w, 27) * G_GUINT64_CONSTANT(0x165667b19e3779f9) + w;
+        }
+        for (; i < width; i ++) {
+          h1 = rotl(h1 ^ row[i], 11) * G_GUINT64_CONSTANT(0x9e3779b97f4a7c15);
+          h2 = (h2 + row[i]) * G_GUINT64_CONSTANT(0xc2b2ae3d27d4eb4f);
+        }
+      }
+
+      hash[0] = rotl(hash[0], 5) ^ mix(h1);
+      hash[1] = rotl(hash[1], 7) + mix(h2);
+    }
+  }
+};
+
+#endif /* __GIMP_FILTER_LAYER_CACHE_HPP__ */
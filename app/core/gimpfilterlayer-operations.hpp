@@ -0,0 +1,297 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GIMP_FILTER_LAYER_OPERATIONS_HPP__
+#define __GIMP_FILTER_LAYER_OPERATIONS_HPP__
+
+// In-process replacements of filter layer procedures.
+//
+// A filter layer runs its procedure through the PDB, which for a plug-in
+// means shipping every tile to another process and back. When an entry
+// is registered here for the procedure, the filter layer runs a GEGL
+// operation instead. The results are close to the ones of the procedures
+// but not identical, the kernels are sampled differently and rounded at
+// other steps. Each entry maps the procedure arguments to the properties
+// of the operation, and returns NULL for arguments the operation can not
+// reproduce. The scale is applied to the spatial arguments, for the
+// previews computed on a downscaled input.
+//
+// The operations see the raw pixel values, the graph is built with
+// linear tile manager sources like gimp_drawable_invert() does.
+//
+// The plug-ins extend the edge pixels of the drawable where they read
+// outside of it, while GEGL reads transparency there. Each entry also
+// reports how far its operation reads around a pixel, so that the input
+// can be padded with copies of its edge pixels first, see pad_tiles().
+
+class FilterOperations {
+  typedef GeglNode* (*Factory) (GimpProcedure* proc,
+                                GValueArray*   args,
+                                gdouble        scale,
+                                gint*          padding);
+
+  struct Entry {
+    const gchar* procedure;
+    const gchar* operation;
+    Factory      create;
+    bool         local;     // output only depends on the pixels nearby
+  };
+
+  static GeglNode* new_node(const gchar* operation) {
+    return GEGL_NODE(g_object_new(GEGL_TYPE_NODE, "operation", operation, NULL));
+  }
+
+  static gdouble get_arg(GimpProcedure* proc,
+                         GValueArray*   args,
+                         const gchar*   name,
+                         gdouble        default_value) {
+    for (gint i = 0; i < proc->num_args; i ++) {
+      if (strcmp(g_param_spec_get_name(proc->args[i]), name) == 0) {
+        GValue  v      = G_VALUE_INIT;
+        gdouble result = default_value;
+
+        g_value_init(&v, G_TYPE_DOUBLE);
+        if (g_value_transform(&args->values[i], &v))
+          result = g_value_get_double(&v);
+        g_value_unset(&v);
+        return result;
+      }
+    }
+    return default_value;
+  }
+
+  static bool has_arg(GimpProcedure* proc, const gchar* name) {
+    for (gint i = 0; i < proc->num_args; i ++)
+      if (strcmp(g_param_spec_get_name(proc->args[i]), name) == 0)
+        return true;
+    return false;
+  }
+
+  // the gauss plug-ins take the radius at which the kernel falls
+  // below 1/255
+  static gdouble radius_to_std_dev(gdouble radius) {
+    radius = fabs(radius) + 1.0;
+    return sqrt(-(radius * radius) / (2 * log(1.0 / 255.0)));
+  }
+
+  // the kernels of gegl:gaussian-blur end at about 3 std-dev, with some
+  // room for the tails of its IIR variant
+  static gint std_dev_to_padding(gdouble std_dev) {
+    return (gint) ceil(std_dev * 4.0) + 1;
+  }
+
+  static GeglNode* gauss(GimpProcedure* proc, GValueArray* args, gdouble scale, gint* padding) {
+    gdouble horizontal, vertical;
+
+    if (has_arg(proc, "radius")) {
+      // plug-in-gauss-iir, plug-in-gauss-rle: one radius and two toggles
+      gdouble radius = get_arg(proc, args, "radius", 0.0);
+
+      horizontal = get_arg(proc, args, "horizontal", 1.0) != 0.0 ? radius : 0.0;
+      vertical   = get_arg(proc, args, "vertical",   1.0) != 0.0 ? radius : 0.0;
+    } else {
+      horizontal = get_arg(proc, args, "horizontal", 0.0);
+      vertical   = get_arg(proc, args, "vertical",   0.0);
+    }
+
+    gdouble std_dev_x = horizontal > 0.0 ? radius_to_std_dev(horizontal) * scale : 0.0;
+    gdouble std_dev_y = vertical   > 0.0 ? radius_to_std_dev(vertical)   * scale : 0.0;
+
+    GeglNode* node = new_node("gegl:gaussian-blur");
+
+    gegl_node_set(node,
+                  "std-dev-x", std_dev_x,
+                  "std-dev-y", std_dev_y,
+                  NULL);
+    *padding = std_dev_to_padding(MAX(std_dev_x, std_dev_y));
+    return node;
+  }
+
+  static GeglNode* unsharp_mask(GimpProcedure* proc, GValueArray* args, gdouble scale, gint* padding) {
+    // the operation has no threshold
+    if (get_arg(proc, args, "threshold", 0.0) != 0.0)
+      return NULL;
+
+    // the plug-in blurs with the kernel of the gauss plug-ins
+    gdouble std_dev = radius_to_std_dev(get_arg(proc, args, "radius", 5.0)) * scale;
+
+    GeglNode* node = new_node("gegl:unsharp-mask");
+
+    gegl_node_set(node,
+                  "std-dev", std_dev,
+                  "scale",   get_arg(proc, args, "amount", 0.5),
+                  NULL);
+    *padding = std_dev_to_padding(std_dev);
+    return node;
+  }
+
+  static GeglNode* blur(GimpProcedure* proc, GValueArray* args, gdouble scale, gint* padding) {
+    // the 3x3 mean of plug-in-blur, not visible on a downscaled input
+    if (scale < 1.0)
+      return new_node("gegl:nop");
+
+    GeglNode* node = new_node("gegl:box-blur");
+
+    gegl_node_set(node, "radius", 1, NULL);
+    *padding = 1;
+    return node;
+  }
+
+  // the plug-in averages the cut blocks at the edges over the pixels
+  // inside, here they also count the copies of the edge pixels
+  static GeglNode* pixelize(GimpProcedure* proc, GValueArray* args, gdouble scale, gint* padding) {
+    gint width  = (gint) get_arg(proc, args, "pixel-width", 10.0);
+    gint height = (gint) get_arg(proc, args, "pixel-height", width);
+
+    GeglNode* node = new_node("gegl:pixelize");
+
+    gint size_x = MAX((gint) (width  * scale), 1);
+    gint size_y = MAX((gint) (height * scale), 1);
+
+    gegl_node_set(node,
+                  "size-x", size_x,
+                  "size-y", size_y,
+                  NULL);
+    *padding = MAX(size_x, size_y);
+    return node;
+  }
+
+  static GeglNode* invert(GimpProcedure* proc, GValueArray* args, gdouble scale, gint* padding) {
+    return new_node("gegl:invert");
+  }
+
+  static const Entry* lookup(GimpProcedure* proc) {
+    static const Entry entries[] = {
+      { "gimp-invert",          "gegl:invert",        invert,       true  },
+      { "plug-in-gauss",        "gegl:gaussian-blur", gauss,        true  },
+      { "plug-in-gauss-iir",    "gegl:gaussian-blur", gauss,        true  },
+      { "plug-in-gauss-iir2",   "gegl:gaussian-blur", gauss,        true  },
+      { "plug-in-gauss-rle",    "gegl:gaussian-blur", gauss,        true  },
+      { "plug-in-gauss-rle2",   "gegl:gaussian-blur", gauss,        true  },
+      { "plug-in-unsharp-mask", "gegl:unsharp-mask",  unsharp_mask, true  },
+      { "plug-in-blur",         "gegl:box-blur",      blur,         true  },
+      { "plug-in-pixelize",     "gegl:pixelize",      pixelize,     false },
+      { "plug-in-pixelize2",    "gegl:pixelize",      pixelize,     false },
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS(entries); i ++)
+      if (strcmp(entries[i].procedure, proc->original_name) == 0)
+        return &entries[i];
+    return NULL;
+  }
+
+public:
+  // Returns a new node for procedure with args, or NULL if the procedure
+  // has to run through the PDB. padding receives how far the operation
+  // reads around a pixel, which the input has to be padded by.
+  static GeglNode* create(GimpProcedure* proc,
+                          GValueArray*   args,
+                          gdouble        scale   = 1.0,
+                          gint*          padding = NULL) {
+    const Entry* entry = lookup(proc);
+    gint         dummy = 0;
+
+    if (!entry || !gegl_has_operation(entry->operation))
+      return NULL;
+    if (!padding)
+      padding = &dummy;
+    *padding = 0;
+    return entry->create(proc, args, scale, padding);
+  }
+
+  // Returns a copy of tiles with padding pixels around it on each side,
+  // which repeat the edge pixels of tiles.
+  static TileManager* pad_tiles(TileManager* tiles,
+                                gint         padding) {
+    gint         width  = tile_manager_width(tiles);
+    gint         height = tile_manager_height(tiles);
+    TileManager* padded;
+    PixelRegion  srcPR, destPR;
+
+    if (padding <= 0)
+      return tile_manager_duplicate(tiles);
+
+    padded = tile_manager_new(width + 2 * padding, height + 2 * padding,
+                              tile_manager_bpp(tiles));
+
+    pixel_region_init(&srcPR,  tiles,  0, 0, width, height, FALSE);
+    pixel_region_init(&destPR, padded, padding, padding, width, height, TRUE);
+    copy_region(&srcPR, &destPR);
+
+    for (gint i = 0; i < padding; i ++) {
+      // the top and bottom rows, then the columns including the corners
+      pixel_region_init(&srcPR,  padded, padding, padding, width, 1, FALSE);
+      pixel_region_init(&destPR, padded, padding, i,       width, 1, TRUE);
+      copy_region(&srcPR, &destPR);
+
+      pixel_region_init(&srcPR,  padded, padding, padding + height - 1,     width, 1, FALSE);
+      pixel_region_init(&destPR, padded, padding, padding + height + i,     width, 1, TRUE);
+      copy_region(&srcPR, &destPR);
+    }
+
+    for (gint i = 0; i < padding; i ++) {
+      pixel_region_init(&srcPR,  padded, padding, 0, 1, height + 2 * padding, FALSE);
+      pixel_region_init(&destPR, padded, i,       0, 1, height + 2 * padding, TRUE);
+      copy_region(&srcPR, &destPR);
+
+      pixel_region_init(&srcPR,  padded, padding + width - 1, 0, 1, height + 2 * padding, FALSE);
+      pixel_region_init(&destPR, padded, padding + width + i, 0, 1, height + 2 * padding, TRUE);
+      copy_region(&srcPR, &destPR);
+    }
+
+    return padded;
+  }
+
+  // Returns how far the operation for procedure with args reads around
+  // an output pixel, or -1 if the operation can not tell. Operations
+  // whose output depends on the absolute position, like the blocks of
+  // pixelize, have no halo.
+  static gint get_halo(GimpProcedure* proc,
+                       GValueArray*   args) {
+    const Entry* entry = lookup(proc);
+
+    if (!entry || !entry->local)
+      return -1;
+
+    GeglNode* node = create(proc, args);
+    if (!node)
+      return -1;
+
+    GeglOperation* operation = gegl_node_get_gegl_operation(node);
+    gint           halo      = -1;
+
+    if (GEGL_IS_OPERATION_POINT_FILTER(operation)) {
+      halo = 0;
+    } else if (GEGL_IS_OPERATION_AREA_FILTER(operation)) {
+      GeglRectangle roi = { 0, 0, 1, 1 };
+      GeglRectangle required;
+
+      gegl_operation_prepare(operation);
+      required = gegl_operation_get_required_for_output(operation, "input", &roi);
+
+      halo = MAX(MAX(-required.x, -required.y),
+                 MAX(required.x + required.width  - 1,
+                     required.y + required.height - 1));
+    }
+    // meta operations hide their children, their halo is not known here
+
+    g_object_unref(node);
+    return halo;
+  }
+};
+
+#endif /* __GIMP_FILTER_LAYER_OPERATIONS_HPP__ */
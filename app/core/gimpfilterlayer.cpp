@@ -29,8 +29,10 @@ extern "C" {
 
 #include <string.h>
 #include <gegl.h>
+#include <gegl-plugin.h>
 
 #include "libgimpbase/gimpbase.h"
+#include "libgimpcolor/gimpcolor.h"
 #include "libgimpmath/gimpmath.h"
 
 #include "core-types.h"
@@ -65,6 +67,13 @@ extern "C" {
 
 #include "gimpfilterlayer.h"
 #include "pdb/pdb-cxx-utils.hpp"
+#include "gimpfilterlayer-cache.hpp"
+#include "gimpfilterlayer-operations.hpp"
+
+// In-process runs first render the filter on the input downscaled by
+// this factor, when the layer is large enough for that to matter.
+const gdouble FILTER_PREVIEW_SCALE      = 0.25;
+const gint64  FILTER_PREVIEW_MIN_PIXELS = 1024 * 1024;
 
 namespace GLib {
 
@@ -87,9 +96,64 @@ struct FilterLayer : virtual public ImplBase, virtual public FilterLayerInterfac
   struct Rectangle {
     gint x, y;
     gint width, height;
+    Rectangle() : x(0), y(0), width(0), height(0) {};
     Rectangle(gint x_, gint y_, gint w_, gint h_) : x(x_), y(y_), width(w_), height(h_) {};
+
+    bool is_empty() const { return width <= 0 || height <= 0; }
+
+    void unite(const Rectangle& rect) {
+      if (rect.is_empty())
+        return;
+      if (is_empty()) {
+        *this = rect;
+        return;
+      }
+      gint x2 = MAX(x + width,  rect.x + rect.width);
+      gint y2 = MAX(y + height, rect.y + rect.height);
+      x      = MIN(x, rect.x);
+      y      = MIN(y, rect.y);
+      width  = x2 - x;
+      height = y2 - y;
+    }
+
+    void intersect(const Rectangle& rect) {
+      gint x2 = MIN(x + width,  rect.x + rect.width);
+      gint y2 = MIN(y + height, rect.y + rect.height);
+      x      = MAX(x, rect.x);
+      y      = MAX(y, rect.y);
+      width  = MAX(0, x2 - x);
+      height = MAX(0, y2 - y);
+    }
   };
 
+  // Region-scoped re-filtering. When only a part of the layers below
+  // was updated, the filter runs on a scratch image which covers the
+  // updated area plus the halo the filter reads around each pixel.
+  // Only the updated area is copied back, the rest of the layer keeps
+  // the result of the previous run.
+  Rectangle        dirty;          // consumed updates, in parent coords
+  bool             refilter_all;
+  GimpImage*       scratch_image;
+  GimpLayer*       scratch_layer;
+  Rectangle        scratch_area;   // of scratch_layer, in layer coords
+  Rectangle        result_area;    // copied back, in layer coords
+  bool             scratch_discarded;
+
+  // Key of the result the runner is producing for the whole layer, it
+  // goes into the FilterResultCache when the run ends.
+  gchar*           pending_cache_key;
+
+  // In-process run of an operation registered in FilterOperations, it
+  // is processed in an idle handler like a plug-in runs asynchronously.
+  GeglNode*        native_graph;
+  GeglProcessor*   native_processor;
+  GeglNode*        native_preview_graph;
+  GeglProcessor*   native_preview_processor;
+  TileManager*     native_input;    // padded by native_padding
+  gint             native_padding;
+  guint            native_idle_id;
+  bool             native_preview;  // layer shows a downscaled result
+
   CXXPointer<Delegators::Connection> child_update_conn;
   CXXPointer<Delegators::Connection> parent_changed_conn;
   CXXPointer<Delegators::Connection> reorder_conn;
@@ -107,6 +171,27 @@ struct FilterLayer : virtual public ImplBase, virtual public FilterLayerInterfac
     return FALSE;
   }
 
+  static gboolean native_process_callback(FilterLayer* filter) {
+    gdouble value;
+
+    // the preview is rendered first, chunk by chunk like the result
+    if (filter->native_preview_processor) {
+      if (!gegl_processor_work(filter->native_preview_processor, &value))
+        filter->show_native_preview();
+      return TRUE;
+    }
+
+    if (gegl_processor_work(filter->native_processor, &value)) {
+      filter->set_value(value);
+      return TRUE;
+    }
+
+    filter->native_idle_id = 0;
+    filter->finish_native();
+    filter->end();
+    return FALSE;
+  }
+
   // Inherited methods
   virtual void            constructed  ();
 
@@ -172,6 +257,7 @@ struct FilterLayer : virtual public ImplBase, virtual public FilterLayerInterfac
 
   virtual bool            is_waiting_to_be_processed() {
     return runner && runner->is_running() ||
+           native_idle_id ||
            projected_tiles_updated ||
            waiting_process_stack ||
            updates;
@@ -214,6 +300,33 @@ private:
   void                invalidate_whole_area ();
   void                invalidate_layer ();
 
+  gint                get_halo_radius  ();
+  bool                get_refilter_area(const Rectangle& visible,
+                                        Rectangle&       scratch,
+                                        Rectangle&       result);
+  void                run_on_area      (PixelRegion*     projPR,
+                                        gint             proj_off_x,
+                                        gint             proj_off_y,
+                                        const Rectangle& scratch,
+                                        const Rectangle& result);
+  void                finish_area      ();
+
+  void                get_projection_area (PixelRegion*  projPR,
+                                           Rectangle&    source,
+                                           Rectangle&    dest);
+  gchar*              get_cache_key    (PixelRegion*     projPR,
+                                        const Rectangle& source,
+                                        const Rectangle& dest);
+  void                stop_runner      ();
+  bool                run_native       (GimpDrawable*    drawable);
+  void                start_native_preview (GimpProcedure*  proc,
+                                            GValueArray*    args,
+                                            TileManager*    tiles);
+  void                show_native_preview  ();
+  void                finish_native    ();
+  bool                is_filtering     ();
+  void                cancel_run       ();
+
   bool try_waiting_for_runner() {
     bool result;
     g_mutex_lock(&mutex);
@@ -333,12 +446,30 @@ GLib::FilterLayer::FilterLayer(GObject* o) : GLib::ImplBase(o) {
   waiting_for_runner  = false;
   loaded              = false;
 
+  refilter_all        = true;
+  scratch_image       = NULL;
+  scratch_layer       = NULL;
+  scratch_discarded   = false;
+  pending_cache_key   = NULL;
+  native_graph        = NULL;
+  native_processor    = NULL;
+  native_input        = NULL;
+  native_padding      = 0;
+  native_idle_id      = 0;
+  native_preview      = false;
+  native_preview_graph     = NULL;
+  native_preview_processor = NULL;
+
   g_mutex_init(&mutex);
   g_mutex_init(&m_updates);
 }
 
 GLib::FilterLayer::~FilterLayer()
 {
+  finish_native();
+  scratch_discarded = true;
+  finish_area();
+  g_free(pending_cache_key);
 }
 
 void GLib::FilterLayer::constructed ()
@@ -521,6 +652,7 @@ void GLib::FilterLayer::project_region (gint          x,
           rect->y + rect->height <= y1 + offset_y - parent_off_y + height) {
 
         projected_tiles_updated = true;
+        dirty.unite(*rect);
         updates = g_list_delete_link (updates, list);
         delete rect;
       }
@@ -532,6 +664,7 @@ void GLib::FilterLayer::project_region (gint          x,
       if (!layer_projected_once) {
         projected_tiles_updated = true;
         layer_projected_once    = true;
+        refilter_all            = true;
 
         g_list_free_full(updates, delete_rectangle);
         updates = NULL;
@@ -545,81 +678,85 @@ void GLib::FilterLayer::project_region (gint          x,
   if (projected_tiles_updated &&
       !waiting_process_stack && !updates_remained) {
     bool trial = false;
-    if (!runner) trial = try_waiting_for_runner();
-    else         trial = runner->preserve();
+    if (!runner)              trial = try_waiting_for_runner();
+    else if (!native_idle_id) trial = runner->preserve();
     if ( trial ) {
       TileManager* tiles   = self [gimp_drawable_get_tiles] ();
       PixelRegion  srcPR, destPR;
+      Rectangle    source_area, dest_area;
 
-      //projected_tiles: 1-5 Be aware of boundary. project_region's image size and size of projected_tiles differ.
-      gint twidth  = w;
-      gint theight = h;
-
-      gint swidth  = tile_manager_width(projPR->tiles);
-      gint sheight = tile_manager_height(projPR->tiles);
-
-      Rectangle source_area = {
-          0, 0, swidth, sheight
-      };
-      Rectangle dest_area = {
-          0 + parent_off_x - offset_x,
-          0 + parent_off_y - offset_y,
-          swidth, sheight
-      };
-
-      if (dest_area.x < 0) {
-        source_area.width += dest_area.x;
-        dest_area.  width += dest_area.x;
-        source_area.x     -= dest_area.x;
-        dest_area.  x     -= dest_area.x;
-      }
-
-      if (dest_area.y < 0) {
-        source_area.height += dest_area.y;
-        dest_area.  height += dest_area.y;
-        source_area.y      -= dest_area.y;
-        dest_area.  y      -= dest_area.y;
-      }
-
-      if (dest_area.x + dest_area.width > twidth) {
-        dest_area.width    = twidth  - dest_area.x;
-        source_area.width  = dest_area.width;
-      }
-
-      if (dest_area.y + dest_area.height > theight) {
-        dest_area.height = theight - dest_area.y;
-        source_area.height = dest_area.height;
-      }
+      get_projection_area(projPR, source_area, dest_area);
 
-      pixel_region_init (&srcPR, projPR->tiles,
-                         source_area.x, source_area.y, source_area.width, source_area.height, FALSE);
+      Rectangle scratch, result;
 
-      pixel_region_init (&destPR,       tiles,
-                         dest_area.x, dest_area.y, dest_area.width, dest_area.height, TRUE);
-
-      copy_region_nocow(&srcPR, &destPR);
-
-      if (runner) {
-
-        bool result = runner->run(GIMP_ITEM(g_object));
-        g_print("--->%s: start runner=%d\n", self [gimp_object_get_name] (), result );
-        auto  image   = ref(self [gimp_item_get_image] () );
-        int   iwidth  = image [gimp_image_get_width] ();
-        int   iheight = image [gimp_image_get_height] ();
-        image [gimp_image_invalidate] (0, 0, iwidth, iheight, 0);
-        image [gimp_image_flush] ();
+      if (runner && get_refilter_area(dest_area, scratch, result)) {
+        run_on_area(projPR,
+                    source_area.x - dest_area.x, source_area.y - dest_area.y,
+                    scratch, result);
 
       } else {
-        g_print("--->%s: no runner\n",self [gimp_object_get_name] () );
-        g_timeout_add(300, (GSourceFunc)notify_filter_end_callback, this);
+        gchar*       key    = runner ? get_cache_key(projPR, source_area, dest_area) : NULL;
+        TileManager* cached = key ? FilterResultCache::get(gimp_item_get_image(GIMP_ITEM(g_object))->gimp)->lookup(key) : NULL;
+
+        if (cached) {
+          // the procedure already ran on this input, share its result
+          runner->cancel();
+          pixel_region_init (&srcPR,  cached, 0, 0, w, h, FALSE);
+          pixel_region_init (&destPR, tiles,  0, 0, w, h, TRUE);
+          copy_region(&srcPR, &destPR);
+          g_free(key);
+          g_idle_add((GSourceFunc)notify_filter_end_callback, this);
+
+        } else {
+          pixel_region_init (&srcPR, projPR->tiles,
+                             source_area.x, source_area.y, source_area.width, source_area.height, FALSE);
+
+          pixel_region_init (&destPR,       tiles,
+                             dest_area.x, dest_area.y, dest_area.width, dest_area.height, TRUE);
+
+          copy_region_nocow(&srcPR, &destPR);
+
+          if (runner) {
+            g_free(pending_cache_key);
+            pending_cache_key = key;
+
+            bool result;
+            if (run_native(GIMP_DRAWABLE(g_object))) {
+              runner->cancel();
+              result = true;
+            } else
+              result = runner->run(GIMP_ITEM(g_object));
+            g_print("--->%s: start runner=%d\n", self [gimp_object_get_name] (), result );
+            if (!result) {
+              g_free(pending_cache_key);
+              pending_cache_key = NULL;
+            }
+            auto  image   = ref(self [gimp_item_get_image] () );
+            int   iwidth  = image [gimp_image_get_width] ();
+            int   iheight = image [gimp_image_get_height] ();
+            image [gimp_image_invalidate] (0, 0, iwidth, iheight, 0);
+            image [gimp_image_flush] ();
+
+          } else {
+            g_print("--->%s: no runner\n",self [gimp_object_get_name] () );
+            g_timeout_add(300, (GSourceFunc)notify_filter_end_callback, this);
+          }
+        }
       }
 
+      dirty                   = Rectangle();
+      refilter_all            = false;
       projected_tiles_updated = false;
     } else
       projected_tiles_updated = true;
   }
 
-  if (!runner || is_waiting_to_be_processed()) {
+  // an in-process run refines its preview in place, which is shown
+  // until the full resolution result is done
+  bool show_preview = native_idle_id && native_preview &&
+                      !projected_tiles_updated && !waiting_process_stack && !updates;
+
+  if (!runner || (is_waiting_to_be_processed() && !show_preview)) {
     return;
   }
 //  g_print("--->%s: do parent process\n",self [gimp_object_get_name] () );
@@ -704,6 +841,14 @@ void GLib::FilterLayer::filter_reset () {
   g_list_free_full(updates, delete_rectangle);
   updates = NULL;
   layer_projected_once = false;
+
+  dirty        = Rectangle();
+  refilter_all = true;
+  if (scratch_image)
+    scratch_discarded = true;
+
+  g_free(pending_cache_key);
+  pending_cache_key = NULL;
 }
 
 
@@ -713,7 +858,24 @@ void GLib::FilterLayer::notify_filter_end()
   gint width  = self [gimp_item_get_width] ();
   gint height = self [gimp_item_get_height] ();
 
-  self [gimp_drawable_update] (0, 0, width, height);
+  if (scratch_image) {
+    bool      discarded = scratch_discarded;
+    Rectangle area      = result_area;
+
+    finish_area();
+    if (!discarded)
+      self [gimp_drawable_update] (area.x, area.y, area.width, area.height);
+  } else {
+    if (pending_cache_key) {
+      GimpImage* image = gimp_item_get_image(GIMP_ITEM(g_object));
+
+      FilterResultCache::get(image->gimp)->insert(pending_cache_key,
+                                                  gimp_drawable_get_tiles(GIMP_DRAWABLE(g_object)));
+      g_free(pending_cache_key);
+      pending_cache_key = NULL;
+    }
+    self [gimp_drawable_update] (0, 0, width, height);
+  }
   auto image  = ref( self [gimp_item_get_image]() );
   auto parent = ref( self [gimp_viewable_get_parent]() );
   set_waiting_for_runner(false);
@@ -758,6 +920,7 @@ void GLib::FilterLayer::end()
 //    g_print("%s: New runner exists. run again.\n", ref(g_object) [gimp_object_get_name] () );
     runner      = std::move(new_runner);
     filter_reset();
+    finish_area();
     return;
   }
 
@@ -766,7 +929,7 @@ void GLib::FilterLayer::end()
 
 gboolean GLib::FilterLayer::is_active()
 {
-  return runner && runner->is_running();
+  return runner && runner->is_running() || native_idle_id;
 //  return filter_active != NULL;
 }
 
@@ -796,6 +959,12 @@ gboolean GLib::FilterLayer::message(Gimp*                gimp,
                                       const gchar*       message)
 {
   g_print("FilterLayer::message: %s / %s\n", domain, message);
+
+  // a failed run must not be remembered as the result of its input
+  if (severity == GIMP_MESSAGE_ERROR) {
+    g_free(pending_cache_key);
+    pending_cache_key = NULL;
+  }
   return TRUE;
 }
 
@@ -924,6 +1093,574 @@ void GLib::FilterLayer::invalidate_layer ()
 }
 
 
+// Returns how far the filter reads around a pixel, or -1 if that is not
+// known. The halo is asked from the GEGL operation of an in-process run
+// where possible, the table covers the procedures which only run through
+// the PDB. Filters which are not known either way always run on the whole
+// layer.
+gint GLib::FilterLayer::get_halo_radius ()
+{
+  static const struct {
+    const gchar* procedure;
+    const gchar* arg;      // NULL if the halo does not depend on an argument
+    gdouble      scale;
+    gint         margin;
+  } halos[] = {
+    { "gimp-invert",              NULL,         0.0, 0 },
+    { "gimp-desaturate",          NULL,         0.0, 0 },
+    { "gimp-desaturate-full",     NULL,         0.0, 0 },
+    { "gimp-brightness-contrast", NULL,         0.0, 0 },
+    { "gimp-color-balance",       NULL,         0.0, 0 },
+    { "gimp-colorize",            NULL,         0.0, 0 },
+    { "gimp-curves-explicit",     NULL,         0.0, 0 },
+    { "gimp-curves-spline",       NULL,         0.0, 0 },
+    { "gimp-hue-saturation",      NULL,         0.0, 0 },
+    { "gimp-levels",              NULL,         0.0, 0 },
+    { "gimp-posterize",           NULL,         0.0, 0 },
+    { "gimp-threshold",           NULL,         0.0, 0 },
+    { "plug-in-blur",             NULL,         0.0, 1 },
+    { "plug-in-gauss",            "horizontal", 1.0, 2 },
+    { "plug-in-gauss",            "vertical",   1.0, 2 },
+    { "plug-in-gauss-iir",        "radius",     1.0, 2 },
+    { "plug-in-gauss-iir2",       "horizontal", 1.0, 2 },
+    { "plug-in-gauss-iir2",       "vertical",   1.0, 2 },
+    { "plug-in-gauss-rle",        "radius",     1.0, 2 },
+    { "plug-in-gauss-rle2",       "horizontal", 1.0, 2 },
+    { "plug-in-gauss-rle2",       "vertical",   1.0, 2 },
+    { "plug-in-sel-gauss",        "radius",     1.0, 2 },
+    { "plug-in-despeckle",        "radius",     1.0, 1 },
+    { "plug-in-unsharp-mask",     "radius",     2.0, 3 },
+  };
+
+  if (!runner)
+    return -1;
+
+  const gchar*   name   = get_procedure();
+  GimpPDB*       pdb    = gimp_item_get_image(GIMP_ITEM(g_object))->gimp->pdb;
+  GimpProcedure* proc   = gimp_pdb_lookup_procedure(pdb, name);
+  GValueArray*   args;
+  gint           result;
+
+  if (!proc)
+    return -1;
+
+  args   = runner->get_args();
+  result = FilterOperations::get_halo(proc, args);
+
+  if (result >= 0) {
+    g_value_array_free(args);
+    return result;
+  }
+
+  for (guint i = 0; i < G_N_ELEMENTS(halos); i ++) {
+    if (strcmp(halos[i].procedure, proc->original_name) != 0)
+      continue;
+
+    gdouble value = 0.0;
+
+    if (halos[i].arg) {
+      for (int j = 0; j < proc->num_args; j ++) {
+        if (strcmp(g_param_spec_get_name(proc->args[j]), halos[i].arg) == 0) {
+          GValue v = G_VALUE_INIT;
+          g_value_init(&v, G_TYPE_DOUBLE);
+          if (g_value_transform(&args->values[j], &v))
+            value = ABS(g_value_get_double(&v));
+          g_value_unset(&v);
+          break;
+        }
+      }
+    }
+
+    result = MAX(result, (gint) ceil(value * halos[i].scale) + halos[i].margin);
+  }
+
+  g_value_array_free(args);
+
+  return result;
+}
+
+// Decides whether the consumed updates can be re-filtered on their own.
+// visible is the part of the layer covered by the projection, scratch
+// receives the area to run the filter on, result the area to copy back.
+// An output pixel within the halo of an update reads changed input, so
+// result is the update grown by the halo, and scratch grows by another
+// halo for the input those pixels read.
+bool GLib::FilterLayer::get_refilter_area (const Rectangle& visible,
+                                           Rectangle&       scratch,
+                                           Rectangle&       result)
+{
+  if (refilter_all || dirty.is_empty() || scratch_image)
+    return false;
+
+  GimpDrawable* drawable = GIMP_DRAWABLE(g_object);
+  if (GIMP_IMAGE_TYPE_IS_INDEXED(gimp_drawable_type(drawable)))
+    return false;
+
+  gint halo = get_halo_radius();
+  if (halo < 0)
+    return false;
+
+  gint parent_off_x = 0;
+  gint parent_off_y = 0;
+  GimpViewable* parent = gimp_viewable_get_parent(GIMP_VIEWABLE(g_object));
+  if (parent)
+    gimp_item_get_offset(GIMP_ITEM(parent), &parent_off_x, &parent_off_y);
+
+  // dirty is in the coordinates of the parent's projection
+  Rectangle changed(dirty.x - gimp_item_get_offset_x(GIMP_ITEM(g_object)) + parent_off_x,
+                    dirty.y - gimp_item_get_offset_y(GIMP_ITEM(g_object)) + parent_off_y,
+                    dirty.width, dirty.height);
+  changed.intersect(visible);
+  if (changed.is_empty())
+    return false;
+
+  result = Rectangle(changed.x - halo, changed.y - halo,
+                     changed.width + 2 * halo, changed.height + 2 * halo);
+  result.intersect(visible);
+
+  scratch = Rectangle(changed.x - 2 * halo, changed.y - 2 * halo,
+                      changed.width + 4 * halo, changed.height + 4 * halo);
+  scratch.intersect(visible);
+
+  // not worth a scratch image if most of the layer has to be filtered
+  return (gint64) scratch.width * scratch.height * 2 <
+         (gint64) visible.width * visible.height;
+}
+
+// Runs the filter on a scratch image which holds the projection below
+// the scratch area. proj_off_x/y translate layer into projection coords.
+void GLib::FilterLayer::run_on_area (PixelRegion*     projPR,
+                                     gint             proj_off_x,
+                                     gint             proj_off_y,
+                                     const Rectangle& scratch,
+                                     const Rectangle& result)
+{
+  GimpDrawable* drawable = GIMP_DRAWABLE(g_object);
+  GimpImage*    image    = gimp_item_get_image(GIMP_ITEM(g_object));
+  GimpImageType type     = gimp_drawable_type(drawable);
+  PixelRegion   srcPR, destPR;
+
+  scratch_image = gimp_create_image(image->gimp, scratch.width, scratch.height,
+                                    GIMP_IMAGE_TYPE_BASE_TYPE(type), FALSE);
+  gimp_image_undo_disable(scratch_image);
+
+  scratch_layer = gimp_layer_new(scratch_image, scratch.width, scratch.height,
+                                 type, gimp_object_get_name(g_object),
+                                 GIMP_OPACITY_OPAQUE, GIMP_NORMAL_MODE);
+  g_object_ref(scratch_layer);
+  gimp_image_add_layer(scratch_image, scratch_layer, NULL, 0, FALSE);
+
+  pixel_region_init (&srcPR, projPR->tiles,
+                     scratch.x + proj_off_x, scratch.y + proj_off_y,
+                     scratch.width, scratch.height, FALSE);
+  pixel_region_init (&destPR, gimp_drawable_get_tiles(GIMP_DRAWABLE(scratch_layer)),
+                     0, 0, scratch.width, scratch.height, TRUE);
+  copy_region_nocow(&srcPR, &destPR);
+
+  scratch_area      = scratch;
+  result_area       = result;
+  scratch_discarded = false;
+
+  if (run_native(GIMP_DRAWABLE(scratch_layer))) {
+    runner->cancel();
+  } else if (!runner->run(GIMP_ITEM(scratch_layer))) {
+    scratch_discarded = true;
+    finish_area();
+  }
+}
+
+// Copies the result of run_on_area() into the layer, unless it was
+// discarded in the meantime, and drops the scratch image.
+void GLib::FilterLayer::finish_area ()
+{
+  if (!scratch_image)
+    return;
+
+  GimpItem* item = GIMP_ITEM(scratch_layer);
+
+  if (!scratch_discarded &&
+      gimp_item_is_attached(item) &&
+      gimp_item_get_width(item)  == scratch_area.width &&
+      gimp_item_get_height(item) == scratch_area.height) {
+    PixelRegion srcPR, destPR;
+
+    pixel_region_init (&srcPR, gimp_drawable_get_tiles(GIMP_DRAWABLE(scratch_layer)),
+                       result_area.x - scratch_area.x, result_area.y - scratch_area.y,
+                       result_area.width, result_area.height, FALSE);
+    pixel_region_init (&destPR, gimp_drawable_get_tiles(GIMP_DRAWABLE(g_object)),
+                       result_area.x, result_area.y,
+                       result_area.width, result_area.height, TRUE);
+    copy_region_nocow(&srcPR, &destPR);
+  }
+
+  g_object_unref(scratch_layer);
+  g_object_unref(scratch_image);
+  scratch_layer = NULL;
+  scratch_image = NULL;
+}
+
+// Computes the part of the projection below the layer, source in
+// projection coords and dest in layer coords.
+void GLib::FilterLayer::get_projection_area (PixelRegion* projPR,
+                                             Rectangle&   source,
+                                             Rectangle&   dest)
+{
+  gint offset_x     = gimp_item_get_offset_x(GIMP_ITEM(g_object));
+  gint offset_y     = gimp_item_get_offset_y(GIMP_ITEM(g_object));
+  gint twidth       = gimp_item_get_width(GIMP_ITEM(g_object));
+  gint theight      = gimp_item_get_height(GIMP_ITEM(g_object));
+  gint parent_off_x = 0;
+  gint parent_off_y = 0;
+  GimpViewable* parent = gimp_viewable_get_parent(GIMP_VIEWABLE(g_object));
+
+  if (parent)
+    gimp_item_get_offset(GIMP_ITEM(parent), &parent_off_x, &parent_off_y);
+
+  //projected_tiles: 1-5 Be aware of boundary. project_region's image size and size of projected_tiles differ.
+  gint swidth  = tile_manager_width(projPR->tiles);
+  gint sheight = tile_manager_height(projPR->tiles);
+
+  source = Rectangle(0, 0, swidth, sheight);
+  dest   = Rectangle(parent_off_x - offset_x, parent_off_y - offset_y,
+                     swidth, sheight);
+
+  if (dest.x < 0) {
+    source.width += dest.x;
+    dest.  width += dest.x;
+    source.x     -= dest.x;
+    dest.  x     -= dest.x;
+  }
+
+  if (dest.y < 0) {
+    source.height += dest.y;
+    dest.  height += dest.y;
+    source.y      -= dest.y;
+    dest.  y      -= dest.y;
+  }
+
+  if (dest.x + dest.width > twidth) {
+    dest.width   = twidth  - dest.x;
+    source.width = dest.width;
+  }
+
+  if (dest.y + dest.height > theight) {
+    dest.height   = theight - dest.y;
+    source.height = dest.height;
+  }
+}
+
+// Returns the FilterResultCache key of filtering the projection below
+// the layer with the current procedure and arguments, or NULL if an
+// argument has no stable representation. The image and drawables the
+// procedure is called on are not part of the key.
+gchar* GLib::FilterLayer::get_cache_key (PixelRegion*     projPR,
+                                         const Rectangle& source,
+                                         const Rectangle& dest)
+{
+  const gchar*   name = get_procedure();
+  GimpPDB*       pdb  = gimp_item_get_image(GIMP_ITEM(g_object))->gimp->pdb;
+  GimpProcedure* proc = gimp_pdb_lookup_procedure(pdb, name);
+
+  if (!proc || source.is_empty())
+    return NULL;
+
+  GValueArray* args    = runner->get_args();
+  GString*     key     = g_string_new(NULL);
+  guint64      hash[2] = { 0, 0 };
+  PixelRegion  srcPR;
+
+  pixel_region_init (&srcPR, projPR->tiles,
+                     source.x, source.y, source.width, source.height, FALSE);
+  FilterResultCache::hash_region(&srcPR, hash);
+
+  g_string_printf(key, "%016" G_GINT64_MODIFIER "x%016" G_GINT64_MODIFIER "x"
+                  ":%dx%d:%d:%d,%d:%s",
+                  hash[0], hash[1],
+                  gimp_item_get_width(GIMP_ITEM(g_object)),
+                  gimp_item_get_height(GIMP_ITEM(g_object)),
+                  gimp_drawable_type(GIMP_DRAWABLE(g_object)),
+                  dest.x, dest.y, name);
+
+  for (gint i = 0; i < proc->num_args && key; i ++) {
+    GParamSpec* pspec = proc->args[i];
+    GValue*     value = &args->values[i];
+
+    if (GIMP_IS_PARAM_SPEC_IMAGE_ID(pspec)   ||
+        GIMP_IS_PARAM_SPEC_ITEM_ID(pspec)    ||
+        GIMP_IS_PARAM_SPEC_DISPLAY_ID(pspec) ||
+        strcmp(g_param_spec_get_name(pspec), "run-mode") == 0)
+      continue;
+
+    g_string_append_printf(key, ";%s=", g_param_spec_get_name(pspec));
+
+    if (GIMP_IS_PARAM_SPEC_ARRAY(pspec)) {
+      GimpArray* array = (GimpArray*) g_value_get_boxed(value);
+
+      if (array) {
+        gchar* checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                                      array->data, array->length);
+        g_string_append_printf(key, "%" G_GSIZE_FORMAT ":%s", array->length, checksum);
+        g_free(checksum);
+      }
+
+    } else if (GIMP_VALUE_HOLDS_RGB(value)) {
+      GimpRGB color;
+
+      gimp_value_get_rgb(value, &color);
+      g_string_append_printf(key, "%.17g,%.17g,%.17g,%.17g",
+                             color.r, color.g, color.b, color.a);
+
+    } else if (G_VALUE_HOLDS_DOUBLE(value)) {
+      // the string transform of GValue rounds to six decimals
+      g_string_append_printf(key, "%.17g", g_value_get_double(value));
+
+    } else if (G_VALUE_HOLDS_FLOAT(value)) {
+      g_string_append_printf(key, "%.9g", g_value_get_float(value));
+
+    } else if (g_value_type_transformable(G_VALUE_TYPE(value), G_TYPE_STRING) &&
+               !G_VALUE_HOLDS_BOXED(value) && !G_VALUE_HOLDS_POINTER(value) &&
+               !G_VALUE_HOLDS_OBJECT(value)) {
+      GValue v_str = G_VALUE_INIT;
+
+      g_value_init(&v_str, G_TYPE_STRING);
+      g_value_transform(value, &v_str);
+      g_string_append(key, g_value_get_string(&v_str));
+      g_value_unset(&v_str);
+
+    } else {
+      g_string_free(key, TRUE);
+      key = NULL;
+    }
+  }
+
+  g_value_array_free(args);
+
+  return key ? g_string_free(key, FALSE) : NULL;
+}
+
+// Stops the runner, its result must not go into the cache.
+void GLib::FilterLayer::stop_runner ()
+{
+  g_free(pending_cache_key);
+  pending_cache_key  = NULL;
+  finish_native();
+  runner->stop();
+  waiting_for_runner = false;
+}
+
+// Starts an in-process run of the procedure on drawable, if an operation
+// is registered for it in FilterOperations. The operation reads from a
+// copy-on-write snapshot of drawable and writes the result into it, end()
+// is called when the processing is done.
+bool GLib::FilterLayer::run_native (GimpDrawable* drawable)
+{
+  if (GIMP_IMAGE_TYPE_IS_INDEXED(gimp_drawable_type(drawable)))
+    return false;
+
+  GimpPDB*       pdb  = gimp_item_get_image(GIMP_ITEM(g_object))->gimp->pdb;
+  GimpProcedure* proc = gimp_pdb_lookup_procedure(pdb, get_procedure());
+
+  if (!proc)
+    return false;
+
+  GValueArray* args      = runner->get_args();
+  gint         padding   = 0;
+  GeglNode*    operation = FilterOperations::create(proc, args, 1.0, &padding);
+
+  if (!operation) {
+    g_value_array_free(args);
+    return false;
+  }
+
+  TileManager*  tiles = gimp_drawable_get_tiles(drawable);
+  GeglRectangle rect  = { 0, 0,
+                          gimp_item_get_width(GIMP_ITEM(drawable)),
+                          gimp_item_get_height(GIMP_ITEM(drawable)) };
+  GeglNode*     input;
+  GeglNode*     shift;
+  GeglNode*     output;
+
+  native_input   = FilterOperations::pad_tiles(tiles, padding);
+  native_padding = padding;
+
+  // scratch areas are small enough to be done without a preview
+  if (drawable == GIMP_DRAWABLE(g_object))
+    start_native_preview(proc, args, tiles);
+  g_value_array_free(args);
+
+  native_graph = gegl_node_new();
+  g_object_set(native_graph, "dont-cache", TRUE, NULL);
+
+  input  = gegl_node_new_child(native_graph,
+                               "operation",    "gimp:tilemanager-source",
+                               "tile-manager", native_input,
+                               "linear",       TRUE,
+                               NULL);
+  shift  = gegl_node_new_child(native_graph,
+                               "operation",    "gegl:translate",
+                               "x",            (gdouble) -padding,
+                               "y",            (gdouble) -padding,
+                               NULL);
+  output = gegl_node_new_child(native_graph,
+                               "operation",    "gimp:tilemanager-sink",
+                               "tile-manager", tiles,
+                               "linear",       TRUE,
+                               NULL);
+
+  gegl_node_add_child(native_graph, operation);
+  g_object_unref(operation);
+
+  gegl_node_link_many(input, operation, shift, output, NULL);
+
+  native_processor = gegl_node_new_processor(output, &rect);
+  native_idle_id   = g_idle_add((GSourceFunc) native_process_callback, this);
+
+  return true;
+}
+
+// Sets up the rendering of the operation on native_input downscaled by
+// FILTER_PREVIEW_SCALE into tiles, so that the canvas shows an
+// approximation of the result soon. The idle handler processes it in
+// chunks before the full resolution result, which then overwrites it.
+void GLib::FilterLayer::start_native_preview (GimpProcedure* proc,
+                                              GValueArray*   args,
+                                              TileManager*   tiles)
+{
+  gint width  = tile_manager_width(tiles);
+  gint height = tile_manager_height(tiles);
+
+  if ((gint64) width * height < FILTER_PREVIEW_MIN_PIXELS ||
+      !gegl_has_operation("gegl:scale-ratio"))
+    return;
+
+  GeglNode* operation = FilterOperations::create(proc, args, FILTER_PREVIEW_SCALE);
+
+  if (!operation)
+    return;
+
+  GeglNode* graph = gegl_node_new();
+  g_object_set(graph, "dont-cache", TRUE, NULL);
+
+  GeglNode* input  = gegl_node_new_child(graph,
+                                         "operation",    "gimp:tilemanager-source",
+                                         "tile-manager", native_input,
+                                         "linear",       TRUE,
+                                         NULL);
+  GeglNode* shift  = gegl_node_new_child(graph,
+                                         "operation",    "gegl:translate",
+                                         "x",            (gdouble) -native_padding,
+                                         "y",            (gdouble) -native_padding,
+                                         NULL);
+  GeglNode* down   = gegl_node_new_child(graph,
+                                         "operation",    "gegl:scale-ratio",
+                                         "x",            FILTER_PREVIEW_SCALE,
+                                         "y",            FILTER_PREVIEW_SCALE,
+                                         NULL);
+  GeglNode* up     = gegl_node_new_child(graph,
+                                         "operation",    "gegl:scale-ratio",
+                                         "x",            1.0 / FILTER_PREVIEW_SCALE,
+                                         "y",            1.0 / FILTER_PREVIEW_SCALE,
+                                         NULL);
+  GeglNode* output = gegl_node_new_child(graph,
+                                         "operation",    "gimp:tilemanager-sink",
+                                         "tile-manager", tiles,
+                                         "linear",       TRUE,
+                                         NULL);
+
+  gegl_node_add_child(graph, operation);
+  g_object_unref(operation);
+
+  gegl_node_link_many(input, shift, down, operation, up, output, NULL);
+
+  GeglRectangle rect = { 0, 0, width, height };
+
+  native_preview_graph     = graph;
+  native_preview_processor = gegl_node_new_processor(output, &rect);
+}
+
+// Shows the finished preview until the full resolution result is done.
+void GLib::FilterLayer::show_native_preview ()
+{
+  g_object_unref(native_preview_processor);
+  g_object_unref(native_preview_graph);
+  native_preview_processor = NULL;
+  native_preview_graph     = NULL;
+
+  native_preview = true;
+
+  gimp_drawable_update(GIMP_DRAWABLE(g_object), 0, 0,
+                       gimp_item_get_width(GIMP_ITEM(g_object)),
+                       gimp_item_get_height(GIMP_ITEM(g_object)));
+}
+
+// Drops the in-process run, without calling end().
+void GLib::FilterLayer::finish_native ()
+{
+  native_preview = false;
+
+  if (native_idle_id) {
+    g_source_remove(native_idle_id);
+    native_idle_id = 0;
+  }
+
+  if (native_preview_processor) {
+    g_object_unref(native_preview_processor);
+    g_object_unref(native_preview_graph);
+    native_preview_processor = NULL;
+    native_preview_graph     = NULL;
+  }
+
+  if (native_processor) {
+    g_object_unref(native_processor);
+    g_object_unref(native_graph);
+    tile_manager_unref(native_input);
+    native_processor = NULL;
+    native_graph     = NULL;
+    native_input     = NULL;
+  }
+}
+
+bool GLib::FilterLayer::is_filtering ()
+{
+  return native_idle_id || (runner && runner->is_running());
+}
+
+// Drops the run in flight because its input changed. The area it was
+// filtering is filtered again by the next run, which starts as soon as
+// the changed input is projected.
+void GLib::FilterLayer::cancel_run ()
+{
+  if (scratch_image) {
+    gint parent_off_x = 0;
+    gint parent_off_y = 0;
+    GimpViewable* parent = gimp_viewable_get_parent(GIMP_VIEWABLE(g_object));
+    if (parent)
+      gimp_item_get_offset(GIMP_ITEM(parent), &parent_off_x, &parent_off_y);
+
+    // back into the coordinates of the parent's projection
+    dirty.unite(Rectangle(result_area.x + gimp_item_get_offset_x(GIMP_ITEM(g_object)) - parent_off_x,
+                          result_area.y + gimp_item_get_offset_y(GIMP_ITEM(g_object)) - parent_off_y,
+                          result_area.width, result_area.height));
+    scratch_discarded = true;
+  } else {
+    refilter_all = true;
+  }
+
+  g_free(pending_cache_key);
+  pending_cache_key = NULL;
+
+  if (native_idle_id) {
+    // nothing else ends an in-process run
+    finish_native();
+    finish_area();
+    set_waiting_for_runner(false);
+  } else {
+    // the plug-in calls end() when it has noticed
+    runner->stop();
+  }
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 // Event handlers
 void GLib::FilterLayer::on_parent_changed (GimpViewable  *viewable,
@@ -1006,8 +1743,7 @@ void GLib::FilterLayer::on_stack_update (GimpDrawableStack *_stack,
 //      g_print("--->%s: Wait for other filter(%s).\n", ref(g_object)[gimp_object_get_name](), ref(layer) [gimp_object_get_name] ());
       waiting_process_stack = true;
       if (runner) {
-        runner->stop();
-        waiting_for_runner = false;
+        stop_runner();
       }
       break;
     }
@@ -1026,8 +1762,7 @@ void GLib::FilterLayer::on_stack_update (GimpDrawableStack *_stack,
       if (filter->is_waiting_to_be_processed()) {
         waiting_process_stack = true;
         if (runner) {
-          runner->stop();
-          waiting_for_runner = false;
+          stop_runner();
         }
         break;
       }
@@ -1043,6 +1778,16 @@ void GLib::FilterLayer::on_stack_update (GimpDrawableStack *_stack,
     invalidate_layer();
 
   } else if (!waiting_process_stack) {
+    // the input of the run in flight is outdated, don't wait for it
+    if (is_filtering() &&
+        gimp_rectangle_intersect(x, y, width, height,
+                                 self [gimp_item_get_offset_x] (),
+                                 self [gimp_item_get_offset_y] (),
+                                 self [gimp_item_get_width] (),
+                                 self [gimp_item_get_height] (),
+                                 NULL, NULL, NULL, NULL))
+      cancel_run();
+
     // waiting_process_stack: 5-1 we don't need to cache projected_tiles, nor record updates when this flag is set.
     invalidate_area(x, y, width, height);
   } else if ( !self [gimp_item_get_visible] () ) {
@@ -1086,8 +1831,7 @@ void GLib::FilterLayer::on_reorder (GimpContainer* _container,
 //        g_print("--->%s: Wait for other filter(%s).\n", ref(g_object)[gimp_object_get_name](), ref(layer) [gimp_object_get_name] ());
         waiting_process_stack = true;
         if (runner) {
-          runner->stop();
-          waiting_for_runner = false;
+          stop_runner();
         }
         is_at_bottom = false;
         break;
@@ -23,6 +23,7 @@
 // (the curves you can edit in the brush settings)
 
 class Mapping {
+  friend class MappingTable;
 private:
   typedef struct {
     // a set of control points (stepwise linear)
@@ -114,6 +115,11 @@ public:
     *y = p->yvalues[index];
   }
 
+  gsize get_memsize()
+  {
+    return sizeof(Mapping) + inputs * sizeof(ControlPoints);
+  }
+
   bool is_constant()
   {
     return inputs_used == 0;
@@ -171,6 +177,166 @@ public:
   }
 };
 
+
+// All mappings of a brush, compiled for evaluation on every dab.
+//
+// Each input of a mapping that has control points becomes one term:
+// the inner control points as segment breaks, and the end points
+// of every segment. The terms of all settings are stored side by side
+// (struct of arrays), ordered by setting and input, so that calculate()
+// is one loop over the used inputs only, without searching through the
+// control points. Inputs without control points and constant settings
+// cost nothing but their base value.
+//
+// The segments are interpolated with the same expression, and the terms
+// summed in the same order, as in Mapping::calculate(), so the values
+// are identical to the ones of the mappings.
+//
+// The table has to be compiled again whenever a mapping changes.
+
+class MappingTable {
+  enum { MAX_SEGMENTS = 7 };
+
+  int n_settings;
+  int n_terms;
+
+  float  *base_values;                       // n_settings
+  guint8 *term_setting;                      // n_terms
+  guint8 *term_input;
+  guint8 *term_n_breaks;
+  float (*term_breaks)[MAX_SEGMENTS - 1];
+  float (*term_x0)[MAX_SEGMENTS];
+  float (*term_y0)[MAX_SEGMENTS];
+  float (*term_x1)[MAX_SEGMENTS];
+  float (*term_y1)[MAX_SEGMENTS];
+
+  void free_terms() {
+    g_free(term_setting);
+    g_free(term_input);
+    g_free(term_n_breaks);
+    g_free(term_breaks);
+    g_free(term_x0);
+    g_free(term_y0);
+    g_free(term_x1);
+    g_free(term_y1);
+  }
+
+public:
+  MappingTable(int n_settings_) {
+    n_settings    = n_settings_;
+    n_terms       = 0;
+    base_values   = g_new0(float, n_settings);
+    term_setting  = NULL;
+    term_input    = NULL;
+    term_n_breaks = NULL;
+    term_breaks   = NULL;
+    term_x0       = NULL;
+    term_y0       = NULL;
+    term_x1       = NULL;
+    term_y1       = NULL;
+  }
+  ~MappingTable() {
+    g_free(base_values);
+    free_terms();
+  }
+
+  // owns its arrays, a copy would free them twice
+  MappingTable(const MappingTable& src) = delete;
+  MappingTable& operator = (const MappingTable& rhs) = delete;
+
+  void compile (Mapping ** mappings)
+  {
+    int n = 0;
+    for (int i = 0; i < n_settings; i++) {
+      Mapping * m = mappings[i];
+      for (int j = 0; j < m->inputs; j++) {
+        if (m->pointsList[j].n) n++;
+      }
+    }
+
+    if (n != n_terms) {
+      free_terms();
+      n_terms       = n;
+      term_setting  = g_new(guint8, n);
+      term_input    = g_new(guint8, n);
+      term_n_breaks = g_new(guint8, n);
+      term_breaks   = (float (*)[MAX_SEGMENTS - 1]) g_new(float, n * (MAX_SEGMENTS - 1));
+      term_x0       = (float (*)[MAX_SEGMENTS]) g_new(float, n * MAX_SEGMENTS);
+      term_y0       = (float (*)[MAX_SEGMENTS]) g_new(float, n * MAX_SEGMENTS);
+      term_x1       = (float (*)[MAX_SEGMENTS]) g_new(float, n * MAX_SEGMENTS);
+      term_y1       = (float (*)[MAX_SEGMENTS]) g_new(float, n * MAX_SEGMENTS);
+    }
+
+    int t = 0;
+    for (int i = 0; i < n_settings; i++) {
+      Mapping * m = mappings[i];
+      base_values[i] = m->base_value;
+
+      for (int j = 0; j < m->inputs; j++) {
+        Mapping::ControlPoints * p = m->pointsList + j;
+        if (!p->n) continue;
+
+        int segments = p->n - 1;
+        term_setting[t]  = i;
+        term_input[t]    = j;
+        term_n_breaks[t] = segments - 1;
+
+        // Mapping::calculate() stays on a segment while x <= its end,
+        // and extrapolates the first and the last segment
+        for (int k = 0; k < segments; k++) {
+          if (k < segments - 1)
+            term_breaks[t][k] = p->xvalues[k+1];
+
+          term_x0[t][k] = p->xvalues[k];
+          term_y0[t][k] = p->yvalues[k];
+          term_x1[t][k] = p->xvalues[k+1];
+          term_y1[t][k] = p->yvalues[k+1];
+        }
+        t++;
+      }
+    }
+  }
+
+  // values[i] = mappings[i]->calculate(data), for all settings
+  void calculate (const float * data, float * values)
+  {
+    for (int i = 0; i < n_settings; i++)
+      values[i] = base_values[i];
+
+    for (int t = 0; t < n_terms; t++) {
+      float x = data[term_input[t]];
+      int   k = 0;
+
+      // the breaks are sorted, so counting them finds the segment
+      for (int b = 0; b < term_n_breaks[t]; b++)
+        k += (x > term_breaks[t][b]);
+
+      float x0 = term_x0[t][k];
+      float y0 = term_y0[t][k];
+      float x1 = term_x1[t][k];
+      float y1 = term_y1[t][k];
+      float y;
+
+      if (x0 == x1) {
+        y = y0;
+      } else {
+        // linear interpolation
+        y = (y1*(x - x0) + y0*(x1 - x)) / (x1 - x0);
+      }
+
+      values[term_setting[t]] += y;
+    }
+  }
+
+  gsize get_memsize()
+  {
+    return sizeof(MappingTable) +
+           n_settings * sizeof(float) +
+           n_terms * (3 * sizeof(guint8) +
+                      (5 * MAX_SEGMENTS - 1) * sizeof(float));
+  }
+};
+
 #undef assert
 
 #endif
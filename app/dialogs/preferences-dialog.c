@@ -1616,6 +1616,19 @@ prefs_dialog_new (Gimp       *gimp,
                           _("Keep record of used files in the Recent Documents list"),
                           GTK_BOX (vbox2));
 
+  /*  XCF Files  */
+  vbox2 = prefs_frame_new (_("XCF Files"), GTK_CONTAINER (vbox), FALSE);
+
+  prefs_check_button_add (object, "xcf-fast-compression",
+                          _("Use fast compression (not readable by older versions)"),
+                          GTK_BOX (vbox2));
+  prefs_check_button_add (object, "xcf-lazy-loading",
+                          _("Load layers only when they are used"),
+                          GTK_BOX (vbox2));
+  prefs_check_button_add (object, "xcf-incremental-save",
+                          _("Save only the changed parts of layers"),
+                          GTK_BOX (vbox2));
+
 
   /***************/
   /*  Interface  */
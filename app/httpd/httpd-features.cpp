@@ -82,5 +82,7 @@ HTTPDFeature::restore    (Gimp* gimp, GimpInitStatusFunc callback)
 gboolean
 HTTPDFeature::exit       (Gimp *gimp, gboolean force)
 {
+  if (rest_daemon)
+    rest_daemon->stop();
   return FALSE;
 }
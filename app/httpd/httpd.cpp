@@ -35,11 +35,193 @@ extern "C" {
 /////////////////////////////////////////////////////////////////////////////
 /// Class HTTPD
 ///  Base class of http server
+
+// Requests are handled below painting and projection updates.
+#define HTTPD_DISPATCH_PRIORITY  G_PRIORITY_DEFAULT_IDLE
+
+// Time in microseconds one idle pass may spend on handling requests.
+#define HTTPD_DISPATCH_BUDGET    10000
+
+struct HTTPD::Request {
+  SoupServer*        server;
+  SoupMessage*       message;
+  gchar*             path;
+  GHashTable*        queries;
+  SoupClientContext* context;
+};
+
+static GQuark
+httpd_quark()
+{
+  return g_quark_from_static_string("gimp-httpd");
+}
+
+static GQuark
+httpd_deferred_quark()
+{
+  return g_quark_from_static_string("gimp-httpd-deferred");
+}
+
+static gboolean
+invoke_callback(std::function<void()>* func)
+{
+  (*func)();
+  return FALSE;
+}
+
+static void
+destroy_invoke_callback(std::function<void()>* func)
+{
+  delete func;
+}
+
+
+HTTPD::HTTPD(Gimp* _gimp) :
+  gimp(_gimp), server(NULL), server_context(NULL), server_loop(NULL),
+  server_thread(NULL), requests(NULL), dispatch_scheduled(0)
+{
+}
+
+HTTPD::~HTTPD()
+{
+  stop();
+}
+
 void HTTPD::run() {
-  GError* error;
-  auto server = Soup::ref( soup_server_new(SOUP_SERVER_SERVER_HEADER, "gimp", NULL) );
-  server [soup_server_listen_local] (port(), (SoupServerListenOptions)0, &error);
-  server.add_handler("/", Delegators::delegator(this, &HTTPD::handle_request));
+  if (server_thread)
+    return;
+
+  server_context = g_main_context_new();
+  server_loop    = g_main_loop_new(server_context, FALSE);
+  requests       = g_async_queue_new();
+  server_thread  = g_thread_new("httpd", GThreadFunc(server_thread_func), this);
+}
+
+void HTTPD::stop() {
+  if (!server_thread)
+    return;
+
+  invoke([this] { g_main_loop_quit(server_loop); });
+  g_thread_join(server_thread);
+  server_thread = NULL;
+
+  // the paused requests are dropped together with the server
+  while (Request* request = (Request*) g_async_queue_try_pop(requests)) {
+    g_object_unref(request->message);
+    if (request->queries)
+      g_hash_table_unref(request->queries);
+    g_free(request->path);
+    g_slice_free(Request, request);
+  }
+  if (dispatch_scheduled)
+    g_idle_remove_by_data(this);
+
+  g_async_queue_unref(requests);
+  g_main_loop_unref(server_loop);
+  g_main_context_unref(server_context);
+  requests       = NULL;
+  server_loop    = NULL;
+  server_context = NULL;
+}
+
+gpointer HTTPD::server_thread_func(HTTPD* httpd) {
+  GError* error = NULL;
+
+  // the server attaches its sources to the thread default context
+  g_main_context_push_thread_default(httpd->server_context);
+
+  httpd->server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "gimp", NULL);
+  auto server = Soup::ref(httpd->server);
+  if (server [soup_server_listen_local] (httpd->port(), (SoupServerListenOptions)0, &error)) {
+    server.add_handler("/", Delegators::delegator(httpd, &HTTPD::queue_request));
+    g_main_loop_run(httpd->server_loop);
+  } else {
+    g_printerr("httpd: %s\n", error->message);
+    g_clear_error(&error);
+  }
+
+  g_object_unref(httpd->server);
+  httpd->server = NULL;
+  g_main_context_pop_thread_default(httpd->server_context);
+
+  return NULL;
+}
+
+// Called in the server thread.
+void HTTPD::queue_request(SoupServer*        server,
+                          SoupMessage*       msg,
+                          const char*        path,
+                          GHashTable*        queries,
+                          SoupClientContext* context)
+{
+  Request* request = g_slice_new(Request);
+
+  request->server  = server;
+  request->message = SOUP_MESSAGE(g_object_ref(msg));
+  request->path    = g_strdup(path);
+  request->queries = queries ? g_hash_table_ref(queries) : NULL;
+  request->context = context;
+
+  g_object_set_qdata(G_OBJECT(msg), httpd_quark(), this);
+  soup_server_pause_message(server, msg);
+  g_async_queue_push(requests, request);
+
+  // g_idle_add() attaches to the default context of the main thread
+  if (g_atomic_int_compare_and_exchange(&dispatch_scheduled, 0, 1))
+    g_idle_add_full(HTTPD_DISPATCH_PRIORITY, GSourceFunc(dispatch_requests), this, NULL);
+}
+
+// Called in the main thread.
+gboolean HTTPD::dispatch_requests(HTTPD* httpd) {
+  gint64 deadline = g_get_monotonic_time() + HTTPD_DISPATCH_BUDGET;
+
+  while (g_get_monotonic_time() < deadline) {
+    Request* request = (Request*) g_async_queue_try_pop(httpd->requests);
+
+    if (!request) {
+      g_atomic_int_set(&httpd->dispatch_scheduled, 0);
+
+      // a request may have been queued before the flag was cleared
+      if (g_async_queue_length(httpd->requests) > 0 &&
+          g_atomic_int_compare_and_exchange(&httpd->dispatch_scheduled, 0, 1))
+        continue;
+      return FALSE;
+    }
+
+    httpd->handle_request(request->server, request->message, request->path,
+                          request->queries, request->context);
+
+    if (!g_object_steal_qdata(G_OBJECT(request->message), httpd_deferred_quark()))
+      httpd->complete(request->message);
+
+    g_object_unref(request->message);
+    if (request->queries)
+      g_hash_table_unref(request->queries);
+    g_free(request->path);
+    g_slice_free(Request, request);
+  }
+
+  return TRUE;
+}
+
+void HTTPD::invoke(std::function<void()> func) {
+  g_main_context_invoke_full(server_context, G_PRIORITY_DEFAULT,
+                             GSourceFunc(invoke_callback),
+                             new std::function<void()>(std::move(func)),
+                             GDestroyNotify(destroy_invoke_callback));
+}
+
+void HTTPD::complete(SoupMessage* msg) {
+  g_object_ref(msg);
+  invoke([this, msg] {
+    if (server)
+      soup_server_unpause_message(server, msg);
+    g_object_unref(msg);
+  });
+}
+
+HTTPD* HTTPD::from_message(SoupMessage* msg) {
+  return (HTTPD*) g_object_get_qdata(G_OBJECT(msg), httpd_quark());
 }
 
 
@@ -130,6 +312,27 @@ RESTResource::req_headers()
 }
 
 
+void
+RESTResource::defer_response()
+{
+  g_object_set_qdata(G_OBJECT(message), httpd_deferred_quark(), GINT_TO_POINTER(TRUE));
+}
+
+
+void
+RESTResource::complete_response(SoupMessage* msg)
+{
+  HTTPD::from_message(msg)->complete(msg);
+}
+
+
+void
+RESTResource::server_invoke(SoupMessage* msg, std::function<void()> func)
+{
+  HTTPD::from_message(msg)->invoke(std::move(func));
+}
+
+
 JSON::INode
 RESTResource::req_body_json()
 {
@@ -26,13 +26,35 @@
 #include "base/soup-cxx-utils.hpp"
 #include "base/json-cxx-utils.hpp"
 
+// The server runs in a thread of its own with its own main context, so
+// neither slow clients nor large bodies stall painting. Requests are
+// paused and queued there, and handle_request() is called for them in
+// the main thread, in batches from a low priority idle. When
+// handle_request() returns, the response is sent from the server thread,
+// unless the request was deferred.
 class HTTPD {
 protected:
-  Gimp* gimp;
+  struct Request;
+
+  Gimp*         gimp;
+  SoupServer*   server;
+  GMainContext* server_context;
+  GMainLoop*    server_loop;
+  GThread*      server_thread;
+  GAsyncQueue*  requests;
+  gint          dispatch_scheduled;
+
+  static gpointer server_thread_func(HTTPD* httpd);
+  static gboolean dispatch_requests(HTTPD* httpd);
+  void queue_request(SoupServer*        server,
+                     SoupMessage*       msg,
+                     const char*        path,
+                     GHashTable*        queries,
+                     SoupClientContext* context);
 
 public:
-  HTTPD(Gimp* _gimp) : gimp(_gimp) { };
-  virtual ~HTTPD() { };
+  HTTPD(Gimp* _gimp);
+  virtual ~HTTPD();
 
   virtual gint port() = 0;
   virtual void handle_request(SoupServer* server,
@@ -41,6 +63,15 @@ public:
                               GHashTable* queries,
                               SoupClientContext* context) = 0;
   void run();
+  void stop();
+
+  // Calls func in the server thread.
+  void invoke(std::function<void()> func);
+
+  // Sends the response of msg, which was received by this server.
+  void complete(SoupMessage* msg);
+
+  static HTTPD* from_message(SoupMessage* msg);
 };
 
 class RESTResourceFactory;
@@ -95,8 +126,17 @@ protected:
   JSON::INode         req_body_json();
   SoupMessageHeaders* req_headers();
 
+  // A deferred response is not sent when the handler returns, but by
+  // complete_response(), e.g. after the data is encoded in a worker.
+  void defer_response();
+  static void complete_response(SoupMessage* msg);
+
+  // Calls func in the thread of the server which received msg. The
+  // bodies of streamed responses are appended there.
+  static void server_invoke(SoupMessage* msg, std::function<void()> func);
+
 public:
-  ~RESTResource() {}
+  virtual ~RESTResource() {}
 
   RESTResource(Gimp*                   _gimp,
                RESTD::Router::Matched* m,
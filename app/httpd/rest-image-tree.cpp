@@ -34,6 +34,10 @@ extern "C" {
 #include "core/core-types.h"
 #include "pdb/pdb-types.h"
 
+#include "base/tile.h"
+#include "base/tile-manager.h"
+#include "base/tile-pyramid.h"
+
 #include "core/gimpimage.h"
 #include "core/gimpimage-new.h"
 #include "core/gimplayer.h"
@@ -44,6 +48,7 @@ extern "C" {
 #include "pdb/gimppdb-query.h"
 #include "pdb/gimpprocedure.h"
 #include "core/gimpgrouplayer.h"
+#include "core/gimpprojection.h"
 }
 #include "core/gimpfilterlayer.h"
 #include "core/gimpclonelayer.h"
@@ -69,7 +74,7 @@ template<> inline GType g_type<GimpLayerModeEffects>() { return GIMP_TYPE_LAYER_
 template<> inline GType g_type<GimpImageBaseType>() { return GIMP_TYPE_IMAGE_BASE_TYPE; }
 };
 
-enum EMethodId { none = 0, info, data, preview };
+enum EMethodId { none = 0, info, data, preview, tiles, raw };
 struct MethodMap {
   const gchar* method_name;
   EMethodId method_id;
@@ -78,7 +83,9 @@ struct MethodMap {
 MethodMap method_map[] = {
     { "info", info },
     { "data", data },
-    { "preview", preview }
+    { "preview", preview },
+    { "tiles", tiles },
+    { "raw", raw }
 };
 
 
@@ -247,12 +254,18 @@ class RESTImageTree : public RESTResource {
 
   void get_info(GLib::IObject<GimpItem> item);
   void get_data(GLib::IObject<GimpItem> item, const gchar* format, gint max_size = 0);
+  void get_tile(GLib::IObject<GimpItem> item);
+  void get_raw(GLib::IObject<GimpItem> item);
   template<typename Converter, typename... Args> void put_data(GLib::IObject<GimpItem> item, Args... args);
   bool parse_path(const gchar* path, GLib::IObject<GimpItem>& item, EMethodId& method_id);
 
+  // path components following the method, e.g. level, x and y of #tiles
+  gchar** method_args;
+
 public:
   RESTImageTree(Gimp* gimp, RESTD::Router::Matched* matched, SoupMessage* msg, SoupClientContext* context) :
-    RESTResource(gimp, matched, msg, context) { }
+    RESTResource(gimp, matched, msg, context), method_args(NULL) { }
+  virtual ~RESTImageTree() { g_strfreev(method_args); }
   virtual void get();
   virtual void put();
   virtual void post();
@@ -356,10 +369,66 @@ RESTImageTree::get_info(GLib::IObject<GimpItem> item) {
 }
 
 
-static gboolean
-ostream_close(GMemoryOutputStream* stream)
+// Encodes the pixbuf of a #data or #preview request in a worker thread,
+// the pixbuf is not touched by the main thread any more.
+struct EncodeRequest {
+  SoupMessage* message;
+  GdkPixbuf*   pixbuf;
+  gchar*       format;
+  gchar*       item_name;
+};
+
+static void
+encode_request_free(EncodeRequest* request)
 {
-  return g_output_stream_close((GOutputStream*)stream, NULL, NULL);
+  g_object_unref(request->message);
+  g_object_unref(request->pixbuf);
+  g_free(request->format);
+  g_free(request->item_name);
+  g_slice_free(EncodeRequest, request);
+}
+
+static void
+encode_pixbuf_thread(GTask* task, gpointer source, EncodeRequest* request, GCancellable* cancellable)
+{
+  gchar* buffer;
+  gsize  size;
+
+  if (gdk_pixbuf_save_to_buffer(request->pixbuf, &buffer, &size, request->format, NULL, NULL))
+    g_task_return_pointer(task, g_bytes_new_take(buffer, size), GDestroyNotify(g_bytes_unref));
+  else
+    g_task_return_pointer(task, NULL, NULL);
+}
+
+static void
+encode_pixbuf_finished(GObject* source, GAsyncResult* result, gpointer data)
+{
+  EncodeRequest* request = (EncodeRequest*) g_task_get_task_data(G_TASK(result));
+  GBytes*        bytes   = (GBytes*) g_task_propagate_pointer(G_TASK(result), NULL);
+  auto           imessage = GLib::ref(request->message);
+
+  if (bytes) {
+    GLib::CString mime_format = g_strdup_printf("image/%s", request->format);
+    gsize         size;
+    gconstpointer encoded = g_bytes_get_data(bytes, &size);
+
+    soup_message_set_response(request->message, mime_format, SOUP_MEMORY_COPY,
+                              (const char*) encoded, size);
+    imessage.set("status-code", 200);
+    g_bytes_unref(bytes);
+  } else {
+    GLib::CString error = g_strdup_printf("Failed to convert image data of \"%s\".",
+                                          request->item_name);
+    JSON::Node    root  = JSON::build_object([&](auto it) {
+      it["error"] = (const gchar*) error;
+    });
+    GLib::CString text  = json_to_string(root, FALSE);
+    soup_message_set_response(request->message, "application/json; charset=utf-8",
+                              SOUP_MEMORY_COPY, text, strlen(text));
+    imessage.set("status-code", 500);
+  }
+
+  RESTResource::complete_response(request->message);
 }
 
 
@@ -411,20 +480,19 @@ RESTImageTree::get_data(GLib::IObject<GimpItem> item, const gchar* format, gint
       pixbuf = item [gimp_viewable_get_pixbuf] (gimp_get_user_context(gimp), w, h);
     }
 
-    ScopedPointer<GMemoryOutputStream, decltype(ostream_close), ostream_close>
-    ostream = (GMemoryOutputStream*)(g_memory_output_stream_new (NULL, 0, g_realloc, g_free));
-    GError* error = NULL;
-
     if (pixbuf) {
-      if (gdk_pixbuf_save_to_stream (pixbuf, (GOutputStream*)ostream.ptr(), format, NULL, &error, NULL)) {
-        GLib::CString mime_format = g_strdup_printf("image/%s", format);
-        soup_message_set_response (message, mime_format, SOUP_MEMORY_COPY,
-                                   (const char*)g_memory_output_stream_get_data(ostream),
-                                   g_memory_output_stream_get_data_size(ostream));
-        imessage.set("status-code", 200);
-      } else {
-        make_error_response(500, "Failed to convert image data of \"%s\".", item_name);
-      }
+      EncodeRequest* request = g_slice_new(EncodeRequest);
+      GTask*         task    = g_task_new(NULL, NULL, encode_pixbuf_finished, NULL);
+
+      request->message   = SOUP_MESSAGE(g_object_ref(message));
+      request->pixbuf    = GDK_PIXBUF(g_object_ref(pixbuf));
+      request->format    = g_strdup(format);
+      request->item_name = g_strdup(item_name);
+
+      defer_response();
+      g_task_set_task_data(task, request, GDestroyNotify(encode_request_free));
+      g_task_run_in_thread(task, GTaskThreadFunc(encode_pixbuf_thread));
+      g_object_unref(task);
     } else {
       make_error_response(403, "Cannot convert item(%s) to image data.", item_name);
     }
@@ -432,6 +500,303 @@ RESTImageTree::get_data(GLib::IObject<GimpItem> item, const gchar* format, gint
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Raw tiles
+//
+// #tiles serves the 64x64 tiles of an item as they are stored in its
+// TileManager, without converting them to an image format:
+//
+//   .../#tiles                   JSON description of the tile grid
+//   .../#tiles/{level}/{x}/{y}   pixels of one tile, row by row
+//
+// Images serve the levels of their projection's TilePyramid, where level
+// n is downscaled by 2^n and premultiplied for n > 0. Layers only have
+// level 0. The ETag is a checksum of the tile content, so clients can
+// revalidate every tile cheaply with If-None-Match. Clients which accept
+// the deflate content coding get the tile compressed.
+//
+// #raw streams the whole level 0 as one body with chunked transfer
+// encoding, one strip of tiles per chunk.
+
+static TileManager*
+get_item_tiles(GimpItem* item, gint level, gboolean* is_premult)
+{
+  if (is_premult)
+    *is_premult = FALSE;
+
+  if (level < 0 || level >= PYRAMID_MAX_LEVELS)
+    return NULL;
+
+  if (GIMP_IS_IMAGE(item)) {
+    GimpImage*   image = GIMP_IMAGE(item);
+    TileManager* tm    =
+      gimp_projection_get_tiles_at_level(gimp_image_get_projection(image),
+                                         level, is_premult);
+
+    // the pyramid hands out its top level for levels above it, level n
+    // of the pyramid is exactly the image size shifted by n
+    if (tm && (tile_manager_width(tm)  != gimp_image_get_width(image)  >> level ||
+               tile_manager_height(tm) != gimp_image_get_height(image) >> level))
+      return NULL;
+    return tm;
+
+  } else if (GIMP_IS_DRAWABLE(item) && level == 0) {
+    return gimp_drawable_get_tiles(GIMP_DRAWABLE(item));
+  }
+  return NULL;
+}
+
+static bool
+accepts_deflate(SoupMessage* message)
+{
+  const gchar* encodings = soup_message_headers_get_list(message->request_headers,
+                                                         "Accept-Encoding");
+  return encodings && soup_header_contains(encodings, "deflate");
+}
+
+// Returns data compressed in the zlib format of the deflate content coding.
+static GBytes*
+deflate_bytes(const guchar* data, gsize size)
+{
+  GZlibCompressor* compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, 1);
+  GOutputStream*   memory     = g_memory_output_stream_new(NULL, 0, g_realloc, g_free);
+  GOutputStream*   ostream    = g_converter_output_stream_new(memory, G_CONVERTER(compressor));
+  GBytes*          result     = NULL;
+
+  if (g_output_stream_write_all(ostream, data, size, NULL, NULL, NULL) &&
+      g_output_stream_close(ostream, NULL, NULL))
+    result = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(memory));
+
+  g_object_unref(ostream);
+  g_object_unref(memory);
+  g_object_unref(compressor);
+
+  return result;
+}
+
+
+void
+RESTImageTree::get_tile(GLib::IObject<GimpItem> item)
+{
+  auto imessage = GLib::ref(message);
+
+  if (!item) {
+    make_error_response(404, "Tiles need an image or a layer.");
+    return;
+  }
+
+  gchar** args = method_args;
+  if (!args || !args[0] || !args[1] || !args[2]) {
+    make_json_response(200,
+        JSON::build_object([&](auto it){
+          it["tile-width"]  = TILE_WIDTH;
+          it["tile-height"] = TILE_HEIGHT;
+          it["levels"] = it.array([&](auto it){
+            for (gint level = 0; level < PYRAMID_MAX_LEVELS; level ++) {
+              gboolean     premult;
+              TileManager* tm = get_item_tiles(item, level, &premult);
+              if (!tm)
+                break;
+              it = it.object([&](auto it){
+                gint width  = tile_manager_width(tm);
+                gint height = tile_manager_height(tm);
+                it["width"]         = width;
+                it["height"]        = height;
+                it["columns"]       = (width  + TILE_WIDTH  - 1) / TILE_WIDTH;
+                it["rows"]          = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+                it["bpp"]           = tile_manager_bpp(tm);
+                it["premultiplied"] = bool(premult);
+              });
+            }
+          });
+        }));
+    return;
+  }
+
+  gint         level   = atoi(args[0]);
+  gint         col     = atoi(args[1]);
+  gint         row     = atoi(args[2]);
+  gboolean     premult = FALSE;
+  TileManager* tm      = get_item_tiles(item, level, &premult);
+
+  if (!tm) {
+    make_error_response(404, "Level %d is not found.", level);
+    return;
+  }
+
+  if (col < 0 || col * TILE_WIDTH  >= tile_manager_width(tm) ||
+      row < 0 || row * TILE_HEIGHT >= tile_manager_height(tm)) {
+    make_error_response(404, "Tile %d,%d is not found.", col, row);
+    return;
+  }
+
+  Tile*          tile = tile_manager_get_tile(tm, col * TILE_WIDTH, row * TILE_HEIGHT,
+                                              TRUE, FALSE);
+  const guchar*  data = (const guchar*) tile_data_pointer(tile, 0, 0);
+  gsize          size = tile_size(tile);
+  GLib::CString  sum  = g_compute_checksum_for_data(G_CHECKSUM_MD5, data, size);
+  GLib::CString  etag = g_strdup_printf("\"%s\"", (const gchar*) sum);
+  GLib::CString  ewidth  = g_strdup_printf("%d", tile_ewidth(tile));
+  GLib::CString  eheight = g_strdup_printf("%d", tile_eheight(tile));
+  GLib::CString  bpp     = g_strdup_printf("%d", tile_bpp(tile));
+  const gchar*   match   = soup_message_headers_get_one(message->request_headers,
+                                                        "If-None-Match");
+  SoupMessageHeaders* headers = message->response_headers;
+
+  soup_message_headers_replace(headers, "ETag", etag);
+  soup_message_headers_replace(headers, "Cache-Control", "no-cache");
+  soup_message_headers_replace(headers, "X-Tile-Width",  ewidth);
+  soup_message_headers_replace(headers, "X-Tile-Height", eheight);
+  soup_message_headers_replace(headers, "X-Tile-Bpp",    bpp);
+  soup_message_headers_replace(headers, "X-Tile-Premultiplied", premult ? "true" : "false");
+
+  if (match && strcmp(match, etag) == 0) {
+    imessage.set("status-code", 304);
+
+  } else if (accepts_deflate(message)) {
+    GBytes* bytes = deflate_bytes(data, size);
+    if (bytes) {
+      gsize length;
+      gconstpointer compressed = g_bytes_get_data(bytes, &length);
+      soup_message_headers_replace(headers, "Content-Encoding", "deflate");
+      soup_message_set_response(message, "application/octet-stream", SOUP_MEMORY_COPY,
+                                (const char*) compressed, length);
+      g_bytes_unref(bytes);
+      imessage.set("status-code", 200);
+    } else {
+      make_error_response(500, "Failed to compress tile %d,%d.", col, row);
+    }
+
+  } else {
+    soup_message_set_response(message, "application/octet-stream", SOUP_MEMORY_COPY,
+                              (const char*) data, size);
+    imessage.set("status-code", 200);
+  }
+
+  tile_release(tile, FALSE);
+}
+
+
+// Feeds the pixels of a tile manager into a chunked response, one strip
+// of tiles whenever the previous one has been written. The tiles are a
+// copy-on-write snapshot, so the stream is consistent even when the item
+// is painted on meanwhile.
+//
+// The signals of the message are emitted in the server thread, the
+// strips are read in the main thread which owns the tiles, and appended
+// to the body in the server thread again.
+class RawStreamer {
+  SoupMessage* message;
+  TileManager* tiles;
+  gint         row;
+  gint         ref_count;
+  gboolean     finished;
+
+  static void on_wrote_chunk(SoupMessage* msg, RawStreamer* streamer) {
+    g_atomic_int_inc(&streamer->ref_count);
+    g_idle_add(GSourceFunc(read_next_callback), streamer);
+  }
+
+  static void on_finished(SoupMessage* msg, RawStreamer* streamer) {
+    g_signal_handlers_disconnect_by_data(msg, streamer);
+    g_idle_add(GSourceFunc(finished_callback), streamer);
+  }
+
+  static gboolean read_next_callback(RawStreamer* streamer) {
+    if (!streamer->finished)
+      streamer->append_next();
+    streamer->unref();
+    return FALSE;
+  }
+
+  static gboolean finished_callback(RawStreamer* streamer) {
+    streamer->finished = TRUE;
+    streamer->unref();
+    return FALSE;
+  }
+
+  ~RawStreamer() {
+    tile_manager_unref(tiles);
+    g_object_unref(message);
+  }
+
+  void unref() {
+    if (g_atomic_int_dec_and_test(&ref_count))
+      delete this;
+  }
+
+public:
+  RawStreamer(SoupMessage* msg, TileManager* tm) : row(0), ref_count(1), finished(FALSE) {
+    message = SOUP_MESSAGE(g_object_ref(msg));
+    tiles   = tile_manager_duplicate(tm);
+    g_signal_connect(message, "wrote-chunk", G_CALLBACK(on_wrote_chunk), this);
+    g_signal_connect(message, "finished",    G_CALLBACK(on_finished),    this);
+  }
+
+  // Called in the main thread.
+  void append_next() {
+    gint         width  = tile_manager_width(tiles);
+    gint         height = tile_manager_height(tiles);
+    gint         bpp    = tile_manager_bpp(tiles);
+    SoupMessage* msg    = SOUP_MESSAGE(g_object_ref(message));
+
+    if (row >= height) {
+      RESTResource::server_invoke(msg, [msg] {
+        soup_message_body_complete(msg->response_body);
+        RESTResource::complete_response(msg);
+        g_object_unref(msg);
+      });
+      return;
+    }
+
+    gint    rows   = MIN(TILE_HEIGHT, height - row);
+    gsize   stride = (gsize) width * bpp;
+    gsize   size   = stride * rows;
+    guchar* strip  = (guchar*) g_malloc(size);
+
+    tile_manager_read_pixel_data(tiles, 0, row, width - 1, row + rows - 1,
+                                 strip, stride);
+    row += rows;
+
+    RESTResource::server_invoke(msg, [msg, strip, size] {
+      soup_message_body_append(msg->response_body, SOUP_MEMORY_TAKE, strip, size);
+      RESTResource::complete_response(msg);
+      g_object_unref(msg);
+    });
+  }
+};
+
+
+void
+RESTImageTree::get_raw(GLib::IObject<GimpItem> item)
+{
+  auto         imessage = GLib::ref(message);
+  TileManager* tm       = item ? get_item_tiles(item, 0, NULL) : NULL;
+
+  if (!tm) {
+    make_error_response(404, "Raw data needs an image or a layer.");
+    return;
+  }
+
+  GLib::CString width  = g_strdup_printf("%d", tile_manager_width(tm));
+  GLib::CString height = g_strdup_printf("%d", tile_manager_height(tm));
+  GLib::CString bpp    = g_strdup_printf("%d", tile_manager_bpp(tm));
+  SoupMessageHeaders* headers = message->response_headers;
+
+  soup_message_headers_set_encoding(headers, SOUP_ENCODING_CHUNKED);
+  soup_message_headers_set_content_type(headers, "application/octet-stream", NULL);
+  soup_message_headers_replace(headers, "X-Image-Width",  width);
+  soup_message_headers_replace(headers, "X-Image-Height", height);
+  soup_message_headers_replace(headers, "X-Image-Bpp",    bpp);
+  imessage.set("status-code", 200);
+
+  // the first strip is sent together with the headers
+  defer_response();
+  RawStreamer* streamer = new RawStreamer(message, tm);
+  streamer->append_next();
+}
+
+
 template<typename Converter, typename... Args> void
 RESTImageTree::put_data(GLib::IObject<GimpItem> item, Args... args)
 {
@@ -512,7 +877,8 @@ RESTImageTree::parse_path(const gchar* path, GLib::IObject<GimpItem>& item, EMet
       for (int j = 0; j < sizeof(method_map) / sizeof(MethodMap); j ++) {
         MethodMap* map = &method_map[j];
         if (strcmp(map->method_name, method_name) == 0) {
-          method_id = map->method_id;
+          method_id   = map->method_id;
+          method_args = g_strdupv(&path_list[i + 1]);
           break;
         }
       }
@@ -591,6 +957,12 @@ void RESTImageTree::get()
   case preview:
     get_data(item, "jpeg", 128);
     break;
+  case tiles:
+    get_tile(item);
+    break;
+  case raw:
+    get_raw(item);
+    break;
   default:
     break;
   }
@@ -32,6 +32,7 @@ extern "C" {
 #include "pdb/pdb-types.h"
 
 #include "core/gimpimage.h"
+#include "core/gimpimage-undo.h"
 #include "core/gimplayer.h"
 #include "core/gimpdrawable.h"
 #include "core/gimpitem.h"
@@ -43,6 +44,8 @@ extern "C" {
 #include "rest-pdb.h"
 #include "pdb/pdb-cxx-utils.hpp"
 
+#include "gimp-intl.h"
+
 ///////////////////////////////////////////////////////////////////////
 // Swagger interface
 
@@ -646,6 +649,130 @@ public:
 };
 
 
+///////////////////////////////////////////////////////////////////////
+// Document cache
+//
+// Publishing all procedures takes long enough to stall the UI, so the
+// path item of each procedure is built once and kept up to date by the
+// register-procedure and unregister-procedure signals of the PDB, which
+// fire for the temporary procedures of plug-ins too. The document is
+// only reassembled and serialized after a change, and is served with an
+// ETag computed from its text.
+
+template<typename Publisher>
+class PDBDocumentCache {
+  GimpPDB*    pdb;
+  Publisher   publisher;
+  GHashTable* paths;     // procedure name -> object holding its path item
+  bool        filled;
+  gchar*      document;
+  gchar*      etag;
+
+  PDBDocumentCache(GimpPDB* p) :
+    pdb(p),
+    paths(g_hash_table_new_full(g_str_hash, g_str_equal,
+                                g_free, GDestroyNotify(json_node_unref))),
+    filled(false), document(NULL), etag(NULL)
+  {
+    g_signal_connect(pdb, "register-procedure",
+                     G_CALLBACK(on_procedure_changed), this);
+    g_signal_connect(pdb, "unregister-procedure",
+                     G_CALLBACK(on_procedure_changed), this);
+  }
+
+  // Called after the PDB has changed the procedures of the name, which
+  // may still be served by a procedure registered earlier.
+  static void on_procedure_changed(GimpPDB* pdb, GimpProcedure* procedure,
+                                   PDBDocumentCache* cache) {
+    cache->update(gimp_object_get_name(GIMP_OBJECT(procedure)));
+  }
+
+  JsonNode* build_path(GimpProcedure* procedure) {
+    return JSON::build_object([&](auto it){
+      publisher.publish_one_proc(it, procedure);
+    });
+  }
+
+  void update(const gchar* name) {
+    if (!filled)
+      return;
+
+    GimpProcedure* procedure = gimp_pdb_lookup_procedure(pdb, name);
+    if (procedure)
+      g_hash_table_replace(paths, g_strdup(name), build_path(procedure));
+    else
+      g_hash_table_remove(paths, name);
+
+    g_free(document);
+    g_free(etag);
+    document = NULL;
+    etag     = NULL;
+  }
+
+  void fill() {
+    GHashTableIter iter;
+    gpointer       key;
+
+    g_hash_table_iter_init(&iter, pdb->procedures);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+      GimpProcedure* procedure = gimp_pdb_lookup_procedure(pdb, (const gchar*) key);
+      if (procedure)
+        g_hash_table_replace(paths, g_strdup((const gchar*) key), build_path(procedure));
+    }
+    filled = true;
+  }
+
+  void build_document() {
+    if (!filled)
+      fill();
+
+    GList*        names = g_list_sort(g_hash_table_get_keys(paths), GCompareFunc(strcmp));
+    JSON::Builder builder;
+
+    publisher.publish_site(builder, [&](auto it){
+      for (GList* list = names; list; list = g_list_next(list)) {
+        JsonObject* path    = json_node_get_object((JsonNode*) g_hash_table_lookup(paths, list->data));
+        GList*      members = json_object_get_members(path);
+
+        for (GList* member = members; member; member = g_list_next(member)) {
+          const gchar* name = (const gchar*) member->data;
+          it[name] = json_node_copy(json_object_get_member(path, name));
+        }
+        g_list_free(members);
+      }
+    });
+    g_list_free(names);
+
+    JSON::Node    root = JSON::ref(builder).get_root();
+    GLib::CString sum;
+
+    document = json_to_string(root, FALSE);
+    sum      = g_compute_checksum_for_string(G_CHECKSUM_MD5, document, -1);
+    etag     = g_strdup_printf("\"%s\"", (const gchar*) sum);
+  }
+
+public:
+  static PDBDocumentCache* get(GimpPDB* pdb) {
+    static PDBDocumentCache* cache = NULL;
+
+    if (!cache)
+      cache = new PDBDocumentCache(pdb);
+    return cache;
+  }
+
+  const gchar* get_document() {
+    if (!document)
+      build_document();
+    return document;
+  }
+
+  const gchar* get_etag() {
+    get_document();
+    return etag;
+  }
+};
+
+
 ///////////////////////////////////////////////////////////////////////
 // Argument configurator interface
 
@@ -988,6 +1115,13 @@ public:
     PDBSyncExecutor::execute(procedure, gimp, context, progress, args, display);
     serialize_values(procedure);
   }
+
+  GimpPDBStatusType get_status()
+  {
+    if (!result || result->n_values == 0)
+      return GIMP_PDB_EXECUTION_ERROR;
+    return GimpPDBStatusType(g_value_get_enum(&result->values[0]));
+  }
 };
 
 using JsonPDBRunner = ProcedureRunnerImpl<JsonArgConfigurator, JsonPDBSyncExecutor>;
@@ -1004,15 +1138,22 @@ void RESTPDB::get()
   auto imessage = GLib::ref(message);
 
   if (!proc_name) {
-    auto             pdb      = GLib::ref( gimp->pdb );
-    gint             num_procs;
-    gchar**          procs = NULL;
-    gboolean         query = pdb [gimp_pdb_query] (".*", ".*", ".*", ".*", ".*", ".*", ".*", &num_procs, &procs, NULL);
-
-    Publisher publisher;
-    JSON::INode result_json = publisher.publish(gimp->pdb, procs, num_procs);
-    make_json_response(200, result_json.ptr());
+    auto         cache    = PDBDocumentCache<Publisher>::get(gimp->pdb);
+    const gchar* document = cache->get_document();
+    const gchar* etag     = cache->get_etag();
+    const gchar* match    = soup_message_headers_get_one(message->request_headers,
+                                                         "If-None-Match");
+
+    soup_message_headers_replace(message->response_headers, "ETag", etag);
     soup_message_headers_append(message->response_headers, "Access-Control-Allow-Origin", "*");
+
+    if (match && strcmp(match, etag) == 0) {
+      imessage.set("status-code", 304);
+    } else {
+      soup_message_set_response(message, "application/json; charset=utf-8",
+                                SOUP_MEMORY_COPY, document, strlen(document));
+      imessage.set("status-code", 200);
+    }
   } else {
     auto           pdb       = GLib::ref( gimp->pdb );
     GimpProcedure* procedure = pdb [gimp_pdb_lookup_procedure] (proc_name);
@@ -1031,6 +1172,255 @@ void RESTPDB::get()
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Batch calls
+//
+// POST /api/v1/pdb/ runs an ordered list of calls in one request:
+//
+//   { "context": { "image": 1 },
+//     "calls": [ { "procedure": "gimp-layer-new", "arguments": { ... } },
+//                { "procedure": "gimp-image-insert-layer",
+//                  "arguments": { "layer": "$0.layer", ... } } ] }
+//
+// A string "$N.name" in the arguments or the context of a call is
+// replaced by the value "name" returned by call N, or else by the member
+// of its context. "$$" escapes a leading "$". A call without context uses
+// the context of the batch. The calls are grouped into one undo step of
+// the context image, and the displays are flushed once at the end. The
+// first failing call stops the batch, the response lists the results of
+// the calls run so far in the form a single call answers them.
+
+static JsonNode*
+lookup_reference(const gchar* ref, JsonArray* results)
+{
+  gchar*  end;
+  guint64 index = g_ascii_strtoull(ref + 1, &end, 10);
+
+  if (end == ref + 1 || *end != '.' || index >= json_array_get_length(results))
+    return NULL;
+
+  JsonObject*  result = json_array_get_object_element(results, index);
+  const gchar* name   = end + 1;
+  const gchar* parts[] = { "values", "context" };
+
+  for (guint i = 0; i < G_N_ELEMENTS(parts); i ++) {
+    if (!json_object_has_member(result, parts[i]))
+      continue;
+
+    JsonObject* part = json_object_get_object_member(result, parts[i]);
+    if (part && json_object_has_member(part, name))
+      return json_object_get_member(part, name);
+  }
+  return NULL;
+}
+
+// Returns a copy of node with the references replaced, or NULL and the
+// first reference which could not be resolved.
+static JsonNode*
+resolve_references(JsonNode* node, JsonArray* results, const gchar** unresolved)
+{
+  if (!node)
+    return json_node_new(JSON_NODE_NULL);
+
+  switch (JSON_NODE_TYPE(node)) {
+  case JSON_NODE_OBJECT: {
+    JsonObject* src     = json_node_get_object(node);
+    JsonObject* dest    = json_object_new();
+    GList*      members = json_object_get_members(src);
+    JsonNode*   result  = NULL;
+
+    for (GList* list = members; list; list = g_list_next(list)) {
+      const gchar* name   = (const gchar*) list->data;
+      JsonNode*    member = resolve_references(json_object_get_member(src, name),
+                                               results, unresolved);
+      if (!member)
+        break;
+      json_object_set_member(dest, name, member);
+    }
+
+    if (!*unresolved) {
+      result = json_node_new(JSON_NODE_OBJECT);
+      json_node_set_object(result, dest);
+    }
+    json_object_unref(dest);
+    g_list_free(members);
+    return result;
+  }
+
+  case JSON_NODE_ARRAY: {
+    JsonArray* src    = json_node_get_array(node);
+    JsonArray* dest   = json_array_new();
+    JsonNode*  result = NULL;
+
+    for (guint i = 0; i < json_array_get_length(src); i ++) {
+      JsonNode* element = resolve_references(json_array_get_element(src, i),
+                                             results, unresolved);
+      if (!element)
+        break;
+      json_array_add_element(dest, element);
+    }
+
+    if (!*unresolved) {
+      result = json_node_new(JSON_NODE_ARRAY);
+      json_node_set_array(result, dest);
+    }
+    json_array_unref(dest);
+    return result;
+  }
+
+  case JSON_NODE_VALUE:
+    if (json_node_get_value_type(node) == G_TYPE_STRING) {
+      const gchar* str = json_node_get_string(node);
+
+      if (str[0] == '$' && str[1] == '$') {
+        JsonNode* result = json_node_new(JSON_NODE_VALUE);
+        json_node_set_string(result, str + 1);
+        return result;
+
+      } else if (str[0] == '$') {
+        JsonNode* value = lookup_reference(str, results);
+        if (!value) {
+          *unresolved = str;
+          return NULL;
+        }
+        return json_node_copy(value);
+      }
+    }
+    return json_node_copy(node);
+
+  default:
+    return json_node_copy(node);
+  }
+}
+
+
+void RESTPDB::post_batch(JSON::INode json)
+{
+  JSON::INode   ctx_node   = json["context"];
+  JSON::INode   calls_node = json["calls"];
+  JsonArray*    results    = json_array_new();
+  GimpImage*    image      = NULL;
+  gint          failed     = -1;
+  gint          code       = 200;
+  GLib::CString error_text;
+
+  if (!calls_node.is_array()) {
+    json_array_unref(results);
+    make_error_response(400, "calls must be an array.");
+    return;
+  }
+
+  try {
+    if (ctx_node.has("image")) {
+      gint id = ctx_node["image"];
+      image = gimp_image_get_by_ID(gimp, id);
+    }
+  } catch(JSON::INode::InvalidType e) {
+  }
+  if (!image)
+    image = gimp_context_get_image(gimp_get_user_context(gimp));
+
+  // a call may delete the image before the group is closed
+  if (image) {
+    g_object_ref(image);
+    gimp_image_undo_group_start(image, GIMP_UNDO_GROUP_MISC, _("Remote Batch"));
+  }
+
+  for (gint i = 0; i < calls_node.length(); i ++) {
+    try {
+      JSON::INode    call      = calls_node[(guint) i];
+      const gchar*   proc_name = call.has("procedure") ? (const gchar*) call["procedure"] : NULL;
+      GimpProcedure* procedure = NULL;
+
+      if (proc_name)
+        procedure = GLib::ref(gimp->pdb) [gimp_pdb_lookup_procedure] (proc_name);
+
+      if (!procedure) {
+        error_text = g_strdup_printf("%s is not found.", proc_name ? proc_name : "procedure");
+        code       = 404;
+        failed     = i;
+        break;
+      }
+
+      const gchar* unresolved = NULL;
+      JSON::Node   call_ctx   = resolve_references(call.has("context") ? call["context"] : ctx_node,
+                                                   results, &unresolved);
+      JSON::Node   call_args  = unresolved ? NULL :
+                                resolve_references(call["arguments"], results, &unresolved);
+
+      if (unresolved) {
+        error_text = g_strdup_printf("%s can not be resolved.", unresolved);
+        code       = 400;
+        failed     = i;
+        break;
+      }
+
+      JsonPDBRunner runner(procedure, NULL);
+
+      auto arg_conf = runner.get_arg_configurator();
+      auto executor = runner.get_executor();
+
+      arg_conf->message  = message;
+      arg_conf->resource = this;
+
+      if (!runner.run(gimp, JSON::INode(call_ctx), JSON::INode(call_args))) {
+        error_text = g_strdup_printf("Arguments of %s are not valid.", proc_name);
+        code       = 400;
+        failed     = i;
+        break;
+      }
+
+      GimpPDBStatusType status = executor->get_status();
+
+      json_array_add_element(results, JSON::build_object([&](auto it) {
+        it["procedure"] = proc_name;
+        it["context"]   = arg_conf->get_context_json();
+        it["values"]    = executor->result_json;
+        executor->result_json = NULL;
+      }));
+
+      if (status != GIMP_PDB_SUCCESS) {
+        const gchar* nick = NULL;
+        gimp_enum_get_value(GIMP_TYPE_PDB_STATUS_TYPE, status, NULL, &nick, NULL, NULL);
+        error_text = g_strdup_printf("%s failed with %s.", proc_name, nick ? nick : "an error");
+        code       = 500;
+        failed     = i;
+        break;
+      }
+
+    } catch(JSON::INode::InvalidType e) {
+      error_text = g_strdup_printf("Call %d is not valid.", i);
+      code       = 400;
+      failed     = i;
+      break;
+    } catch(JSON::INode::InvalidIndex e) {
+      error_text = g_strdup_printf("Call %d is not valid.", i);
+      code       = 400;
+      failed     = i;
+      break;
+    }
+  }
+
+  if (image) {
+    gimp_image_undo_group_end(image);
+    gimp_image_flush(image);
+    g_object_unref(image);
+  }
+
+  JsonNode* results_node = json_node_new(JSON_NODE_ARRAY);
+  json_node_take_array(results_node, results);
+
+  JSON::INode new_root = JSON::build_object([&](auto it) {
+    it["results"] = results_node;
+    if (failed >= 0) {
+      it["error"] = (const gchar*) error_text;
+      it["index"] = failed;
+    }
+  });
+  make_json_response(code, new_root.ptr());
+}
+
+
 void RESTPDB::put()
 {
 
@@ -1043,6 +1433,11 @@ void RESTPDB::post()
   if (!json.is_object())
     return;
 
+  if (!matched->data()["name"]) {
+    post_batch(json);
+    return;
+  }
+
   try {
     auto ctx_node = json["context"];
     GLib::IObject<GimpImage> image;
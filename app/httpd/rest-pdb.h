@@ -24,6 +24,8 @@
 #include "httpd.h"
 
 class RESTPDB : public RESTResource {
+  void post_batch(JSON::INode json);
+
 public:
   RESTPDB(Gimp* gimp, RESTD::Router::Matched* matched, SoupMessage* msg, SoupClientContext* context) :
     RESTResource(gimp, matched, msg, context) { }
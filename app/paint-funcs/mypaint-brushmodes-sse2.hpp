@@ -0,0 +1,335 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MYPAINT_BRUSHMODES_SSE2_HPP__
+#define __MYPAINT_BRUSHMODES_SSE2_HPP__
+
+// SSE2 versions of the blend modes in mypaint-brushmodes.hpp for the
+// run length encoded dab masks of MypaintBrushFeature and RGBA
+// layers. Four pixels of a run are processed at once; the tail of a
+// run and every other layer type go through the scalar templates.
+//
+// The kernels evaluate the same float expressions in the same order
+// as the scalar code (REAL_CALC), so the results are bit-identical.
+
+#include <emmintrin.h>
+
+namespace BrushModesSSE2 {
+
+  inline bool is_usable(const BrushPixelIteratorForRunLength& iter) {
+    static const bool supported =
+      (gimp_cpu_accel_get_support () & GIMP_CPU_ACCEL_X86_SSE2) != 0;
+    return supported && iter.src_bytes == 4 && iter.dest_bytes == 4;
+  }
+
+  // mask[0..3] are part of the current run. The mask is terminated by
+  // zero at the end of each run, so this never reads past the run.
+  inline bool has_run_of_4(const Pixel::real* mask) {
+    return mask[0] != 0 && mask[1] != 0 && mask[2] != 0 && mask[3] != 0;
+  }
+
+  inline __m128 clamp01(__m128 v) {
+    return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  }
+
+  // 4 RGBA pixels -> one vector per channel, scaled to 0.0 .. 1.0
+  inline void load_rgba(const Pixel::data_t* src,
+                        __m128& r, __m128& g, __m128& b, __m128& a) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128  max  = _mm_set1_ps((float)Pixel::MAX_VALUE);
+    __m128i pixels = _mm_loadu_si128((const __m128i*)src);
+    __m128i lo     = _mm_unpacklo_epi8(pixels, zero);
+    __m128i hi     = _mm_unpackhi_epi8(pixels, zero);
+
+    r = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    g = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    b = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    a = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+
+    r = _mm_div_ps(r, max);
+    g = _mm_div_ps(g, max);
+    b = _mm_div_ps(b, max);
+    a = _mm_div_ps(a, max);
+  }
+
+  // Same as r2d(): MAX_VALUE * v + 0.5, clamped and truncated.
+  inline __m128i to_data(__m128 v) {
+    const __m128 max = _mm_set1_ps((float)Pixel::MAX_VALUE);
+    v = _mm_add_ps(_mm_mul_ps(max, v), _mm_set1_ps(0.5f));
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), max);
+    return _mm_cvttps_epi32(v);
+  }
+
+  inline void store_rgba(Pixel::data_t* dest,
+                         __m128i r, __m128i g, __m128i b, __m128i a) {
+    // interleave the channels back into pixels
+    __m128i rg_lo  = _mm_unpacklo_epi32(r, g);
+    __m128i rg_hi  = _mm_unpackhi_epi32(r, g);
+    __m128i ba_lo  = _mm_unpacklo_epi32(b, a);
+    __m128i ba_hi  = _mm_unpackhi_epi32(b, a);
+    __m128i p01    = _mm_packs_epi32(_mm_unpacklo_epi64(rg_lo, ba_lo),
+                                     _mm_unpackhi_epi64(rg_lo, ba_lo));
+    __m128i p23    = _mm_packs_epi32(_mm_unpacklo_epi64(rg_hi, ba_hi),
+                                     _mm_unpackhi_epi64(rg_hi, ba_hi));
+    _mm_storeu_si128((__m128i*)dest, _mm_packus_epi16(p01, p23));
+  }
+
+  inline __m128i select(__m128 cond, __m128i if_true, __m128i if_false) {
+    __m128i m = _mm_castps_si128(cond);
+    return _mm_or_si128(_mm_and_si128(m, if_true),
+                        _mm_andnot_si128(m, if_false));
+  }
+
+  inline bool
+  blend_normal(BrushPixelIteratorForRunLength& iter, Pixel::real opacity)
+  {
+    const __m128  one     = _mm_set1_ps(1.0f);
+    const __m128  opa     = _mm_set1_ps(opacity);
+    const __m128  color_r = _mm_set1_ps(iter.colors[0]);
+    const __m128  color_g = _mm_set1_ps(iter.colors[1]);
+    const __m128  color_b = _mm_set1_ps(iter.colors[2]);
+    // the scalar code assigns the float color to the byte as is
+    const __m128i fill_r  = _mm_set1_epi32((Pixel::data_t)iter.colors[0]);
+    const __m128i fill_g  = _mm_set1_epi32((Pixel::data_t)iter.colors[1]);
+    const __m128i fill_b  = _mm_set1_epi32((Pixel::data_t)iter.colors[2]);
+
+    while (1) {
+      for (; has_run_of_4(iter.mask);
+           iter.mask += 4, iter.src += 16, iter.dest += 16) {
+        __m128 r, g, b, base_a;
+        load_rgba(iter.src, r, g, b, base_a);
+
+        __m128 brush_a = clamp01(_mm_mul_ps(_mm_loadu_ps(iter.mask), opa));
+        __m128 inv_a   = _mm_sub_ps(one, brush_a);
+        __m128 alpha   = clamp01(_mm_add_ps(brush_a, _mm_mul_ps(inv_a, base_a)));
+        __m128 base    = _mm_mul_ps(inv_a, base_a);
+        __m128 empty   = _mm_cmpeq_ps(alpha, _mm_setzero_ps());
+
+        r = clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(brush_a, color_r),
+                                          _mm_mul_ps(base, r)), alpha));
+        g = clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(brush_a, color_g),
+                                          _mm_mul_ps(base, g)), alpha));
+        b = clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(brush_a, color_b),
+                                          _mm_mul_ps(base, b)), alpha));
+
+        store_rgba(iter.dest,
+                   select(empty, fill_r, to_data(r)),
+                   select(empty, fill_g, to_data(g)),
+                   select(empty, fill_b, to_data(b)),
+                   to_data(alpha));
+      }
+      for (; !iter.is_row_end(); iter.next_pixel()) {
+        pixel_t brush_a = pix( eval( pix(iter.get_brush_alpha()) * pix(opacity) ) );
+        pixel_t base_a  = pix(iter.src[3]);
+        result_t alpha  = eval( brush_a + (pix(1.0f) - brush_a) * base_a );
+        iter.dest[3] = r2d(alpha);
+        if (alpha) {
+          pixel_t dest_a = pix(alpha);
+          for (int c = 0; c < 3; c++)
+            iter.dest[c] = r2d(eval( (brush_a * pix(iter.get_brush_color()[c]) +
+                                      (pix(1.0f) - brush_a) * base_a * pix(iter.src[c]))
+                                     / dest_a ));
+        } else {
+          iter.dest[0] = iter.get_brush_color()[0];
+          iter.dest[1] = iter.get_brush_color()[1];
+          iter.dest[2] = iter.get_brush_color()[2];
+        }
+      }
+      if (iter.is_data_end()) break;
+      iter.next_row();
+    }
+    return true;
+  }
+
+  inline bool
+  blend_normal_and_eraser(BrushPixelIteratorForRunLength& iter,
+                          Pixel::real color_a, Pixel::real opacity)
+  {
+    const __m128  one     = _mm_set1_ps(1.0f);
+    const __m128  opa     = _mm_set1_ps(opacity);
+    const __m128  col_a   = _mm_set1_ps(color_a);
+    const __m128  color_r = _mm_set1_ps(iter.colors[0]);
+    const __m128  color_g = _mm_set1_ps(iter.colors[1]);
+    const __m128  color_b = _mm_set1_ps(iter.colors[2]);
+    const __m128i fill_r  = _mm_set1_epi32((Pixel::data_t)iter.colors[0]);
+    const __m128i fill_g  = _mm_set1_epi32((Pixel::data_t)iter.colors[1]);
+    const __m128i fill_b  = _mm_set1_epi32((Pixel::data_t)iter.colors[2]);
+
+    while (1) {
+      for (; has_run_of_4(iter.mask);
+           iter.mask += 4, iter.src += 16, iter.dest += 16) {
+        __m128 r, g, b, base_a;
+        load_rgba(iter.src, r, g, b, base_a);
+
+        __m128 brush_a = clamp01(_mm_mul_ps(_mm_loadu_ps(iter.mask), opa));
+        __m128 alpha   = clamp01(_mm_add_ps(_mm_mul_ps(brush_a, col_a),
+                                            _mm_mul_ps(_mm_sub_ps(one, brush_a),
+                                                       base_a)));
+        __m128 inv_a   = clamp01(_mm_sub_ps(one, brush_a));
+        __m128 base    = _mm_mul_ps(inv_a, base_a);
+        __m128 top     = _mm_mul_ps(brush_a, col_a);
+        __m128 empty   = _mm_cmpeq_ps(alpha, _mm_setzero_ps());
+
+        r = clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(base, r),
+                                          _mm_mul_ps(top, color_r)), alpha));
+        g = clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(base, g),
+                                          _mm_mul_ps(top, color_g)), alpha));
+        b = clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(base, b),
+                                          _mm_mul_ps(top, color_b)), alpha));
+
+        store_rgba(iter.dest,
+                   select(empty, fill_r, to_data(r)),
+                   select(empty, fill_g, to_data(g)),
+                   select(empty, fill_b, to_data(b)),
+                   to_data(alpha));
+      }
+      for (; !iter.is_row_end(); iter.next_pixel()) {
+        pixel_t brush_a = pix( eval( pix(iter.get_brush_alpha()) * pix(opacity) ) );
+        pixel_t base_a  = pix(iter.src[3]);
+        result_t alpha  = eval( brush_a * pix(color_a) + (pix(1.0f) - brush_a) * base_a );
+        iter.dest[3] = r2d(alpha);
+        if (alpha) {
+          pixel_t inv_brush_a = pix( eval(pix(1.0f) - brush_a));
+          pixel_t dest_a = pix(alpha);
+          for (int c = 0; c < 3; c++)
+            iter.dest[c] = r2d(eval( (inv_brush_a*base_a*pix(iter.src[c]) + brush_a*pix(color_a)*pix(iter.get_brush_color()[c])) / dest_a ));
+        } else {
+          iter.dest[0] = iter.get_brush_color()[0];
+          iter.dest[1] = iter.get_brush_color()[1];
+          iter.dest[2] = iter.get_brush_color()[2];
+        }
+      }
+      if (iter.is_data_end()) break;
+      iter.next_row();
+    }
+    return true;
+  }
+
+  inline bool
+  blend_lock_alpha(BrushPixelIteratorForRunLength& iter, Pixel::real opacity)
+  {
+    const __m128 one     = _mm_set1_ps(1.0f);
+    const __m128 opa     = _mm_set1_ps(opacity);
+    const __m128 color_r = _mm_set1_ps(iter.colors[0]);
+    const __m128 color_g = _mm_set1_ps(iter.colors[1]);
+    const __m128 color_b = _mm_set1_ps(iter.colors[2]);
+
+    while (1) {
+      for (; has_run_of_4(iter.mask);
+           iter.mask += 4, iter.src += 16, iter.dest += 16) {
+        __m128 r, g, b, alpha;
+        load_rgba(iter.src, r, g, b, alpha);
+
+        __m128 brush_a = clamp01(_mm_mul_ps(_mm_loadu_ps(iter.mask), opa));
+        __m128 inv_a   = clamp01(_mm_sub_ps(one, brush_a));
+        __m128 top     = _mm_mul_ps(brush_a, alpha);
+        __m128 base    = _mm_mul_ps(inv_a, alpha);
+        // The scalar code divides 0 by 0 on fully transparent pixels,
+        // which ends up as 0 on x86. Make that explicit here.
+        __m128 keep    = _mm_cmpneq_ps(alpha, _mm_setzero_ps());
+
+        r = _mm_and_ps(keep, clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(top, color_r),
+                                                           _mm_mul_ps(base, r)), alpha)));
+        g = _mm_and_ps(keep, clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(top, color_g),
+                                                           _mm_mul_ps(base, g)), alpha)));
+        b = _mm_and_ps(keep, clamp01(_mm_div_ps(_mm_add_ps(_mm_mul_ps(top, color_b),
+                                                           _mm_mul_ps(base, b)), alpha)));
+
+        // the alpha channel of dest is left as it is
+        __m128i a = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)iter.dest), 24);
+        store_rgba(iter.dest,
+                   _mm_and_si128(_mm_castps_si128(keep), to_data(r)),
+                   _mm_and_si128(_mm_castps_si128(keep), to_data(g)),
+                   _mm_and_si128(_mm_castps_si128(keep), to_data(b)),
+                   a);
+      }
+      for (; !iter.is_row_end(); iter.next_pixel()) {
+        pixel_t brush_a = pix( eval( pix(iter.get_brush_alpha()) * pix(opacity) ) );
+        pixel_t inv_brush_a = pix( eval( f2p(1.0) - brush_a) );
+        pixel_t alpha = pix( iter.src[3] );
+        pixel_t dest_a = pix( iter.src[3] );
+        pixel_t base_a = dest_a;
+        for (int c = 0; c < 3; c++)
+          iter.dest[c] = r2d(eval( (brush_a*alpha*pix(iter.get_brush_color()[c]) + inv_brush_a*base_a*pix(iter.src[c])) / dest_a));
+      }
+      if (iter.is_data_end()) break;
+      iter.next_row();
+    }
+    return true;
+  }
+
+  inline bool
+  get_color_accumulate(BrushPixelIteratorForRunLength& iter,
+                       float* sum_weight,
+                       float* sum_r, float* sum_g, float* sum_b, float* sum_a)
+  {
+    // The per-pixel products are computed four at a time, but they are
+    // summed up in pixel order to keep the float sums bit-identical.
+    float lanes[5][4] __attribute__((aligned(16)));
+    internal_t weight = 0;
+    internal_t r = 0;
+    internal_t g = 0;
+    internal_t b = 0;
+    internal_t a = 0;
+
+    while (1) {
+      for (; has_run_of_4(iter.mask); iter.mask += 4, iter.src += 16) {
+        __m128 src_r, src_g, src_b, alpha;
+        load_rgba(iter.src, src_r, src_g, src_b, alpha);
+
+        __m128 opa = clamp01(_mm_loadu_ps(iter.mask));
+        __m128 raw = _mm_loadu_ps(iter.mask);
+        _mm_store_ps(lanes[0], opa);
+        _mm_store_ps(lanes[1], clamp01(_mm_mul_ps(_mm_mul_ps(raw, src_r), alpha)));
+        _mm_store_ps(lanes[2], clamp01(_mm_mul_ps(_mm_mul_ps(raw, src_g), alpha)));
+        _mm_store_ps(lanes[3], clamp01(_mm_mul_ps(_mm_mul_ps(raw, src_b), alpha)));
+        _mm_store_ps(lanes[4], clamp01(_mm_mul_ps(raw, alpha)));
+
+        for (int i = 0; i < 4; i++) {
+          weight += lanes[0][i];
+          r      += lanes[1][i];
+          g      += lanes[2][i];
+          b      += lanes[3][i];
+          a      += lanes[4][i];
+        }
+      }
+      for (; !iter.is_row_end(); iter.next_pixel()) {
+        pixel_t opa = pix (iter.get_brush_alpha());
+        pixel_t alpha = pix(iter.src[3]);
+
+        weight += r2i(eval(opa));
+        r      += r2i(eval (opa * pix(iter.src[0]) * alpha));
+        g      += r2i(eval (opa * pix(iter.src[1]) * alpha));
+        b      += r2i(eval (opa * pix(iter.src[2]) * alpha));
+        a      += r2i(eval (opa * alpha));
+      }
+      if (iter.is_data_end()) break;
+      iter.next_row();
+    }
+
+    *sum_weight += weight;
+    *sum_r += r;
+    *sum_g += g;
+    *sum_b += b;
+    *sum_a += a;
+    return true;
+  }
+
+}; // namespace BrushModesSSE2
+
+#endif
@@ -555,6 +555,80 @@ void get_color_pixels_accumulate (/*Pixel::real  * mask,
   *sum_a += a;
 };
 
+// Accelerated blend modes for run length encoded dab masks.
+// Non-template overloads win over the templates above for
+// BrushPixelIteratorForRunLength; they fall back to the scalar
+// templates whenever the accelerated kernels cannot be used.
+
+#if defined(USE_SSE) && defined(ARCH_X86) && defined(__SSE2__)
+#define MYPAINT_BRUSHMODES_USE_SSE2 1
+#include "mypaint-brushmodes-sse2.hpp"
+#endif
+
+inline void
+draw_dab_pixels_BlendMode_Normal (BrushPixelIteratorForRunLength iter,
+                                  Pixel::real   opacity)
+{
+#ifdef MYPAINT_BRUSHMODES_USE_SSE2
+  if (BrushModesSSE2::is_usable(iter)) {
+    BrushModesSSE2::blend_normal(iter, opacity);
+    return;
+  }
+#endif
+  draw_dab_pixels_BlendMode_Normal<BrushPixelIteratorForRunLength>(iter, opacity);
+}
+
+inline void
+draw_dab_pixels_BlendMode_Normal_and_Eraser (BrushPixelIteratorForRunLength iter,
+                                             Pixel::real   color_a,
+                                             Pixel::real   opacity,
+                                             Pixel::real   background_r = 1.0f,
+                                             Pixel::real   background_g = 1.0f,
+                                             Pixel::real   background_b = 1.0f)
+{
+#ifdef MYPAINT_BRUSHMODES_USE_SSE2
+  // the background color is only used by the 1 and 3 bytes cases
+  if (BrushModesSSE2::is_usable(iter)) {
+    BrushModesSSE2::blend_normal_and_eraser(iter, color_a, opacity);
+    return;
+  }
+#endif
+  draw_dab_pixels_BlendMode_Normal_and_Eraser<BrushPixelIteratorForRunLength>
+    (iter, color_a, opacity, background_r, background_g, background_b);
+}
+
+inline void
+draw_dab_pixels_BlendMode_LockAlpha (BrushPixelIteratorForRunLength iter,
+                                     Pixel::real   opacity)
+{
+#ifdef MYPAINT_BRUSHMODES_USE_SSE2
+  if (BrushModesSSE2::is_usable(iter)) {
+    BrushModesSSE2::blend_lock_alpha(iter, opacity);
+    return;
+  }
+#endif
+  draw_dab_pixels_BlendMode_LockAlpha<BrushPixelIteratorForRunLength>(iter, opacity);
+}
+
+inline void
+get_color_pixels_accumulate (BrushPixelIteratorForRunLength iter,
+                             float * sum_weight,
+                             float * sum_r,
+                             float * sum_g,
+                             float * sum_b,
+                             float * sum_a)
+{
+#ifdef MYPAINT_BRUSHMODES_USE_SSE2
+  if (BrushModesSSE2::is_usable(iter)) {
+    BrushModesSSE2::get_color_accumulate(iter, sum_weight,
+                                         sum_r, sum_g, sum_b, sum_a);
+    return;
+  }
+#endif
+  get_color_pixels_accumulate<BrushPixelIteratorForRunLength>
+    (iter, sum_weight, sum_r, sum_g, sum_b, sum_a);
+}
+
 #if 0
 // Colorize: apply the source hue and saturation, retaining the target
 // brightness. Same thing as in the PDF spec addendum but with different Luma
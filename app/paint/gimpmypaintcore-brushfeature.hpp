@@ -68,49 +68,112 @@ extern "C" {
 
 const float ALPHA_THRESHOLD = (float)((1 << 16) - 1);
 
+#include "gimpmypaintcore-dabcache.hpp"
+
 ////////////////////////////////////////////////////////////////////////////////
 template<typename PixelIter>
 class GeneralBrushFeature {
 public:
+  // Sums up the color samples of get_color().
+  //
+  // With ENABLE_MP the pixel region chunks are processed by several
+  // threads. Each chunk pushes its partial sums onto a lock-free list;
+  // summarize() reduces them in row-major chunk order, i.e. the same
+  // order as the single-threaded processor, so the result does not
+  // depend on the number of threads.
   class ColorAccumulator {
 #ifdef ENABLE_MP
-    GMutex              mutex;
+    struct Partial {
+      Partial* next;
+      gint     x, y;
+      float    sum_weight, sum_r, sum_g, sum_b, sum_a;
+    };
+    gpointer partials;
+
+    static bool comes_before(const Partial* a, const Partial* b) {
+      return (a->y < b->y) || (a->y == b->y && a->x < b->x);
+    }
+
+    void reduce() {
+      Partial* list   = (Partial*)g_atomic_pointer_get(&partials);
+      Partial* sorted = NULL;
+
+      g_atomic_pointer_set(&partials, NULL);
+
+      // insertion sort, there are only a handful of chunks per dab
+      while (list) {
+        Partial*  p    = list;
+        Partial** link = &sorted;
+        list = list->next;
+        while (*link && comes_before(*link, p))
+          link = &(*link)->next;
+        p->next = *link;
+        *link   = p;
+      }
+
+      while (sorted) {
+        Partial* p = sorted;
+        sorted = sorted->next;
+        sum_weight += p->sum_weight;
+        sum_r += p->sum_r;
+        sum_g += p->sum_g;
+        sum_b += p->sum_b;
+        sum_a += p->sum_a;
+        g_slice_free(Partial, p);
+      }
+    }
 #endif
     float sum_weight, sum_r, sum_g, sum_b, sum_a;
 
   public:
-  ColorAccumulator() {
-    reset();
+    ColorAccumulator() {
 #ifdef ENABLE_MP
-    g_mutex_init(&mutex);
+      partials = NULL;
 #endif
+      reset();
     };
   
     ~ColorAccumulator() {
 #ifdef ENABLE_MP
-      g_mutex_clear(&mutex);
+      reset();
 #endif
     }
 
     void reset() {
+#ifdef ENABLE_MP
+      reduce();
+#endif
       sum_weight = sum_r = sum_g = sum_b = sum_a = 0.0;
     }
   
-    void accumulate(float w, float r, float g, float b, float a) {
+    // x, y: origin of the pixel region chunk the sums belong to.
+    void accumulate(gint x, gint y,
+                    float w, float r, float g, float b, float a) {
 #ifdef ENABLE_MP
-      g_mutex_lock (&mutex);
-#endif
+      Partial* p = g_slice_new(Partial);
+      p->x          = x;
+      p->y          = y;
+      p->sum_weight = w;
+      p->sum_r      = r;
+      p->sum_g      = g;
+      p->sum_b      = b;
+      p->sum_a      = a;
+      do {
+        p->next = (Partial*)g_atomic_pointer_get(&partials);
+      } while (!g_atomic_pointer_compare_and_exchange(&partials, p->next, p));
+#else
       sum_weight += w;
       sum_r += r;
       sum_g += g;
       sum_b += b;
       sum_a += a;
-#ifdef ENABLE_MP
-      g_mutex_unlock (&mutex);
 #endif
     }
 
     void summarize(float* r, float* g, float* b, float* a) {
+#ifdef ENABLE_MP
+      reduce();
+#endif
       if (sum_weight > 0.0) {
         sum_r /= sum_weight;
         sum_g /= sum_weight;
@@ -230,11 +293,18 @@ class MypaintBrushFeature :
 {
   float radius;
   float hardness, aspect_ratio, angle;
+  DabMaskCache*           cache;
+  DabMaskCache::Placement cached_mask;
 
 public:
   typedef BrushPixelIteratorForRunLength iterator;
   typedef GeneralBrushFeature<iterator> Parent;
 
+  MypaintBrushFeature(DabMaskCache* cache = NULL) : cache(cache)
+  {
+    cached_mask.mask = NULL;
+  }
+
   bool 
   prepare_brush(float x, float y, float radius, 
                 float hardness, float aspect_ratio, float angle, 
@@ -252,6 +322,10 @@ public:
     this->hardness     = hardness;
     this->aspect_ratio = aspect_ratio;
     this->angle        = angle;
+
+    cached_mask.mask = NULL;
+    if (cache)
+      cache->lookup(x, y, radius, hardness, aspect_ratio, angle, cached_mask);
     return true;
   }
   
@@ -260,9 +334,17 @@ public:
 
   void 
   get_boundary(int&x1, int& y1, int& x2, int& y2) 
+  {
+    get_dab_boundary(x, y, radius, x1, y1, x2, y2);
+  };
+
+  // The boundary of a dab, known without preparing the brush.
+  static void
+  get_dab_boundary(float x, float y, float radius,
+                   int& x1, int& y1, int& x2, int& y2)
   {
     float r_fringe = radius + 1;
-    
+
     x1  = floor(x - r_fringe);
     y1  = floor(y - r_fringe);
     x2  = floor(x + r_fringe);
@@ -321,10 +403,6 @@ public:
     float segment2_slope  = (hardness != 1.0) ? -hardness/(1.0-hardness): 0;
     // for hardness == 1.0, segment2 will never be used
 
-    float angle_rad=angle/360*2*M_PI;
-    float cs=cos(angle_rad);
-    float sn=sin(angle_rad);
-
     int x0 = floor (cx_in_tile_coords - r_fringe);
     int y0 = floor (cy_in_tile_coords - r_fringe);
     int x1 = ceil (cx_in_tile_coords + r_fringe);
@@ -352,6 +430,71 @@ public:
     }
     
     skip += y0*stride;
+
+    if (cached_mask.mask) {
+      // The dab shape is already rasterized; only the mask channel and
+      // the texture have to be applied per pixel.
+      const DabMaskCache::Mask* m = cached_mask.mask;
+      gint mask_x = cached_mask.x - srcPR->x;
+      gint mask_y = cached_mask.y - srcPR->y;
+
+      for (yp = y0; yp <= y1; yp++) {
+        gint row   = yp - mask_y;
+        gint first = x1 + 1;
+        gint last  = x1;
+
+        if (row >= 0 && row < m->height) {
+          first = MAX(x0, m->spans[row * 2] + mask_x);
+          last  = MIN(x1, m->spans[row * 2 + 1] + mask_x);
+        }
+
+        if (first > last) {
+          skip += stride;
+        } else {
+          const Pixel::real* opacity = m->opacity + row * m->width - mask_x;
+
+          skip += first;
+          for (xp = first; xp <= last; xp++) {
+            result_t opa_ = opacity[xp];
+            if (opa_ == 0.0) {
+              skip++;
+              continue;
+            }
+            if (channel_data)
+              opa_ = eval( pix(opa_) * pix(channel_data[xp]) );
+
+            if (texture_data) {
+              opa_ = eval( pix(opa_) * 
+                          (pix(texture_data[xp * texturePR->bytes]) + pix(texture_grain)) * pix(texture_contrast));
+            }
+
+            if (opa_ * ALPHA_THRESHOLD < 1.0) {
+              skip++;
+            } else {
+              if (skip) {
+                *dab_mask_p++ = 0;
+                *offsets++ = skip;
+                skip = 0;
+              }
+              *dab_mask_p++ = opa_;
+            }
+          }
+          skip += stride - xp;
+        }
+        if (channelPR)
+          channel_data += channelPR->rowstride;
+        if (texturePR)
+          texture_data += texturePR->rowstride;
+      }
+      *dab_mask_p++ = 0;
+      *offsets  = 0;
+      return;
+    }
+
+    float angle_rad=angle/360*2*M_PI;
+    float cs=cos(angle_rad);
+    float sn=sin(angle_rad);
+
     for (yp = y0; yp <= y1; yp++) {
       yy = (yp + 0.5 - cy_in_tile_coords);
       skip += x0;
@@ -472,7 +615,8 @@ public:
 
     get_color_pixels_accumulate (iter,
                                  &sum_weight, &sum_r, &sum_g, &sum_b, &sum_a);
-    accumulator.accumulate(sum_weight, sum_r, sum_g, sum_b, sum_a);
+    accumulator.accumulate(src1PR->x, src1PR->y,
+                           sum_weight, sum_r, sum_g, sum_b, sum_a);
   }
   
 };
@@ -659,7 +803,8 @@ public:
 
     get_color_pixels_accumulate (iter,
                                  &sum_weight, &sum_r, &sum_g, &sum_b, &sum_a);
-    accumulator.accumulate(sum_weight, sum_r, sum_g, sum_b, sum_a);
+    accumulator.accumulate(src1PR->x, src1PR->y,
+                           sum_weight, sum_r, sum_g, sum_b, sum_a);
   }
 };
 
@@ -0,0 +1,227 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GIMPMYPAINTCORE_DABCACHE_HPP__
+#define __GIMPMYPAINTCORE_DABCACHE_HPP__
+
+// Cache of rasterized MyPaint dab shapes.
+//
+// Consecutive dabs of a stroke mostly share radius, hardness, aspect
+// ratio and angle. Instead of evaluating the rotated ellipse and the
+// hardness curve for every pixel of every dab, the dab shape is
+// rasterized once for a quantized set of parameters (including the
+// sub-pixel position of the dab center) and reused while the key
+// stays the same.
+//
+// A mask is always rendered from its quantized key, so the result
+// of a dab does not depend on whether it was a cache hit or not.
+//
+// Lookups happen in prepare_brush(), i.e. before the dab is split
+// into pixel regions for the worker threads. The workers only read
+// the returned mask, so the cache itself needs no locking.
+
+const int   DAB_MASK_CACHE_SIZE         = 32;
+const float DAB_MASK_CACHE_MAX_RADIUS   = 64.0;
+const int   DAB_MASK_SUBPIXEL_STEPS     = 4;
+const int   DAB_MASK_RADIUS_STEPS       = 16;
+const int   DAB_MASK_HARDNESS_STEPS     = 256;
+const int   DAB_MASK_ASPECT_RATIO_STEPS = 64;
+const int   DAB_MASK_ANGLE_STEPS        = 2;   // per degree
+
+class DabMaskCache {
+public:
+  struct Key {
+    gint radius;
+    gint hardness;
+    gint aspect_ratio;
+    gint angle;
+    gint offset_x;
+    gint offset_y;
+
+    bool operator == (const Key& rhs) const {
+      return radius       == rhs.radius &&
+             hardness     == rhs.hardness &&
+             aspect_ratio == rhs.aspect_ratio &&
+             angle        == rhs.angle &&
+             offset_x     == rhs.offset_x &&
+             offset_y     == rhs.offset_y;
+    }
+  };
+
+  struct Mask {
+    Key          key;
+    gint         width, height;
+    gint         origin;   // offset of the top-left pixel from the dab center pixel
+    Pixel::real* opacity;  // width * height values, zero outside of the dab
+    gint*        spans;    // [first, last] non-zero column of each row
+    guint        stamp;
+  };
+
+  struct Placement {
+    const Mask* mask;
+    gint        x, y;      // top-left pixel of the mask in drawable coords
+  };
+
+private:
+  Mask  masks[DAB_MASK_CACHE_SIZE];
+  guint clock;
+
+  static gint quantize(float value, int steps) {
+    return (gint)floor(value * steps + 0.5);
+  }
+
+  static gint floor_div(gint value, gint divisor) {
+    return (value >= 0)? value / divisor : -((divisor - 1 - value) / divisor);
+  }
+
+  void render(Mask& m, const Key& key) {
+    float radius       = (float)key.radius / DAB_MASK_RADIUS_STEPS;
+    float hardness     = (float)key.hardness / DAB_MASK_HARDNESS_STEPS;
+    float aspect_ratio = (float)key.aspect_ratio / DAB_MASK_ASPECT_RATIO_STEPS;
+    float angle        = (float)key.angle / DAB_MASK_ANGLE_STEPS;
+    float fx           = (float)key.offset_x / DAB_MASK_SUBPIXEL_STEPS;
+    float fy           = (float)key.offset_y / DAB_MASK_SUBPIXEL_STEPS;
+
+    gint r_fringe = (gint)ceil(radius + 1);
+    gint size     = 2 * r_fringe + 2;
+
+    if (m.width * m.height < size * size) {
+      g_free(m.opacity);
+      m.opacity = g_new(Pixel::real, size * size);
+    }
+    if (m.height < size) {
+      g_free(m.spans);
+      m.spans = g_new(gint, size * 2);
+    }
+    m.key    = key;
+    m.width  = size;
+    m.height = size;
+    m.origin = -r_fringe;
+
+    // Same two-segment hardness curve as
+    // MypaintBrushFeature::fill_brushmark_buffer().
+    float one_over_radius2 = 1.0 / (radius * radius);
+    float segment1_offset  = 1.0;
+    float segment1_slope   = -(1.0/hardness - 1.0);
+    float segment2_offset  = (hardness != 1.0) ? hardness/(1.0-hardness): 0;
+    float segment2_slope   = (hardness != 1.0) ? -hardness/(1.0-hardness): 0;
+
+    float angle_rad = angle/360*2*M_PI;
+    float cs        = cos(angle_rad);
+    float sn        = sin(angle_rad);
+
+    Pixel::real* p = m.opacity;
+    for (int row = 0; row < size; row++) {
+      float yy    = (row + m.origin + 0.5 - fy);
+      gint  first = size;
+      gint  last  = -1;
+      for (int col = 0; col < size; col++, p++) {
+        float xx  = (col + m.origin + 0.5 - fx);
+        float yyr = (yy*cs-xx*sn)*aspect_ratio;
+        float xxr = yy*sn+xx*cs;
+        float rr  = (yyr*yyr + xxr*xxr) * one_over_radius2;
+        float opa = 0.0;
+
+        if (rr <= 1.0) {
+          if (rr <= hardness)
+            opa = segment1_offset + rr*segment1_slope;
+          else
+            opa = segment2_offset + rr*segment2_slope;
+        }
+
+        if (opa * ALPHA_THRESHOLD < 1.0) {
+          *p = 0.0;
+        } else {
+          *p = opa;
+          if (col < first) first = col;
+          last = col;
+        }
+      }
+      m.spans[row * 2]     = first;
+      m.spans[row * 2 + 1] = last;
+    }
+  }
+
+public:
+  DabMaskCache() : clock(0) {
+    for (int i = 0; i < DAB_MASK_CACHE_SIZE; i++) {
+      masks[i].width   = masks[i].height = 0;
+      masks[i].opacity = NULL;
+      masks[i].spans   = NULL;
+      masks[i].stamp   = 0;
+    }
+  }
+
+  ~DabMaskCache() {
+    for (int i = 0; i < DAB_MASK_CACHE_SIZE; i++) {
+      g_free(masks[i].opacity);
+      g_free(masks[i].spans);
+    }
+  }
+
+  // Returns false if the dab is too large to be cached. In that case
+  // the caller has to rasterize the dab by itself.
+  bool lookup(float x, float y, float radius,
+              float hardness, float aspect_ratio, float angle,
+              Placement& result)
+  {
+    if (radius > DAB_MASK_CACHE_MAX_RADIUS)
+      return false;
+
+    Key  key;
+    gint qx = quantize(x, DAB_MASK_SUBPIXEL_STEPS);
+    gint qy = quantize(y, DAB_MASK_SUBPIXEL_STEPS);
+    gint cx = floor_div(qx, DAB_MASK_SUBPIXEL_STEPS);
+    gint cy = floor_div(qy, DAB_MASK_SUBPIXEL_STEPS);
+
+    // rounded down, so that the mask stays within the boundary which
+    // get_boundary() computes from the exact radius
+    key.radius       = MAX(1, (gint)floor(radius * DAB_MASK_RADIUS_STEPS));
+    key.hardness     = CLAMP(quantize(hardness, DAB_MASK_HARDNESS_STEPS),
+                             1, DAB_MASK_HARDNESS_STEPS);
+    key.aspect_ratio = MAX(DAB_MASK_ASPECT_RATIO_STEPS,
+                           quantize(aspect_ratio, DAB_MASK_ASPECT_RATIO_STEPS));
+    // the angle of a round dab does not matter
+    key.angle        = (key.aspect_ratio == DAB_MASK_ASPECT_RATIO_STEPS)? 0:
+                       quantize(fmodf(angle, 360.0), DAB_MASK_ANGLE_STEPS);
+    key.offset_x     = qx - cx * DAB_MASK_SUBPIXEL_STEPS;
+    key.offset_y     = qy - cy * DAB_MASK_SUBPIXEL_STEPS;
+
+    Mask* victim = &masks[0];
+    clock++;
+    for (int i = 0; i < DAB_MASK_CACHE_SIZE; i++) {
+      Mask& m = masks[i];
+      if (m.stamp && m.key == key) {
+        victim = &m;
+        break;
+      }
+      if (m.stamp < victim->stamp)
+        victim = &m;
+    }
+
+    if (!victim->stamp || !(victim->key == key))
+      render(*victim, key);
+    victim->stamp = clock;
+
+    result.mask = victim;
+    result.x    = cx + victim->origin;
+    result.y    = cy + victim->origin;
+    return true;
+  }
+};
+
+#endif
@@ -3,23 +3,22 @@
 ////////////////////////////////////////////////////////////////////////////////
 class GeneralDrawableFeature {
 protected:
+  // The get_*_region() functions initialize the caller's storage and
+  // return it, or return NULL if there is no such buffer.
   PixelRegion*
-  get_tiles_region(TileManager* tiles,
+  get_tiles_region(PixelRegion* result, TileManager* tiles,
                    gint x, gint y, gint w, gint h, bool writable) {
-    PixelRegion* result = NULL; 
-    if (tiles) {
-      result = g_new(PixelRegion, 1);
-      pixel_region_init (result, tiles, x, y, w, h, writable? TRUE: FALSE);
-    }
+    if (!tiles)
+      return NULL;
+    pixel_region_init (result, tiles, x, y, w, h, writable? TRUE: FALSE);
     return result;
   }
   PixelRegion*
-  get_temp_buf_region(TempBuf* temp_buf, gint x, gint y, gint w, gint h) {
-    PixelRegion* result = NULL; 
-    if (temp_buf) {
-      result = g_new(PixelRegion, 1);
-      pixel_region_init_temp_buf(result, temp_buf, x, y, w, h); 
-    }
+  get_temp_buf_region(PixelRegion* result, TempBuf* temp_buf,
+                      gint x, gint y, gint w, gint h) {
+    if (!temp_buf)
+      return NULL;
+    pixel_region_init_temp_buf(result, temp_buf, x, y, w, h); 
     return result;
   }
 public:  
@@ -31,7 +30,8 @@ public:
   gint get_drawable_width() { return 0; }
   gint get_drawable_height() { return 0; }
   PixelRegion* 
-  get_drawable_region(gint x, gint y, gint w, gint h, bool writable) {
+  get_drawable_region(PixelRegion* pr,
+                      gint x, gint y, gint w, gint h, bool writable) {
     return NULL;
   };
 
@@ -39,17 +39,20 @@ public:
   gint get_mask_width() { return 0; }
   gint get_mask_height() { return 0; }  
   PixelRegion* 
-  get_mask_region(gint x, gint y, gint w, gint h, bool writable) {
+  get_mask_region(PixelRegion* pr,
+                  gint x, gint y, gint w, gint h, bool writable) {
     return NULL;
   };
 
   void start_undo_group() {};
-  void stop_undo_group() {};
+  // Returns true if the stroke was attached to an undo step.
+  bool stop_undo_group(Stroke* stroke) { return false; };
   void validate_undo_tiles(gint x, gint y, gint w, gint h) {};
   gint get_undo_width() { return 0; }
   gint get_undo_height() { return 0; }  
   PixelRegion* 
-  get_undo_region(gint x, gint y, gint w, gint h, bool writable) {
+  get_undo_region(PixelRegion* pr,
+                  gint x, gint y, gint w, gint h, bool writable) {
     return NULL;
   };
   
@@ -59,7 +62,8 @@ public:
   gint get_floating_stroke_height() { return 0; }  
   void validate_floating_stroke_tiles(gint x, gint y, gint w, gint h) {};
   PixelRegion* 
-  get_floating_stroke_region(gint x, gint y, gint w, gint h, bool writable) {
+  get_floating_stroke_region(PixelRegion* pr,
+                             gint x, gint y, gint w, gint h, bool writable) {
     return NULL;
   };
 };
@@ -67,36 +71,82 @@ public:
 ////////////////////////////////////////////////////////////////////////////////
 class GimpImageFeature : public GeneralDrawableFeature {
   GimpDrawable* drawable;
+  // Both tile managers have the size of the drawable and are reused
+  // for every stroke, their tile arrays are allocated only once.
   TileManager*  undo_tiles;
   TileManager*  floating_stroke_tiles;
   gint          x1, y1;           /*  undo extents in image coords        */
   gint          x2, y2;           /*  undo extents in image coords        */  
+  gint          fx1, fy1;         /*  validated floating stroke extents   */
+  gint          fx2, fy2;
   GimpItem    *drawable_item;
   GimpImage   *image;
   GimpChannel *mask;
   GimpItem    *mask_item;
 
+  // Returns a tile manager of the size of the drawable, reusing the
+  // one of the previous stroke if possible.
+  TileManager*
+  ensure_tiles (TileManager* tiles, gint bytes)
+  {
+    if (tiles &&
+        tile_manager_width(tiles)  == get_drawable_width() &&
+        tile_manager_height(tiles) == get_drawable_height() &&
+        tile_manager_bpp(tiles)    == bytes)
+      return tiles;
+
+    if (tiles)
+      tile_manager_unref (tiles);
+
+    return tile_manager_new (get_drawable_width(), get_drawable_height(),
+                             bytes);
+  }
+
+  // Hands the original tiles of the stroke over to an UndoTiles and
+  // leaves undo_tiles empty for the next stroke. A tile which the
+  // drawable still shares was validated but never written to, it is
+  // left out of the undo step.
+  UndoTiles*
+  take_undo_tiles ()
+  {
+    UndoTiles*   result = new UndoTiles(drawable, x1, y1, x2 - x1, y2 - y1);
+    TileManager* tiles  = gimp_drawable_get_tiles (drawable);
+    gint         i, j;
+
+    for (i = y1; i < y2; i += (TILE_HEIGHT - (i % TILE_HEIGHT))) {
+      for (j = x1; j < x2; j += (TILE_WIDTH - (j % TILE_WIDTH))) {
+        Tile *tile = tile_manager_get_tile (undo_tiles, j, i, FALSE, FALSE);
+
+        if (tile && tile_is_valid (tile) &&
+            tile != tile_manager_get_tile (tiles, j, i, FALSE, FALSE))
+          result->add(undo_tiles, j, i);
+      }
+    }
+    tile_manager_invalidate_area (undo_tiles, x1, y1, x2 - x1, y2 - y1);
+
+    return result;
+  }
+
   GimpUndo *
-  push_undo (GimpImage* image, const gchar* undo_desc)
+  push_undo (GimpImage* image, const gchar* undo_desc, Stroke* stroke,
+             UndoTiles* tiles)
   {
+    GimpUndo* undo;
+
     gimp_image_undo_group_start (image, GIMP_UNDO_GROUP_MYPAINT,
                                  undo_desc);
 
-    gimp_image_undo_push (image, GIMP_TYPE_MYPAINT_CORE_UNDO,
+    undo = gimp_image_undo_push (image, GIMP_TYPE_MYPAINT_CORE_UNDO,
                                  GIMP_UNDO_PAINT, NULL,
-                                 GimpDirtyMask(0),
+                                 GimpDirtyMask(GIMP_DIRTY_ITEM |
+                                               GIMP_DIRTY_DRAWABLE),
+                                 "stroke",     stroke,
+                                 "undo-tiles", tiles,
                                  NULL);
-    if (undo_tiles) {
-      gimp_image_undo_push_drawable (image, "Mypaint Brush",
-                                     drawable, undo_tiles,
-                                     TRUE, x1, y1, x2 - x1, y2 - y1);
-    }
-    gimp_image_undo_group_end (image);
 
-    tile_manager_unref (undo_tiles);
-    undo_tiles = NULL;
+    gimp_image_undo_group_end (image);
 
-    return NULL;
+    return undo;
   }
   
 public:
@@ -105,6 +155,8 @@ public:
   GimpImageFeature(GimpDrawable* d) : undo_tiles(0), floating_stroke_tiles(0),
     drawable(d), image(0), mask(0), mask_item(0), GeneralDrawableFeature() 
   {
+    x1 = y1 = fx1 = fy1 = 0;
+    x2 = y2 = fx2 = fy2 = -1;
     g_object_add_weak_pointer(G_OBJECT(d), (gpointer*)&drawable);
   };
 
@@ -153,9 +205,10 @@ public:
   }
   
   PixelRegion* 
-  get_drawable_region(gint x, gint y, gint w, gint h, bool writable) {
+  get_drawable_region(PixelRegion* pr,
+                      gint x, gint y, gint w, gint h, bool writable) {
     TileManager* tiles = gimp_drawable_get_tiles(drawable);
-    return get_tiles_region(tiles, x, y, w, h, writable);
+    return get_tiles_region(pr, tiles, x, y, w, h, writable);
   };
 
   bool has_mask_item() {
@@ -171,12 +224,13 @@ public:
   }
   
   PixelRegion* 
-  get_mask_region(gint x, gint y, gint w, gint h, bool writable) {
+  get_mask_region(PixelRegion* pr,
+                  gint x, gint y, gint w, gint h, bool writable) {
     TileManager *tiles = NULL;
     if (mask_item)
       tiles = gimp_drawable_get_tiles(GIMP_DRAWABLE(mask));
 
-    return get_tiles_region(tiles, x, y, w, h, writable);
+    return get_tiles_region(pr, tiles, x, y, w, h, writable);
   };
   
   void start_undo_group() {
@@ -186,12 +240,7 @@ public:
   //  g_return_if_fail (error == NULL || *error == NULL);
 
     /*  Allocate the undo structure  */
-    if (undo_tiles)
-      tile_manager_unref (undo_tiles);
-
-    undo_tiles = tile_manager_new (get_drawable_width(),
-                                   get_drawable_height(),
-                                   gimp_drawable_bytes (drawable));
+    undo_tiles = ensure_tiles (undo_tiles, gimp_drawable_bytes (drawable));
 
     /*  Get the initial undo extents  */
     x1 = get_drawable_width() + 1;
@@ -205,11 +254,12 @@ public:
     return;
   };
   
-  void stop_undo_group() {
+  bool stop_undo_group(Stroke* stroke) {
     GimpImage *image;
+    UndoTiles *tiles;
 
-    g_return_if_fail (GIMP_IS_DRAWABLE (drawable));
-    g_return_if_fail (gimp_item_is_attached (GIMP_ITEM (drawable)));
+    g_return_val_if_fail (GIMP_IS_DRAWABLE (drawable), false);
+    g_return_val_if_fail (gimp_item_is_attached (GIMP_ITEM (drawable)), false);
 
     image = gimp_item_get_image (GIMP_ITEM (drawable));
 
@@ -218,15 +268,21 @@ public:
      */
     if (x2 < x1 || y2 < y1) {
       gimp_viewable_preview_thaw (GIMP_VIEWABLE (drawable));
-      return;
+      return false;
     }
 
     g_print("Stroke::end_session::push_undo(%d,%d)-(%d,%d)\n",x1,y1,x2,y2);
-    push_undo (image, "Mypaint Brush");
+    tiles = take_undo_tiles ();
+
+    /*  the undo step owns the stroke and the tiles, unless undo is frozen  */
+    if (! push_undo (image, "Mypaint Brush", stroke, tiles)) {
+      delete tiles;
+      stroke = NULL;
+    }
 
     gimp_viewable_preview_thaw (GIMP_VIEWABLE (drawable));
 
-    return;
+    return stroke != NULL;
   };
   
   void validate_undo_tiles(gint x, gint y, gint w, gint h) {
@@ -268,30 +324,31 @@ public:
   }
   
   PixelRegion* 
-  get_undo_region(gint x, gint y, gint w, gint h, bool writable) {
-    return get_tiles_region(undo_tiles, x, y, w, h, writable);
+  get_undo_region(PixelRegion* pr,
+                  gint x, gint y, gint w, gint h, bool writable) {
+    return get_tiles_region(pr, undo_tiles, x, y, w, h, writable);
   };
 
   
   void start_floating_stroke() {
     g_return_if_fail(drawable);
 
-    if (floating_stroke_tiles) {
-      tile_manager_unref(floating_stroke_tiles);
-      floating_stroke_tiles = NULL;
-    }
+    /*  drawable_item is not set before the first dab  */
+    refresh();
 
     gint bytes = gimp_drawable_bytes_with_alpha (drawable);
-    floating_stroke_tiles = tile_manager_new(get_drawable_width(),
-                                             get_drawable_height(),
-                                             bytes);
+    floating_stroke_tiles = ensure_tiles (floating_stroke_tiles, bytes);
+    fx1 = fy1 = 0;
+    fx2 = fy2 = -1;
   };
   
   void stop_floating_stroke() {
-    if (floating_stroke_tiles) {
-      tile_manager_unref(floating_stroke_tiles);
-      floating_stroke_tiles = NULL;
-    }
+    /*  keep the tile manager, only drop the pixels of this stroke  */
+    if (floating_stroke_tiles && fx2 >= fx1 && fy2 >= fy1)
+      tile_manager_invalidate_area (floating_stroke_tiles,
+                                    fx1, fy1, fx2 - fx1, fy2 - fy1);
+    fx1 = fy1 = 0;
+    fx2 = fy2 = -1;
   };
   
   void validate_floating_stroke_tiles(gint x, gint y, gint w, gint h) {
@@ -299,6 +356,18 @@ public:
 
     g_return_if_fail (floating_stroke_tiles != NULL);
 
+    if (fx2 < fx1) {
+      fx1 = x;
+      fy1 = y;
+      fx2 = x + w;
+      fy2 = y + h;
+    } else {
+      fx1 = MIN(fx1, x);
+      fy1 = MIN(fy1, y);
+      fx2 = MAX(fx2, x + w);
+      fy2 = MAX(fy2, y + h);
+    }
+
     for (i = y; i < (y + h); i += (TILE_HEIGHT - (i % TILE_HEIGHT))) {
       for (j = x; j < (x + w); j += (TILE_WIDTH - (j % TILE_WIDTH))) {
         Tile *tile = tile_manager_get_tile (floating_stroke_tiles, j, i,
@@ -326,8 +395,9 @@ public:
   }
   
   PixelRegion* 
-  get_floating_stroke_region(gint x, gint y, gint w, gint h, bool writable) {
-    return get_tiles_region(floating_stroke_tiles, x, y, w, h, writable);
+  get_floating_stroke_region(PixelRegion* pr,
+                             gint x, gint y, gint w, gint h, bool writable) {
+    return get_tiles_region(pr, floating_stroke_tiles, x, y, w, h, writable);
   };
 };
 
@@ -365,8 +435,9 @@ public:
   }
   
   PixelRegion* 
-  get_drawable_region(gint x, gint y, gint w, gint h, bool writable) {
-    return get_temp_buf_region(drawable, x, y, w, h);
+  get_drawable_region(PixelRegion* pr,
+                      gint x, gint y, gint w, gint h, bool writable) {
+    return get_temp_buf_region(pr, drawable, x, y, w, h);
   };
   
   void start_undo_group() {
@@ -377,9 +448,10 @@ public:
     temp_buf_copy(drawable, undo);
   };
   
-  void stop_undo_group() {
+  bool stop_undo_group(Stroke* stroke) {
     temp_buf_free(undo);
     undo = NULL;
+    return false;
   };
   
   void validate_undo_tiles(gint x, gint y, gint w, gint h) { };
@@ -393,8 +465,9 @@ public:
   }
   
   PixelRegion* 
-  get_undo_region(gint x, gint y, gint w, gint h, bool writable) {
-    return get_temp_buf_region(undo, x, y, w, h);
+  get_undo_region(PixelRegion* pr,
+                  gint x, gint y, gint w, gint h, bool writable) {
+    return get_temp_buf_region(pr, undo, x, y, w, h);
   };
 
   
@@ -421,8 +494,9 @@ public:
   }
   
   PixelRegion* 
-  get_floating_stroke_region(gint x, gint y, gint w, gint h, bool writable) {
-    return get_temp_buf_region(floating, x, y, w, h);
+  get_floating_stroke_region(PixelRegion* pr,
+                             gint x, gint y, gint w, gint h, bool writable) {
+    return get_temp_buf_region(pr, floating, x, y, w, h);
   };
 };
 
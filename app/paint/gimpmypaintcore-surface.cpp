@@ -63,6 +63,7 @@ extern "C" {
 #include "base/delegators.hpp"
 #include "base/glib-cxx-utils.hpp"
 #include "paint/gimpmypaintcore-brushfeature.hpp"
+#include "paint/gimpmypaintcore-undotiles.hpp"
 #include "paint/gimpmypaintcore-drawablefeature.hpp"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -109,6 +110,69 @@ public:
     get_color;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Renders a batch of prepared dabs tile by tile.
+//
+// The pixel processor splits the touched tiles of the dab boundaries
+// into tile sized portions, and each worker applies every dab touching its
+// portion in stroke order. A pixel sees the same blend operations in
+// the same order as with one pixel_regions_process_parallel() call
+// per dab, but the threads are handed whole tiles instead of a few
+// pixels of a small dab.
+template<typename BrushFeature>
+class DabScheduler {
+  struct Entry {
+    BrushFeature brush;          // prepared for this dab
+    gint         x1, y1, x2, y2; // boundary, x2 and y2 exclusive
+  };
+  std::vector<Entry> entries;
+
+  void process_tile(PixelRegion* src1PR, PixelRegion* destPR,
+                    PixelRegion* brushPR, PixelRegion* maskPR,
+                    PixelRegion* texturePR)
+  {
+    for (typename std::vector<Entry>::iterator i = entries.begin();
+         i != entries.end(); i++) {
+      if (i->x2 <= src1PR->x || i->x1 >= src1PR->x + src1PR->w ||
+          i->y2 <= src1PR->y || i->y1 >= src1PR->y + src1PR->h)
+        continue;
+      i->brush.draw_dab(src1PR, destPR, brushPR, maskPR, texturePR);
+    }
+  }
+
+  static void process_tile_func(DabScheduler* scheduler,
+                                PixelRegion* src1PR, PixelRegion* destPR,
+                                PixelRegion* brushPR, PixelRegion* maskPR,
+                                PixelRegion* texturePR)
+  {
+    scheduler->process_tile(src1PR, destPR, brushPR, maskPR, texturePR);
+  }
+
+public:
+  void push(const BrushFeature& brush, gint x, gint y, gint w, gint h) {
+    Entry entry = { brush, x, y, x + w, y + h };
+    entries.push_back(entry);
+  }
+
+  gint size() { return entries.size(); }
+
+  // Applies the pushed dabs to the regions, which may cover a part of
+  // their boundaries. The dabs stay queued for other regions until
+  // clear() is called.
+  void render(PixelRegion* src1PR, PixelRegion* destPR,
+              PixelRegion* brushPR, PixelRegion* maskPR,
+              PixelRegion* texturePR)
+  {
+    if (entries.empty())
+      return;
+    pixel_regions_process_parallel_tiles((PixelProcessorFunc)process_tile_func,
+                                         this, 1, 5, src1PR, destPR,
+                                         brushPR, maskPR, texturePR);
+  }
+
+  void clear() { entries.clear(); }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 template<class DrawableFeature>
 class GimpMypaintSurfaceImpl : public GimpMypaintSurface
@@ -122,6 +186,9 @@ private:
   GimpCoords    current_coords;
   bool          floating_stroke;
   float         stroke_opacity;
+  Stroke*       stroke;
+  DabMaskCache  dab_mask_cache;
+  DabScheduler<MypaintBrushFeature> dab_scheduler;
   
   gint          session;          /*  reference counter of atomic scope   */
 
@@ -160,12 +227,18 @@ private:
                        BrushFeature* brush_impl,
                        TempBuf* dab_mask) 
   {
-    /*  get the layer offsets  */
-    drawable_feature.get_drawable_offset(b.offset_x, b.offset_y);
-
     brush_impl->get_boundary(b.original_x1, b.original_y1, 
                              b.original_x2, b.original_y2);
 
+    return clip_boundary(b, dab_mask);
+  };
+
+  // Clips the original boundary of a dab to the drawable and its mask.
+  bool clip_boundary(Boundary& b, TempBuf* dab_mask)
+  {
+    /*  get the layer offsets  */
+    drawable_feature.get_drawable_offset(b.offset_x, b.offset_y);
+
     b.rx1 = b.original_x1;
     b.ry1 = b.original_y1;
     b.rx2 = b.original_x2;
@@ -205,7 +278,13 @@ private:
     return true;
   };
 
-  void configure_pixel_regions(PixelRegion** src1PR, 
+  // storage for the pixel regions of one dab
+  struct DabRegions {
+    PixelRegion src1, dest, brush, mask, texture;
+  };
+
+  void configure_pixel_regions(DabRegions&   regions,
+                               PixelRegion** src1PR, 
                                PixelRegion** destPR, 
                                PixelRegion** brushPR, 
                                PixelRegion** maskPR, 
@@ -218,23 +297,27 @@ private:
     if (src1PR) {
       if (src_use_floating)
         *src1PR = drawable_feature.
-          get_floating_stroke_region(b.rx1, b.ry1, b.width, b.height, false);
+          get_floating_stroke_region(&regions.src1,
+                                     b.rx1, b.ry1, b.width, b.height, false);
       else
         *src1PR = drawable_feature.
-          get_drawable_region(b.rx1, b.ry1, b.width, b.height, false);
+          get_drawable_region(&regions.src1,
+                              b.rx1, b.ry1, b.width, b.height, false);
     }
     
     if (destPR) {
       if (dest_use_floating)
         *destPR = drawable_feature.
-          get_floating_stroke_region(b.rx1, b.ry1, b.width, b.height, true);
+          get_floating_stroke_region(&regions.dest,
+                                     b.rx1, b.ry1, b.width, b.height, true);
       else
         *destPR = drawable_feature.
-          get_drawable_region(b.rx1, b.ry1, b.width, b.height, true);
+          get_drawable_region(&regions.dest,
+                              b.rx1, b.ry1, b.width, b.height, true);
     }
     
     if (brushPR && dab_mask) {
-      *brushPR = g_new(PixelRegion, 1);
+      *brushPR = &regions.brush;
       pixel_region_init_temp_buf(*brushPR, dab_mask, 
                                  MAX(b.rx1 - b.original_x1, 0), 
                                  MAX(b.ry1 - b.original_y1, 0), 
@@ -243,11 +326,12 @@ private:
 
     if (maskPR)
       *maskPR = drawable_feature.
-        get_mask_region(b.rx1 + b.offset_x, b.ry1 + b.offset_y,
+        get_mask_region(&regions.mask,
+                        b.rx1 + b.offset_x, b.ry1 + b.offset_y,
                         b.width, b.height, false);
 
     if (texturePR && texture) {
-      *texturePR = g_new(PixelRegion, 1);
+      *texturePR = &regions.texture;
       TempBuf* pattern = NULL;
       pattern = gimp_pattern_get_mask (texture);
       pixel_region_init_temp_buf(*texturePR, pattern,
@@ -258,29 +342,45 @@ private:
     }
   };
 
+  // Returns false if the dab would not modify the drawable.
+  static bool is_painting_dab (const Dab& dab)
+  {
+    if (dab.radius < 0.1)    return false; // don't bother with dabs smaller than 0.1 pixel
+    if (dab.hardness <= 0.0) return false; // infintly small center point, fully transparent outside
+    if (dab.opaque <= 0.0)   return false;
+    return true;
+  }
+
+  // Computes the boundary which prepare_dab() would compute, without
+  // preparing the brush. Returns false if the dab would not modify the
+  // drawable.
   template<class BrushFeature>
-  bool draw_dab_impl (BrushFeature& brush_impl,
-                      float x, float y, float radius, 
-                      float color_r, float color_g, float color_b,
-                      float opaque, float hardness,
-                      float color_a,
-                      float aspect_ratio, float angle,
-                      float lock_alpha,float colorize,
-                      float texture_grain = 0.0, float texture_contrast = 1.0)
+  bool get_dab_boundary (const Dab& dab, Boundary& b)
   {
-    PixelRegion     *src1PR, *destPR, *brushPR, *maskPR, *texturePR;
-    src1PR = destPR = brushPR = maskPR = texturePR = NULL;
+    if (!is_painting_dab(dab))
+      return false;
 
-    drawable_feature.refresh();
-    
-    opaque     = CLAMP(opaque, 0.0, 1.0);
-    hardness   = CLAMP(hardness, 0.0, 1.0);
-    lock_alpha = CLAMP(lock_alpha, 0.0, 1.0);
-    colorize   = CLAMP(colorize, 0.0, 1.0);
+    BrushFeature::get_dab_boundary(dab.x, dab.y, dab.radius,
+                                   b.original_x1, b.original_y1,
+                                   b.original_x2, b.original_y2);
 
-    if (radius < 0.1)    return false; // don't bother with dabs smaller than 0.1 pixel
-    if (hardness == 0.0) return false; // infintly small center point, fully transparent outside
-    if (opaque == 0.0)   return false;
+    return clip_boundary(b, NULL);
+  }
+
+  // Normalizes the dab parameters and prepares the brush for them.
+  // Returns false if the dab would not modify the drawable.
+  template<class BrushFeature>
+  bool prepare_dab (BrushFeature& brush_impl, const Dab& dab,
+                    Boundary& b, TempBuf*& dab_mask)
+  {
+    float opaque       = CLAMP(dab.opaque, 0.0, 1.0);
+    float hardness     = CLAMP(dab.hardness, 0.0, 1.0);
+    float lock_alpha   = CLAMP(dab.lock_alpha, 0.0, 1.0);
+    float colorize     = CLAMP(dab.colorize, 0.0, 1.0);
+    float aspect_ratio = dab.aspect_ratio;
+
+    if (!is_painting_dab(dab))
+      return false;
 
     if (aspect_ratio<1.0) aspect_ratio=1.0;
 
@@ -290,66 +390,233 @@ private:
     normal *= 1.0-lock_alpha;
     normal *= 1.0-colorize;
 
-    Pixel::real fg_color[4] = {color_r, color_g, color_b, color_a };
+    Pixel::real fg_color[4] = {dab.color_r, dab.color_g, dab.color_b,
+                               dab.alpha_eraser };
     Pixel::real bg_color[3] = {Pixel::real(this->bg_color.r),
                                Pixel::real(this->bg_color.g), 
                                Pixel::real(this->bg_color.b) };
 
-    if (!brush_impl.prepare_brush(x, y, radius, 
-                                  hardness, aspect_ratio, angle, 
+    if (!brush_impl.prepare_brush(dab.x, dab.y, dab.radius, 
+                                  hardness, aspect_ratio, dab.angle, 
                                   normal, opaque, lock_alpha,
-                                  fg_color, color_a, bg_color, stroke_opacity,
-                                  texture_grain, texture_contrast,
+                                  fg_color, dab.alpha_eraser, bg_color,
+                                  stroke_opacity,
+                                  dab.texture_grain, dab.texture_contrast,
                                   (void*)brushmark))
       return false;
-    TempBuf* dab_mask = (TempBuf*)brush_impl.get_brush_data();
+    dab_mask = (TempBuf*)brush_impl.get_brush_data();
 
-    Boundary b;
-    if (!adjust_boundary(b, &brush_impl, dab_mask))
-      return false;
+    return adjust_boundary(b, &brush_impl, dab_mask);
+  }
 
-    /*  set undo blocks  */
-    start_undo_group();
-    validate_undo_tiles(b.rx1, b.ry1, b.width, b.height);
+  // Renders a prepared dab. The undo tiles (and the floating stroke
+  // tiles) of the boundary must already be validated.
+  template<class BrushFeature>
+  void render_dab (BrushFeature& brush_impl, const Boundary& b,
+                   TempBuf* dab_mask)
+  {
+    DabRegions   regions;
+    PixelRegion *src1PR, *destPR, *brushPR, *maskPR, *texturePR;
+    src1PR = destPR = brushPR = maskPR = texturePR = NULL;
 
-    if (floating_stroke)
-      validate_floating_stroke_tiles(b.rx1, b.ry1, b.width, b.height);
-    configure_pixel_regions(&src1PR, &destPR, &brushPR, &maskPR, &texturePR,
+    configure_pixel_regions(regions,
+                            &src1PR, &destPR, &brushPR, &maskPR, &texturePR,
                             b, floating_stroke, floating_stroke,
                             dab_mask);
     
     Processors<BrushFeature>::draw_dab(&brush_impl,
                                        src1PR, destPR, 
                                        brushPR, maskPR, texturePR);
+  }
+
+  /* Copy floating stroke buffer into drawable buffer */
+  template<class BrushFeature>
+  void composite_floating_stroke (BrushFeature& brush_impl,
+                                  gint x, gint y, gint w, gint h)
+  {
+    DabRegions   regions;
+    PixelRegion *src1PR, *destPR, *brushPR;
+
+    src1PR  = drawable_feature.
+      get_undo_region(&regions.src1, x, y, w, h, false);
+    destPR  = drawable_feature.
+      get_drawable_region(&regions.dest, x, y, w, h, true);
+    brushPR = drawable_feature.
+      get_floating_stroke_region(&regions.brush, x, y, w, h, false);
+
+    Processors<BrushFeature>::copy_stroke(&brush_impl,
+                                          src1PR, destPR, brushPR,
+                                          (PixelRegion*)NULL, (PixelRegion*)NULL);
+  }
 
-    if (floating_stroke) {
-      /* Copy floating stroke buffer into drawable buffer */
-      if (src1PR) g_free(src1PR);
-      src1PR = drawable_feature.
-        get_undo_region(b.rx1, b.ry1, b.width, b.height, false);
+  template<class BrushFeature>
+  bool draw_dab_impl (BrushFeature& brush_impl, const Dab& dab)
+  {
+    drawable_feature.refresh();
+    
+    Boundary b;
+    TempBuf* dab_mask = NULL;
+    if (!prepare_dab(brush_impl, dab, b, dab_mask))
+      return false;
 
-      if (destPR) g_free(destPR);
-      destPR = drawable_feature.
-        get_drawable_region(b.rx1, b.ry1, b.width, b.height, true);
+    /*  set undo blocks  */
+    start_undo_group();
+    validate_undo_tiles(b.rx1, b.ry1, b.width, b.height);
+
+    if (floating_stroke)
+      validate_floating_stroke_tiles(b.rx1, b.ry1, b.width, b.height);
 
-      if (brushPR) g_free(brushPR);
-      brushPR = drawable_feature.
-        get_floating_stroke_region(b.rx1, b.ry1, b.width, b.height, false);
+    render_dab(brush_impl, b, dab_mask);
 
-      Processors<BrushFeature>::copy_stroke(&brush_impl,
-                                            src1PR, destPR, brushPR,
-                                            (PixelRegion*)NULL, (PixelRegion*)NULL);
-    }
+    if (floating_stroke)
+      composite_floating_stroke(brush_impl, b.rx1, b.ry1, b.width, b.height);
 
     drawable_feature.update_drawable(b.rx1, b.ry1, b.width, b.height);
-    if (src1PR) g_free(src1PR);
-    if (destPR) g_free(destPR);
-    if (brushPR) g_free(brushPR);
-    if (maskPR) g_free(maskPR);
-    if (texturePR) g_free(texturePR);
 
     return true;
   }
+
+  // Renders the dabs queued in the scheduler onto the given runs of
+  // tiles.
+  template<class BrushFeature>
+  void render_scheduled_dabs (DabScheduler<BrushFeature>& scheduler,
+                              const std::vector<Boundary>& runs)
+  {
+    for (typename std::vector<Boundary>::const_iterator i = runs.begin();
+         i != runs.end(); i++) {
+      DabRegions   regions;
+      PixelRegion *src1PR, *destPR, *maskPR, *texturePR;
+      src1PR = destPR = maskPR = texturePR = NULL;
+
+      configure_pixel_regions(regions,
+                              &src1PR, &destPR, NULL, &maskPR, &texturePR,
+                              *i, floating_stroke, floating_stroke,
+                              NULL);
+
+      scheduler.render(src1PR, destPR, NULL, maskPR, texturePR);
+    }
+    scheduler.clear();
+  }
+
+  // Splits area into runs of horizontally adjacent tiles which are
+  // touched by at least one of the dab boundaries. The tiles of area
+  // between distant dabs are left out, so they are neither written to
+  // nor pushed to undo.
+  void get_touched_runs (const std::vector<Boundary>& boundaries,
+                         const Boundary&              area,
+                         std::vector<Boundary>&       runs)
+  {
+    gint col1 = area.rx1 / TILE_WIDTH;
+    gint row1 = area.ry1 / TILE_HEIGHT;
+    gint cols = area.rx2 / TILE_WIDTH  - col1 + 1;
+    gint rows = area.ry2 / TILE_HEIGHT - row1 + 1;
+
+    std::vector<bool> touched(cols * rows, false);
+
+    for (typename std::vector<Boundary>::const_iterator i = boundaries.begin();
+         i != boundaries.end(); i++) {
+      for (gint row = i->ry1 / TILE_HEIGHT; row <= i->ry2 / TILE_HEIGHT; row++)
+        for (gint col = i->rx1 / TILE_WIDTH; col <= i->rx2 / TILE_WIDTH; col++)
+          touched[(row - row1) * cols + (col - col1)] = true;
+    }
+
+    for (gint row = 0; row < rows; row++) {
+      gint col = 0;
+
+      while (col < cols) {
+        if (!touched[row * cols + col]) {
+          col++;
+          continue;
+        }
+
+        gint first = col;
+        while (col < cols && touched[row * cols + col])
+          col++;
+
+        Boundary run = area;
+        run.rx1    = MAX(area.rx1, (col1 + first) * TILE_WIDTH);
+        run.rx2    = MIN(area.rx2, (col1 + col) * TILE_WIDTH - 1);
+        run.ry1    = MAX(area.ry1, (row1 + row) * TILE_HEIGHT);
+        run.ry2    = MIN(area.ry2, (row1 + row + 1) * TILE_HEIGHT - 1);
+        run.width  = run.rx2 - run.rx1 + 1;
+        run.height = run.ry2 - run.ry1 + 1;
+        runs.push_back(run);
+      }
+    }
+  }
+
+  // Draws all dabs of a motion event. The boundaries of the dabs are
+  // computed first, so that only the tiles they touch are validated
+  // for undo, written to and updated, once per batch. Then the dabs are
+  // prepared and handed to the tile scheduler.
+  template<class BrushFeature>
+  int draw_dabs_impl (BrushFeature& brush_impl, const DabBatch& dabs,
+                      DabScheduler<BrushFeature>& scheduler)
+  {
+    drawable_feature.refresh();
+
+    std::vector<Boundary> boundaries;
+    Boundary              area;
+
+    for (DabBatch::const_iterator i = dabs.begin(); i != dabs.end(); i++) {
+      Boundary b;
+      if (!get_dab_boundary<BrushFeature>(*i, b))
+        continue;
+      if (boundaries.empty()) {
+        area = b;
+      } else {
+        area.rx1 = MIN(area.rx1, b.rx1);
+        area.ry1 = MIN(area.ry1, b.ry1);
+        area.rx2 = MAX(area.rx2, b.rx2);
+        area.ry2 = MAX(area.ry2, b.ry2);
+      }
+      boundaries.push_back(b);
+    }
+
+    if (boundaries.empty())
+      return 0;
+
+    std::vector<Boundary> runs;
+    get_touched_runs(boundaries, area, runs);
+
+    /*  set undo blocks  */
+    start_undo_group();
+    for (typename std::vector<Boundary>::iterator r = runs.begin(); r != runs.end(); r++) {
+      validate_undo_tiles(r->rx1, r->ry1, r->width, r->height);
+
+      if (floating_stroke)
+        validate_floating_stroke_tiles(r->rx1, r->ry1, r->width, r->height);
+    }
+
+    int painted = 0;
+    for (DabBatch::const_iterator i = dabs.begin(); i != dabs.end(); i++) {
+      Boundary b;
+      TempBuf* dab_mask = NULL;
+      if (!prepare_dab(brush_impl, *i, b, dab_mask))
+        continue;
+      scheduler.push(brush_impl, b.rx1, b.ry1, b.width, b.height);
+      painted++;
+
+      // A scheduled dab may refer to a cached mask. No more than
+      // DAB_MASK_CACHE_SIZE lookups may happen before it is rendered,
+      // otherwise the mask could be evicted.
+      if (scheduler.size() == DAB_MASK_CACHE_SIZE)
+        render_scheduled_dabs(scheduler, runs);
+    }
+    render_scheduled_dabs(scheduler, runs);
+
+    for (typename std::vector<Boundary>::iterator r = runs.begin(); r != runs.end(); r++) {
+      // The composite only depends on the undo and the floating stroke
+      // tiles, so it can be done once for the whole batch.
+      if (floating_stroke)
+        composite_floating_stroke(brush_impl, r->rx1, r->ry1,
+                                  r->width, r->height);
+
+      drawable_feature.update_drawable(r->rx1, r->ry1, r->width, r->height);
+    }
+
+    return painted;
+  }
   
   template<typename BrushFeature>
   void get_color_impl (BrushFeature& brush_impl,
@@ -369,7 +636,8 @@ private:
     if (aspect_ratio<1.0) aspect_ratio=1.0;
 
     drawable_feature.refresh();
-    PixelRegion     *src1PR, *brushPR, *maskPR, *texturePR;
+    DabRegions   regions;
+    PixelRegion *src1PR, *brushPR, *maskPR, *texturePR;
     src1PR = brushPR = maskPR = texturePR = NULL;
     
     /*  get the layer offsets  */
@@ -389,28 +657,28 @@ private:
     if (!adjust_boundary(b, &brush_impl, dab_mask))
       return;
 
-    configure_pixel_regions(&src1PR, NULL, &brushPR, &maskPR, &texturePR,
+    configure_pixel_regions(regions,
+                            &src1PR, NULL, &brushPR, &maskPR, &texturePR,
                             b, false, false, dab_mask);
     
     // first, we calculate the mask (opacity for each pixel)
     Processors<BrushFeature>::get_color(&brush_impl,
                                      src1PR, brushPR, maskPR, texturePR); 
     brush_impl.get_accumulator()->summarize(color_r, color_g, color_b, color_a);
-
-    if (src1PR) g_free(src1PR);
-    if (brushPR) g_free(brushPR);
-    if (maskPR) g_free(maskPR);
-    if (texturePR) g_free(texturePR);
   }
 public:
   GimpMypaintSurfaceImpl(typename DrawableFeature::Drawable d) 
     : session(0), drawable_feature(d), brushmark(NULL), 
-      floating_stroke(false), stroke_opacity(1.0), texture(NULL)
+      floating_stroke(false), stroke_opacity(1.0), texture(NULL),
+      stroke(NULL)
   {
   }
 
   virtual ~GimpMypaintSurfaceImpl()
   {
+    if (stroke)
+      delete stroke;
+
     if (brushmark)
       g_object_unref(G_OBJECT(brushmark));
 
@@ -477,6 +745,12 @@ public:
     stroke_opacity = (float)CLAMP(value, 0.0, 1.0);
   }
 
+  void set_stroke(Stroke* stroke_) {
+    if (stroke)
+      delete stroke;
+    stroke = stroke_;
+  }
+
   virtual void set_coords(const GimpCoords* coords) { current_coords = *coords; }
   virtual bool draw_dab (float x, float y, float radius, 
                          float color_r, float color_g, float color_b,
@@ -487,6 +761,8 @@ public:
                          float texture_grain = 0.0, float texture_contrast = 1.0
                          );
 
+  virtual int draw_dabs (const DabBatch& dabs);
+
   virtual void get_color (float x, float y, float radius, 
                           float * color_r, float * color_g, float * color_b, float * color_a,
                           float hardness, float aspect_ratio, float angle, 
@@ -508,18 +784,33 @@ draw_dab (float x, float y, float radius,
           float lock_alpha, float colorize,
           float texture_grain, float texture_contrast)
 {
+  Dab dab = { x, y, radius, color_r, color_g, color_b, opaque,
+              hardness, color_a, aspect_ratio, angle, lock_alpha,
+              colorize, texture_grain, texture_contrast };
+
   if (brushmark) {
     GimpBrushFeature brush_impl(&current_coords, &last_coords);
-    return draw_dab_impl(brush_impl,
-                          x, y, radius, color_r, color_g, color_b, opaque,
-                          hardness, color_a, aspect_ratio, angle, lock_alpha,
-                          colorize, texture_grain, texture_contrast);
+    return draw_dab_impl(brush_impl, dab);
+  } else {
+    MypaintBrushFeature brush_impl(&dab_mask_cache);
+    return draw_dab_impl(brush_impl, dab);
+  }
+}
+
+template<class DrawableFeature> int
+GimpMypaintSurfaceImpl<DrawableFeature>::
+draw_dabs (const DabBatch& dabs)
+{
+  if (dabs.empty())
+    return 0;
+
+  if (brushmark) {
+    // GimpBrushFeature::prepare_brush() advances the brush pipe and
+    // the last coords, so a brushmark dab must not be prepared twice.
+    return GimpMypaintSurface::draw_dabs(dabs);
   } else {
-    MypaintBrushFeature brush_impl;
-    return draw_dab_impl(brush_impl,
-                          x, y, radius, color_r, color_g, color_b, opaque,
-                          hardness, color_a, aspect_ratio, angle, lock_alpha,
-                          colorize, texture_grain, texture_contrast);
+    MypaintBrushFeature brush_impl(&dab_mask_cache);
+    return draw_dabs_impl(brush_impl, dabs, dab_scheduler);
   }
 }
 
@@ -537,7 +828,7 @@ get_color (float x, float y, float radius,
                           hardness, aspect_ratio, angle, 
                           texture_grain, texture_contrast);
   } else { // DEFAULT_CASE
-    MypaintBrushFeature brush_impl;
+    MypaintBrushFeature brush_impl(&dab_mask_cache);
     return get_color_impl(brush_impl,
                           x, y, radius, color_r, color_g, color_b, color_a, 
                           hardness, aspect_ratio, angle, 
@@ -556,8 +847,10 @@ GimpMypaintSurfaceImpl<DrawableFeature>::begin_session()
 template<class DrawableFeature> void 
 GimpMypaintSurfaceImpl<DrawableFeature>::end_session()
 {
-  if (session <= 0)
+  if (session <= 0) {
+    set_stroke(NULL);
     return;
+  }
     
   stop_undo_group();
   if (floating_stroke)
@@ -580,7 +873,9 @@ template<class DrawableFeature> void
 GimpMypaintSurfaceImpl<DrawableFeature>::stop_undo_group()
 {
   g_print("Stroke::stop_undo_group...\n");
-  drawable_feature.stop_undo_group();
+  if (drawable_feature.stop_undo_group(stroke))
+    stroke = NULL;  // owned by the undo step now
+  set_stroke(NULL);
 }
 
 template<class DrawableFeature> void 
@@ -33,6 +33,8 @@ extern "C++" {
 #include "core/gimpcoords.h"
 #include "base/pixel.hpp"
 
+class Stroke;
+
 class GimpMypaintSurface : public Surface
 {
 public:
@@ -48,6 +50,11 @@ public:
   virtual void set_coords(const GimpCoords* coords) = 0;
   virtual void set_texture(GimpPattern* texture) = 0;
   virtual GimpPattern* get_texture() = 0;
+
+  // Hands a finished stroke over to the surface. It is attached to the
+  // undo step pushed by the next end_session(), or deleted if there is
+  // none.
+  virtual void set_stroke(Stroke* stroke) = 0;
 };
 
 GimpMypaintSurface* GimpMypaintSurface_new(GimpDrawable* drawable);
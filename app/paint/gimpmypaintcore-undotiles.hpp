@@ -0,0 +1,130 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GIMPMYPAINTCORE_UNDOTILES_HPP__
+#define __GIMPMYPAINTCORE_UNDOTILES_HPP__
+
+// The original tiles of the part of a drawable that a stroke touched.
+//
+// While painting, GimpImageFeature collects the original tiles in a
+// tile manager of the drawable size, which is reused by every stroke
+// on the drawable. When the stroke ends, its tiles are handed over to
+// an UndoTiles, which keeps each tile in a tile manager of its own.
+// The tiles stay shared copy-on-write with the tile managers they come
+// from, so no pixels are copied. Only the tiles the drawable has made a
+// copy of when it was painted on are kept, so an undo step only costs
+// the tiles which were actually changed.
+
+class UndoTiles {
+  GimpDrawable* drawable;
+  gint          width, height;  // of the drawable
+  gint          ntile_cols;
+  gint          x, y, w, h;     // area to update after a swap
+  GHashTable*   tiles;          // tile number -> TileManager of one tile
+  gint64        memsize;
+
+public:
+  UndoTiles(GimpDrawable* drawable, gint x, gint y, gint w, gint h) {
+    this->drawable = GIMP_DRAWABLE(g_object_ref(drawable));
+    width      = gimp_item_get_width(GIMP_ITEM(drawable));
+    height     = gimp_item_get_height(GIMP_ITEM(drawable));
+    ntile_cols = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+    this->x    = x;
+    this->y    = y;
+    this->w    = w;
+    this->h    = h;
+    tiles      = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                       (GDestroyNotify) tile_manager_unref);
+    memsize    = sizeof(UndoTiles);
+  }
+
+  ~UndoTiles() {
+    g_hash_table_destroy(tiles);
+    g_object_unref(drawable);
+  }
+
+  // Shares the valid tile of src at the given pixel.
+  void add(TileManager* src, gint xpixel, gint ypixel) {
+    gint         tile_num = (ypixel / TILE_HEIGHT) * ntile_cols +
+                            (xpixel / TILE_WIDTH);
+    Tile*        tile     = tile_manager_get_tile(src, xpixel, ypixel,
+                                                  TRUE, FALSE);
+    TileManager* tm       = tile_manager_new(tile_ewidth(tile),
+                                             tile_eheight(tile),
+                                             tile_bpp(tile));
+
+    // allocates the tile of tm, tile_manager_map() expects it
+    tile_manager_get(tm, 0, FALSE, FALSE);
+    tile_manager_map(tm, 0, tile);
+    tile_release(tile, FALSE);
+
+    g_hash_table_insert(tiles, GINT_TO_POINTER(tile_num), tm);
+
+    // tm has exactly the size of the tile, so this is not an estimate
+    memsize += tile_manager_get_memsize(tm, FALSE) + 2 * sizeof(gpointer);
+  }
+
+  bool is_empty() {
+    return g_hash_table_size(tiles) == 0;
+  }
+
+  gint64 get_memsize() {
+    return memsize;
+  }
+
+  // Exchanges the kept tiles with the ones of the drawable, this is
+  // both undo and redo. The tiles are put into a sparse tile manager
+  // of the drawable size for gimp_drawable_swap_pixels(), which also
+  // does the updates and notifications of the drawable, and are taken
+  // back from it afterwards.
+  void swap() {
+    TileManager*   dest = gimp_drawable_get_tiles(drawable);
+    TileManager*   sparse;
+    GHashTableIter iter;
+    gpointer       key, value;
+
+    g_return_if_fail(tile_manager_width(dest)  == width &&
+                     tile_manager_height(dest) == height);
+
+    sparse = tile_manager_new(width, height, tile_manager_bpp(dest));
+
+    g_hash_table_iter_init(&iter, tiles);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+      move_tile((TileManager*) value, 0, sparse, GPOINTER_TO_INT(key));
+
+    gimp_drawable_swap_pixels(drawable, sparse, TRUE, x, y, w, h);
+
+    g_hash_table_iter_init(&iter, tiles);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+      move_tile(sparse, GPOINTER_TO_INT(key), (TileManager*) value, 0);
+
+    tile_manager_unref(sparse);
+  }
+
+private:
+  static void move_tile(TileManager* src,  gint src_num,
+                        TileManager* dest, gint dest_num) {
+    Tile* tile = tile_manager_get(src, src_num, TRUE, FALSE);
+
+    // allocates the tile of dest, tile_manager_map() expects it
+    tile_manager_get(dest, dest_num, FALSE, FALSE);
+    tile_manager_map(dest, dest_num, tile);
+    tile_release(tile, FALSE);
+  }
+};
+
+#endif
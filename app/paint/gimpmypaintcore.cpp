@@ -139,7 +139,6 @@ void GimpMypaintCore::stroke_to (GimpDrawable* drawable,
   // Prepare Stroke object
   if (!stroke) {
     stroke = new Stroke();
-    stroke->start(brush);
 
     GimpContext* context = GIMP_CONTEXT (options);
 
@@ -190,6 +189,9 @@ void GimpMypaintCore::stroke_to (GimpDrawable* drawable,
       else
         brush->set_base_value(BRUSH_LOCK_ALPHA, 0.0);
     }
+
+    // snapshot the brush after all per-stroke settings are applied
+    stroke->start(brush);
     surface->begin_session();
   }
   
@@ -213,11 +215,11 @@ void GimpMypaintCore::split_stroke()
     return;
     
   stroke->stop();
-  surface->end_session();
-  // push stroke to undo stack.
 
-  delete stroke;  
+  // push stroke to undo stack.
+  surface->set_stroke(stroke);
   stroke = NULL;
+  surface->end_session();
   /*
   if (brush) {
     delete brush;
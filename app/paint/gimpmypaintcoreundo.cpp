@@ -23,16 +23,25 @@ extern "C" {
 #include "paint-types.h"
 
 #include "libgimpmath/gimpmath.h"
+
+#include "base/tile.h"
+#include "base/tile-manager.h"
+
+#include "core/gimpchannel.h"
+#include "core/gimpdrawable.h"
+
 #include "gimpmypaintcore.hpp"
 #include "gimpmypaintcoreundo.h"
 };
 #include "mypaintbrush-surface.hpp"
 #include "mypaintbrush-stroke.hpp"
+#include "gimpmypaintcore-undotiles.hpp"
 
 enum
 {
   PROP_0,
-  PROP_STROKE
+  PROP_STROKE,
+  PROP_UNDO_TILES
 };
 
 
@@ -46,6 +55,9 @@ static void   gimp_mypaint_core_undo_get_property (GObject             *object,
                                                  GValue              *value,
                                                  GParamSpec          *pspec);
 
+static gint64 gimp_mypaint_core_undo_get_memsize  (GimpObject          *object,
+                                                 gint64              *gui_size);
+
 static void   gimp_mypaint_core_undo_pop          (GimpUndo            *undo,
                                                  GimpUndoMode         undo_mode,
                                                  GimpUndoAccumulator *accum);
@@ -61,21 +73,30 @@ G_DEFINE_TYPE (GimpMypaintCoreUndo, gimp_mypaint_core_undo, GIMP_TYPE_UNDO)
 static void
 gimp_mypaint_core_undo_class_init (GimpMypaintCoreUndoClass *klass)
 {
-  GObjectClass  *object_class = G_OBJECT_CLASS (klass);
-  GimpUndoClass *undo_class   = GIMP_UNDO_CLASS (klass);
+  GObjectClass    *object_class      = G_OBJECT_CLASS (klass);
+  GimpObjectClass *gimp_object_class = GIMP_OBJECT_CLASS (klass);
+  GimpUndoClass   *undo_class        = GIMP_UNDO_CLASS (klass);
+
+  object_class->constructed      = gimp_mypaint_core_undo_constructed;
+  object_class->set_property     = gimp_mypaint_core_undo_set_property;
+  object_class->get_property     = gimp_mypaint_core_undo_get_property;
 
-  object_class->constructed  = gimp_mypaint_core_undo_constructed;
-  object_class->set_property = gimp_mypaint_core_undo_set_property;
-  object_class->get_property = gimp_mypaint_core_undo_get_property;
+  gimp_object_class->get_memsize = gimp_mypaint_core_undo_get_memsize;
 
-  undo_class->pop            = gimp_mypaint_core_undo_pop;
-  undo_class->free           = gimp_mypaint_core_undo_free;
+  undo_class->pop                = gimp_mypaint_core_undo_pop;
+  undo_class->free               = gimp_mypaint_core_undo_free;
 
+  /*  the recorded Stroke, owned by the undo step  */
   g_object_class_install_property (object_class, PROP_STROKE,
-                                   g_param_spec_object ("stroke", NULL, NULL,
-                                                        G_TYPE_POINTER,
-                                                        (GParamFlags)(GIMP_PARAM_READWRITE |
-                                                        G_PARAM_CONSTRUCT_ONLY)));
+                                   g_param_spec_pointer ("stroke", NULL, NULL,
+                                                         (GParamFlags)(GIMP_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY)));
+
+  /*  the original tiles of the drawable (UndoTiles), owned as well  */
+  g_object_class_install_property (object_class, PROP_UNDO_TILES,
+                                   g_param_spec_pointer ("undo-tiles", NULL, NULL,
+                                                         (GParamFlags)(GIMP_PARAM_READWRITE |
+                                                         G_PARAM_CONSTRUCT_ONLY)));
 }
 
 static void
@@ -106,6 +127,9 @@ gimp_mypaint_core_undo_set_property (GObject      *object,
     case PROP_STROKE:
       mypaint_core_undo->stroke = g_value_get_pointer (value);
       break;
+    case PROP_UNDO_TILES:
+      mypaint_core_undo->undo_tiles = g_value_get_pointer (value);
+      break;
 
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -126,6 +150,9 @@ gimp_mypaint_core_undo_get_property (GObject    *object,
     case PROP_STROKE:
       g_value_set_pointer (value, mypaint_core_undo->stroke);
       break;
+    case PROP_UNDO_TILES:
+      g_value_set_pointer (value, mypaint_core_undo->undo_tiles);
+      break;
 
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -133,6 +160,27 @@ gimp_mypaint_core_undo_get_property (GObject    *object,
     }
 }
 
+static gint64
+gimp_mypaint_core_undo_get_memsize (GimpObject *object,
+                                    gint64     *gui_size)
+{
+  GimpMypaintCoreUndo *mypaint_core_undo = GIMP_MYPAINT_CORE_UNDO (object);
+  gint64               memsize           = 0;
+
+  if (mypaint_core_undo->stroke) {
+    Stroke* stroke = reinterpret_cast<Stroke*>(mypaint_core_undo->stroke);
+    memsize += stroke->get_memsize();
+  }
+
+  if (mypaint_core_undo->undo_tiles) {
+    UndoTiles* undo_tiles = reinterpret_cast<UndoTiles*>(mypaint_core_undo->undo_tiles);
+    memsize += undo_tiles->get_memsize();
+  }
+
+  return memsize + GIMP_OBJECT_CLASS (parent_class)->get_memsize (object,
+                                                                  gui_size);
+}
+
 static void
 gimp_mypaint_core_undo_pop (GimpUndo              *undo,
                           GimpUndoMode           undo_mode,
@@ -142,9 +190,11 @@ gimp_mypaint_core_undo_pop (GimpUndo              *undo,
 
   GIMP_UNDO_CLASS (parent_class)->pop (undo, undo_mode, accum);
 
-  /*  only pop if the core still exists  */
-  if (mypaint_core_undo->stroke)
+  /*  swapping the tiles undoes and redoes the stroke alike  */
+  if (mypaint_core_undo->undo_tiles)
     {
+      UndoTiles* undo_tiles = reinterpret_cast<UndoTiles*>(mypaint_core_undo->undo_tiles);
+      undo_tiles->swap();
     }
 }
 
@@ -160,5 +210,11 @@ gimp_mypaint_core_undo_free (GimpUndo     *undo,
     mypaint_core_undo->stroke = NULL;
   }
 
+  if (mypaint_core_undo->undo_tiles) {
+    UndoTiles* undo_tiles = reinterpret_cast<UndoTiles*>(mypaint_core_undo->undo_tiles);
+    delete undo_tiles;
+    mypaint_core_undo->undo_tiles = NULL;
+  }
+
   GIMP_UNDO_CLASS (parent_class)->free (undo, undo_mode);
 }
@@ -36,6 +36,7 @@ struct _GimpMypaintCoreUndo
 {
   GimpUndo         parent_instance;
   gpointer         stroke;
+  gpointer         undo_tiles;
 };
 
 struct _GimpMypaintCoreUndoClass
@@ -31,6 +31,7 @@ extern "C" {
 #include "core/mypaintbrush-brushsettings.h"
 #include "core/mypaintbrush-enum-settings.h"
 #include "core/mypaintbrush-mapping.hpp"
+#include "mypaintbrush-rng.hpp"
 
 ///
 /// Helper functions
@@ -42,11 +43,11 @@ extern "C" {
 // adapted from ppmforge.c, which is part of PBMPLUS. The algorithm
 // comes from: 'The Science Of Fractal Images'. Peitgen, H.-O., and
 // Saupe, D. eds.  Springer Verlag, New York, 1988.
-inline float rand_gauss (GRand * rng)
+inline float rand_gauss (BrushRng& rng)
 {
   float sum = 0.0;
-  gint32 rand1 = g_rand_int(rng);
-  gint32 rand2 = g_rand_int(rng);
+  gint32 rand1 = rng.next_int();
+  gint32 rand2 = rng.next_int();
   sum +=  rand1        & 0x7FFF;
   sum += (rand1 >> 16) & 0x7FFF;
   sum +=  rand2        & 0x7FFF;
@@ -141,12 +142,17 @@ private:
 
   // the states (get_state, set_state, reset) that change during a stroke
   float states[STATE_COUNT];
-  GRand * rng;
+  BrushRng rng;
 
   // Those mappings describe how to calculate the current value for each setting.
   // Most of settings will be constant (eg. only their base_value is used).
   Mapping * settings[BRUSH_SETTINGS_COUNT];
 
+  // settings compiled for update_states_and_setting_values(),
+  // recompiled lazily after a mapping was changed
+  MappingTable mapping_table;
+  bool         mappings_changed;
+
   // the current value of all settings (calculated using the current state)
   float settings_value[BRUSH_SETTINGS_COUNT];
 
@@ -155,13 +161,19 @@ private:
 
   bool reset_requested;
 
+  // dabs of the current motion event which were not yet handed over
+  // to the surface, and how many of the flushed ones painted something
+  DabBatch pending_dabs;
+  int      painted_dabs;
+
 public:
-  Brush() {
+  Brush() : mapping_table(BRUSH_SETTINGS_COUNT) {
     for (int i=0; i<BRUSH_SETTINGS_COUNT; i++) {
       settings[i] = new Mapping(INPUT_COUNT);
     }
-    rng = g_rand_new();
+    mappings_changed = true;
     print_inputs = false;
+    painted_dabs = 0;
     
     for (int i=0; i<STATE_COUNT; i++) {
       states[i] = 0;
@@ -173,11 +185,26 @@ public:
     reset_requested = true;
   }
 
+  // Copies the settings and the state of another brush, e.g. to keep
+  // a snapshot of the brush at the beginning of a stroke.
+  Brush(const Brush& src) : mapping_table(BRUSH_SETTINGS_COUNT) {
+    for (int i=0; i<BRUSH_SETTINGS_COUNT; i++) {
+      settings[i] = new Mapping(INPUT_COUNT);
+      *(settings[i]) = *(src.settings[i]);
+    }
+    mappings_changed = true;
+    print_inputs = src.print_inputs;
+    painted_dabs = 0;
+
+    settings_base_values_have_changed();
+
+    copy_state_from(src);
+  }
+
   ~Brush() {
     for (int i=0; i<BRUSH_SETTINGS_COUNT; i++) {
       delete settings[i];
     }
-    g_rand_free (rng); rng = NULL;
   }
 
   void reset()
@@ -194,6 +221,7 @@ public:
   void set_base_value (int id, float value) {
     assert (id >= 0 && id < BRUSH_SETTINGS_COUNT);
     settings[id]->base_value = value;
+    mappings_changed = true;
 
     settings_base_values_have_changed ();
   }
@@ -201,11 +229,13 @@ public:
   void set_mapping_n (int id, int input, int n) {
     assert (id >= 0 && id < BRUSH_SETTINGS_COUNT);
     settings[id]->set_n (input, n);
+    mappings_changed = true;
   }
 
   void set_mapping_point (int id, int input, int index, float x, float y) {
     assert (id >= 0 && id < BRUSH_SETTINGS_COUNT);
     settings[id]->set_point (input, index, x, y);
+    mappings_changed = true;
   }
   
   void copy_mapping (int id, const Mapping* src) {
@@ -213,6 +243,46 @@ public:
     assert (src != NULL);
     
     *(settings[id]) = *src;
+    mappings_changed = true;
+  }
+
+  // Takes over everything that changes during a stroke from another
+  // brush, but keeps the settings. Replaying the same events afterwards
+  // continues exactly where the other brush was.
+  void copy_state_from (const Brush& src)
+  {
+    for (int i=0; i<STATE_COUNT; i++) {
+      states[i] = src.states[i];
+    }
+    for (int i=0; i<BRUSH_SETTINGS_COUNT; i++) {
+      settings_value[i] = src.settings_value[i];
+    }
+    rng = src.rng;
+    stroke_total_painting_time = src.stroke_total_painting_time;
+    stroke_current_idling_time = src.stroke_current_idling_time;
+    reset_requested = src.reset_requested;
+  }
+
+  gsize get_memsize ()
+  {
+    gsize memsize = sizeof(Brush);
+    for (int i=0; i<BRUSH_SETTINGS_COUNT; i++) {
+      memsize += settings[i]->get_memsize();
+    }
+    memsize += mapping_table.get_memsize() - sizeof(MappingTable);
+    return memsize;
+  }
+
+  // Starts the random sequence of the brush dynamics from a known
+  // seed, e.g. to make a stroke reproducible.
+  void set_seed (guint32 seed)
+  {
+    states[STATE_RNG_SEED] = seed & BRUSH_RNG_SEED_MASK;
+  }
+
+  guint32 get_seed ()
+  {
+    return (guint32)states[STATE_RNG_SEED];
   }
 
   float get_state (int i)
@@ -340,7 +410,7 @@ private:
     inputs[INPUT_PRESSURE] = pressure;
     inputs[INPUT_SPEED1] = log(speed_mapping_gamma[0] + states[STATE_NORM_SPEED1_SLOW])*speed_mapping_m[0] + speed_mapping_q[0];
     inputs[INPUT_SPEED2] = log(speed_mapping_gamma[1] + states[STATE_NORM_SPEED2_SLOW])*speed_mapping_m[1] + speed_mapping_q[1];
-    inputs[INPUT_RANDOM] = g_rand_double (rng);
+    inputs[INPUT_RANDOM] = rng.next_double ();
     inputs[INPUT_STROKE] = MIN(states[STATE_STROKE], 1.0);
     inputs[INPUT_DIRECTION] = fmodf (atan2f (states[STATE_DIRECTION_DY], states[STATE_DIRECTION_DX])/M_PI*180.0 + 360, 360.0);
     inputs[INPUT_TILT_DECLINATION] = states[STATE_DECLINATION];
@@ -352,9 +422,11 @@ private:
     // FIXME: this one fails!!!
     //assert(inputs[INPUT_SPEED1] >= 0.0 && inputs[INPUT_SPEED1] < 1e8); // checking for inf
 
-    for (int i=0; i<BRUSH_SETTINGS_COUNT; i++) {
-      settings_value[i] = settings[i]->calculate (inputs);
+    if (mappings_changed) {
+      mapping_table.compile (settings);
+      mappings_changed = false;
     }
+    mapping_table.calculate (inputs, settings_value);
 
     {
       float fac = 1.0 - exp_decay (settings_value[BRUSH_SLOW_TRACKING_PER_DAB], 1.0);
@@ -445,12 +517,21 @@ private:
     states[STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE] = settings_value[BRUSH_ELLIPTICAL_DAB_ANGLE];
   }
 
+  // Hands the pending dabs over to the surface in one batch.
+  void flush_dabs (Surface * surface)
+  {
+    if (pending_dabs.empty())
+      return;
+    painted_dabs += surface->draw_dabs (pending_dabs);
+    pending_dabs.clear();
+  }
+
   // Called only from stroke_to(). Calculate everything needed to
-  // draw the dab, then let the surface do the actual drawing.
+  // draw the dab, then queue it for the surface. The queued dabs are
+  // drawn by flush_dabs() at the end of the motion event.
   //
   // This is only gets called right after update_states_and_setting_values().
-  // Returns true if the surface was modified.
-  bool prepare_and_draw_dab (Surface * surface)
+  void prepare_and_draw_dab (Surface * surface)
   {
     float x, y, opaque;
     float radius;
@@ -595,6 +676,8 @@ private:
 
         float smudge_radius = radius * expf(settings_value[BRUSH_SMUDGE_RADIUS_LOG]);
         smudge_radius = CLAMP(smudge_radius, ACTUAL_RADIUS_MIN, ACTUAL_RADIUS_MAX);
+        // the queued dabs must be on the surface before we pick from it
+        flush_dabs (surface);
         surface->get_color (px, py, smudge_radius, &r, &g, &b, &a, hardness, 
                             states[STATE_ACTUAL_ELLIPTICAL_DAB_RATIO], 
                             states[STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE]);
@@ -651,10 +734,23 @@ private:
     // the functions below will CLAMP most inputs
     hsv_to_rgb_float (&color_h, &color_s, &color_v);
   
-    return surface->draw_dab (x, y, radius, color_h, color_s, color_v, opaque, hardness, eraser_target_alpha,
-                              states[STATE_ACTUAL_ELLIPTICAL_DAB_RATIO], states[STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE],
-                              settings_value[BRUSH_LOCK_ALPHA], false, 
-                              settings_value[BRUSH_TEXTURE_GRAIN], settings_value[BRUSH_TEXTURE_CONTRAST]);
+    Dab dab;
+    dab.x                = x;
+    dab.y                = y;
+    dab.radius           = radius;
+    dab.color_r          = color_h;
+    dab.color_g          = color_s;
+    dab.color_b          = color_v;
+    dab.opaque           = opaque;
+    dab.hardness         = hardness;
+    dab.alpha_eraser     = eraser_target_alpha;
+    dab.aspect_ratio     = states[STATE_ACTUAL_ELLIPTICAL_DAB_RATIO];
+    dab.angle            = states[STATE_ACTUAL_ELLIPTICAL_DAB_ANGLE];
+    dab.lock_alpha       = settings_value[BRUSH_LOCK_ALPHA];
+    dab.colorize         = 0.0;
+    dab.texture_grain    = settings_value[BRUSH_TEXTURE_GRAIN];
+    dab.texture_contrast = settings_value[BRUSH_TEXTURE_CONTRAST];
+    pending_dabs.push_back (dab);
   }
 
   // How many dabs will be drawn between the current and the next (x, y, pressure, +dt) position?
@@ -761,7 +857,7 @@ public:
       dtime = 0.0001;
     }
 
-    g_rand_set_seed (rng, states[STATE_RNG_SEED]);
+    rng.set_seed ((guint32)states[STATE_RNG_SEED]);
 
     { // calculate the actual "virtual" cursor position
 
@@ -802,9 +898,12 @@ public:
       */
 
       //printf("Brush reset.\n");
+      // keep the seed, it may have been set for this stroke
+      float seed = states[STATE_RNG_SEED];
       for (int i=0; i<STATE_COUNT; i++) {
         states[i] = 0;
       }
+      states[STATE_RNG_SEED] = seed;
 
       states[STATE_X] = x;
       states[STATE_Y] = y;
@@ -823,6 +922,9 @@ public:
     //g_print("dist = %f\n", states[STATE_DIST]);
     enum { UNKNOWN, YES, NO } painted = UNKNOWN;
     double dtime_left = dtime;
+    int    queued_dabs = 0;
+
+    painted_dabs = 0;
 
     float step_dx, step_dy, step_dpressure, step_dtime;
     float step_declination, step_ascension;
@@ -847,12 +949,8 @@ public:
       }
     
       update_states_and_setting_values (step_dx, step_dy, step_dpressure, step_declination, step_ascension, step_dtime);
-      bool painted_now = prepare_and_draw_dab (surface);
-      if (painted_now) {
-        painted = YES;
-      } else if (painted == UNKNOWN) {
-        painted = NO;
-      }
+      prepare_and_draw_dab (surface);
+      queued_dabs++;
 
       dtime_left   -= step_dtime;
       dist_todo  = count_dabs_to (x, y, pressure, dtime_left);
@@ -877,12 +975,20 @@ public:
       update_states_and_setting_values (step_dx, step_dy, step_dpressure, step_declination, step_ascension, step_dtime);
     }
 
+    // draw all dabs of this motion event at once
+    flush_dabs (surface);
+    if (painted_dabs > 0) {
+      painted = YES;
+    } else if (queued_dabs > 0) {
+      painted = NO;
+    }
+
     // save the fraction of a dab that is already done now
     states[STATE_DIST] = dist_moved + dist_todo;
     //g_print("dist_final = %f\n", states[STATE_DIST]);
 
-    // next seed for the RNG (GRand has no get_state() and states[] must always contain our full state)
-    states[STATE_RNG_SEED] = g_rand_int(rng);
+    // next seed for the RNG (states[] must always contain our full state)
+    states[STATE_RNG_SEED] = rng.next_seed();
 
     // stroke separation logic (for undo/redo)
 
@@ -0,0 +1,80 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MYPAINT_BRUSH_RNG_HPP__
+#define __MYPAINT_BRUSH_RNG_HPP__
+
+#include <glib.h>
+
+// Random numbers for the brush dynamics.
+//
+// xoshiro128** (Blackman and Vigna), seeded through splitmix32. Unlike
+// GRand it has no locking and no global state, and the whole sequence
+// is defined by a seed that fits into a float state of the brush.
+
+// Seeds are limited to 24 bits, so that they survive a round trip
+// through Brush::states[STATE_RNG_SEED] unchanged.
+const guint32 BRUSH_RNG_SEED_MASK = 0xffffff;
+
+class BrushRng {
+  guint32 s[4];
+
+  static guint32 rotl(guint32 x, int k) {
+    return (x << k) | (x >> (32 - k));
+  }
+
+public:
+  BrushRng(guint32 seed = 0) {
+    set_seed(seed);
+  }
+
+  void set_seed(guint32 seed) {
+    guint32 z = seed;
+    for (int i = 0; i < 4; i++) {
+      z += 0x9e3779b9;
+      guint32 t = z;
+      t = (t ^ (t >> 16)) * 0x85ebca6b;
+      t = (t ^ (t >> 13)) * 0xc2b2ae35;
+      s[i] = t ^ (t >> 16);
+    }
+  }
+
+  guint32 next_int() {
+    guint32 result = rotl(s[1] * 5, 7) * 9;
+    guint32 t      = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3]  = rotl(s[3], 11);
+
+    return result;
+  }
+
+  // uniformly distributed in [0, 1)
+  double next_double() {
+    return next_int() * (1.0 / 4294967296.0);
+  }
+
+  guint32 next_seed() {
+    return next_int() & BRUSH_RNG_SEED_MASK;
+  }
+};
+
+#endif /* __MYPAINT_BRUSH_RNG_HPP__ */
@@ -32,7 +32,8 @@ extern "C" {
 
 gint Stroke::_serial_number = 0;
 
-Stroke::Stroke() : brush(NULL), finished(FALSE)
+Stroke::Stroke() : brush(NULL), brush_state(NULL),
+  total_painting_time(0), finished(FALSE), seed(0)
 {
   serial_number = ++_serial_number;
 }
@@ -40,6 +41,8 @@ Stroke::Stroke() : brush(NULL), finished(FALSE)
 
 Stroke::~Stroke() 
 {
+  if (brush_state)
+    delete brush_state;
 }
 
 void 
@@ -47,19 +50,28 @@ Stroke::start(Brush* brush)
 {
   g_assert (!finished);
   
-  //TODO: record brush state and setting here.
-  
   brush->new_stroke();
   coords.clear();
   this->brush = brush;
-  
+  this->seed  = brush->get_seed();
+
+  // the brush settings and state the recorded events start from
+  if (brush_state)
+    delete brush_state;
+  brush_state = new Brush(*brush);
+}
+
+void 
+Stroke::start(Brush* brush, guint32 seed)
+{
+  brush->set_seed(seed);
+  start(brush);
 }
 
 void 
 Stroke::record(gdouble dtime, 
                const GimpCoords* coord)
 {
-  // TODO:
   g_assert (!finished);
   StrokeRecord rec;
   rec.dtime  = dtime;
@@ -70,9 +82,11 @@ Stroke::record(gdouble dtime,
 void 
 Stroke::stop()
 {
- // TODO:
   finished = true;
   total_painting_time += brush->stroke_total_painting_time;
+
+  // the stroke may outlive the brush (e.g. when it is kept for undo)
+  brush = NULL;
 }
 
 bool 
@@ -81,26 +95,46 @@ Stroke::is_empty()
   return total_painting_time == 0;
 }
 
-void 
-Stroke::render(Surface* surface)
+gsize
+Stroke::get_memsize()
 {
-  // TODO:
-  for (std::vector<StrokeRecord>::iterator i = coords.begin(); i != coords.end(); i ++) {
-    brush->stroke_to(surface, i->coords.x, i->coords.y, 
-                     i->coords.pressure, 
-                     i->coords.xtilt, i->coords.ytilt, i->dtime);
-  }
+  gsize memsize = sizeof(Stroke) + coords.capacity() * sizeof(StrokeRecord);
 
+  if (brush_state)
+    memsize += brush_state->get_memsize();
+
+  return memsize;
 }
 
-void 
-Stroke::copy_using_different_brush(Surface* surface, Brush* b)
+void
+Stroke::replay(Surface* surface, Brush* b)
 {
-  // TODO:
+  surface->begin_session();
   for (std::vector<StrokeRecord>::iterator i = coords.begin(); i != coords.end(); i ++) {
     b->stroke_to(surface, i->coords.x, i->coords.y, 
-                     i->coords.pressure, 
-                     i->coords.xtilt, i->coords.ytilt, i->dtime);
+                 i->coords.pressure, 
+                 i->coords.xtilt, i->coords.ytilt, i->dtime);
   }
+  surface->end_session();
+}
+
+void 
+Stroke::render(Surface* surface)
+{
+  g_return_if_fail (brush_state != NULL);
+
+  // work on a copy, so that the stroke can be rendered again
+  Brush b(*brush_state);
+  replay(surface, &b);
+}
+
+void 
+Stroke::copy_using_different_brush(Surface* surface, Brush* brush)
+{
+  g_return_if_fail (brush_state != NULL);
+  g_return_if_fail (brush != NULL);
 
+  Brush b(*brush);
+  b.copy_state_from(*brush_state);
+  replay(surface, &b);
 }
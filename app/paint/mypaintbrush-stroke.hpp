@@ -5,6 +5,9 @@
 #include "mypaintbrush-surface.hpp"
 #include <vector>
 
+// The input events of a stroke, together with the state of the brush
+// at its beginning. This is enough to paint the stroke again, with the
+// same or with different brush settings (see MyPaint's stroke.py).
 class Stroke {
   struct StrokeRecord {
     gdouble dtime;
@@ -14,21 +17,37 @@ class Stroke {
   static gint _serial_number;
 
   Brush*                 brush;
+  Brush*                 brush_state;   // snapshot taken by start()
   gdouble                total_painting_time;
   bool                   finished;
   gint                   serial_number;
+  guint32                seed;
   std::vector<StrokeRecord> coords;
 
+  void replay(Surface* surface, Brush* b);
+
 public:
   Stroke();
   ~Stroke();
 
+  // Starts recording. The first form continues the random sequence of
+  // the brush, the second one restarts it from the given seed.
   void start(Brush* brush);
+  void start(Brush* brush, guint32 seed);
   void record(gdouble dtime, 
               const GimpCoords* coord);
   void stop();
   bool is_empty();
+  gint get_serial_number() { return serial_number; }
+  guint32 get_seed() { return seed; }
+  gsize get_memsize();
+
+  // Paints the stroke again as it was recorded.
   void render(Surface* surface);
+
+  // Paints the stroke again with the settings of b. The brush state at
+  // the beginning of the stroke is taken from the snapshot; b itself
+  // is not modified.
   void copy_using_different_brush(Surface* surface, Brush* b);
 };
 
@@ -17,6 +17,22 @@
 #ifndef __MYPAINTBRUSH_SURFACE_HPP__
 #define __MYPAINTBRUSH_SURFACE_HPP__
 
+#include <vector>
+
+// parameters of a single dab, in the order of Surface::draw_dab()
+struct Dab {
+  float x, y;
+  float radius;
+  float color_r, color_g, color_b;
+  float opaque, hardness;
+  float alpha_eraser;
+  float aspect_ratio, angle;
+  float lock_alpha, colorize;
+  float texture_grain, texture_contrast;
+};
+
+typedef std::vector<Dab> DabBatch;
+
 // surface interface required by brush.hpp
 class Surface {
 public:
@@ -33,6 +49,23 @@ public:
                          float texture_grain = 0.0, float texture_contrast = 1.0
                          ) = 0;
 
+  // Draws the dabs in order, as if draw_dab() was called for each of
+  // them. Surfaces may override this to share the per-dab setup.
+  // Returns the number of dabs which modified the surface.
+  virtual int draw_dabs (const DabBatch& dabs) {
+    int painted = 0;
+    for (DabBatch::const_iterator i = dabs.begin(); i != dabs.end(); i++) {
+      if (draw_dab (i->x, i->y, i->radius,
+                    i->color_r, i->color_g, i->color_b,
+                    i->opaque, i->hardness, i->alpha_eraser,
+                    i->aspect_ratio, i->angle,
+                    i->lock_alpha, i->colorize,
+                    i->texture_grain, i->texture_contrast))
+        painted++;
+    }
+    return painted;
+  }
+
   virtual void get_color (float x, float y, 
                           float radius,
                           float * color_r, float * color_g, float * color_b, float * color_a,
@@ -199,6 +199,7 @@ public:
   bool cancel() {
     GLib::synchronized locker(&mutex);
     preserved = false;
+    return true;
   }
 
   template<typename... ContextArgs>
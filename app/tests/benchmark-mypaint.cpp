@@ -0,0 +1,523 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Headless benchmark of the MyPaint brush engine.
+ *
+ * Replays an input trace through Brush::stroke_to() onto a TempBuf
+ * surface (or, with --drawable, onto a layer of a real image) and
+ * reports the dab throughput and the number of tiles the stroke
+ * changed. With --drawable it also reports how much the undo stack of
+ * the image grew by the stroke.
+ *
+ * A trace is a text file with one motion event per line:
+ *
+ *   dtime x y pressure [xtilt ytilt]
+ *
+ * Lines starting with '#' are ignored. Without --trace a fixed zigzag
+ * with varying pressure is used.
+ *
+ * Usage: benchmark-mypaint [--trace FILE] [--size WxH] [--repeat N]
+ *                          [--seed N] [--drawable] [BRUSH.myb ...]
+ */
+
+extern "C" {
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gegl.h>
+#include <gtk/gtk.h>
+
+#include "libgimpbase/gimpbase.h"
+
+#include "widgets/widgets-types.h"
+
+#include "base/temp-buf.h"
+#include "base/tile.h"
+#include "base/tile-manager.h"
+
+#include "core/gimp.h"
+#include "core/gimpcontext.h"
+#include "core/gimpdrawable.h"
+#include "core/gimpimage.h"
+#include "core/gimpimage-undo.h"
+#include "core/gimplayer.h"
+#include "core/gimpmypaintbrush.h"
+#include "core/gimpmypaintbrush-load.h"
+
+#include "tests.h"
+
+#include "gimp-app-test-utils.h"
+};
+
+#include <vector>
+
+#include "paint/gimpmypaintcore-surface.hpp"
+#include "paint/mypaintbrush-brush.hpp"
+#include "core/gimpmypaintbrush-private.hpp"
+
+
+#define BENCHMARK_DEFAULT_SIZE    1024
+#define BENCHMARK_DEFAULT_REPEAT  5
+#define BENCHMARK_DEFAULT_SEED    1
+
+
+struct TraceEvent
+{
+  gdouble dtime;
+  gfloat  x, y;
+  gfloat  pressure;
+  gfloat  xtilt, ytilt;
+};
+
+typedef std::vector<TraceEvent> Trace;
+
+
+/*  Forwards everything to the real surface, counting the dabs on the
+ *  way.
+ */
+class CountingSurface : public Surface
+{
+  Surface *target;
+
+public:
+  gulong dabs;
+  gulong painted;
+
+  CountingSurface (Surface *target)
+    : target (target), dabs (0), painted (0)
+  {
+  }
+
+  virtual bool
+  draw_dab (float x, float y, float radius,
+            float color_r, float color_g, float color_b,
+            float opaque, float hardness,
+            float alpha_eraser,
+            float aspect_ratio, float angle,
+            float lock_alpha, float colorize,
+            float texture_grain, float texture_contrast)
+  {
+    bool result = target->draw_dab (x, y, radius,
+                                    color_r, color_g, color_b,
+                                    opaque, hardness, alpha_eraser,
+                                    aspect_ratio, angle,
+                                    lock_alpha, colorize,
+                                    texture_grain, texture_contrast);
+    dabs++;
+    if (result)
+      painted++;
+
+    return result;
+  }
+
+  virtual int
+  draw_dabs (const DabBatch &batch)
+  {
+    int result = target->draw_dabs (batch);
+
+    dabs    += batch.size ();
+    painted += result;
+
+    return result;
+  }
+
+  virtual void
+  get_color (float x, float y, float radius,
+             float *color_r, float *color_g, float *color_b, float *color_a,
+             float hardness, float aspect_ratio, float angle,
+             float texture_grain, float texture_contrast)
+  {
+    target->get_color (x, y, radius, color_r, color_g, color_b, color_a,
+                       hardness, aspect_ratio, angle,
+                       texture_grain, texture_contrast);
+  }
+
+  virtual void begin_session () { target->begin_session (); }
+  virtual void end_session ()   { target->end_session (); }
+};
+
+
+static gchar    *trace_file = NULL;
+static gchar    *size_arg   = NULL;
+static gint      repeat     = BENCHMARK_DEFAULT_REPEAT;
+static gint      seed       = BENCHMARK_DEFAULT_SEED;
+static gboolean  drawable   = FALSE;
+static gchar   **brushes    = NULL;
+
+static const GOptionEntry options[] =
+{
+  { "trace", 't', 0, G_OPTION_ARG_FILENAME, &trace_file,
+    "Input trace to replay", "FILE" },
+  { "size", 's', 0, G_OPTION_ARG_STRING, &size_arg,
+    "Size of the canvas", "WxH" },
+  { "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat,
+    "Number of times the trace is replayed", "N" },
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed,
+    "Seed of the brush dynamics", "N" },
+  { "drawable", 'd', 0, G_OPTION_ARG_NONE, &drawable,
+    "Paint onto a layer instead of a TempBuf", NULL },
+  { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &brushes,
+    NULL, NULL },
+  { NULL }
+};
+
+
+static gboolean
+load_trace (const gchar  *filename,
+            Trace        &trace,
+            GError      **error)
+{
+  gchar  *contents;
+  gchar **lines;
+
+  if (! g_file_get_contents (filename, &contents, NULL, error))
+    return FALSE;
+
+  lines = g_strsplit (contents, "\n", -1);
+
+  for (gchar **line = lines; *line; line++)
+    {
+      TraceEvent event = { 0, };
+      gint       n;
+
+      if (**line == '#' || **line == '\0')
+        continue;
+
+      n = sscanf (*line, "%lf %f %f %f %f %f",
+                  &event.dtime, &event.x, &event.y, &event.pressure,
+                  &event.xtilt, &event.ytilt);
+      if (n >= 4)
+        trace.push_back (event);
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return TRUE;
+}
+
+/*  A zigzag over the canvas at 100 events per second, with the
+ *  pressure going up and down along the way.
+ */
+static void
+synthesize_trace (Trace &trace,
+                  gint   width,
+                  gint   height)
+{
+  const gint rows  = 8;
+  const gint steps = 200;
+
+  for (gint row = 0; row < rows; row++)
+    {
+      gfloat y = (row + 0.5) * height / rows;
+
+      for (gint i = 0; i <= steps; i++)
+        {
+          TraceEvent event;
+          gfloat     t = (gfloat) i / steps;
+
+          event.dtime    = 0.01;
+          event.x        = (row % 2) ? width * (1.0 - t) : width * t;
+          event.y        = y + sin (t * 4 * G_PI) * height / (rows * 4);
+          event.pressure = 0.5 + 0.5 * sin (t * G_PI);
+          event.xtilt    = 0.0;
+          event.ytilt    = 0.0;
+
+          trace.push_back (event);
+        }
+    }
+}
+
+static void
+setup_brush (Brush            *brush,
+             GimpMypaintBrush *myb)
+{
+  GimpMypaintBrushPrivate *priv;
+
+  priv = reinterpret_cast<GimpMypaintBrushPrivate*> (myb->p);
+
+  /*  same as GimpMypaintCore::option_changed()  */
+  for (int i = 0; i < BRUSH_MAPPING_COUNT; i++)
+    {
+      Mapping *m = priv->get_setting (i)->mapping;
+
+      if (m)
+        {
+          brush->copy_mapping (i, m);
+        }
+      else
+        {
+          brush->set_mapping_n (i, 0, 0);
+          brush->set_base_value (i, priv->get_setting (i)->base_value);
+        }
+    }
+}
+
+/*  A tile the layer has written to was copied away from the tile it
+ *  shared with the duplicate taken before the stroke.
+ */
+static gulong
+count_dirty_tiles (TileManager *before,
+                   TileManager *after)
+{
+  gint   width  = tile_manager_width (after);
+  gint   height = tile_manager_height (after);
+  gulong n      = 0;
+
+  for (gint y = 0; y < height; y += TILE_HEIGHT)
+    for (gint x = 0; x < width; x += TILE_WIDTH)
+      if (tile_manager_get_tile (before, x, y, FALSE, FALSE) !=
+          tile_manager_get_tile (after,  x, y, FALSE, FALSE))
+        n++;
+
+  return n;
+}
+
+/*  Counts the tile sized blocks of a TempBuf whose pixels changed.  */
+static gulong
+count_dirty_temp_buf_tiles (TempBuf *before,
+                            TempBuf *after)
+{
+  const guchar *src    = temp_buf_get_data (before);
+  const guchar *dest   = temp_buf_get_data (after);
+  gint          stride = after->width * after->bytes;
+  gulong        n      = 0;
+
+  for (gint y = 0; y < after->height; y += TILE_HEIGHT)
+    for (gint x = 0; x < after->width; x += TILE_WIDTH)
+      {
+        gint rows   = MIN (TILE_HEIGHT, after->height - y);
+        gint length = MIN (TILE_WIDTH, after->width - x) * after->bytes;
+
+        for (gint row = 0; row < rows; row++)
+          {
+            gint offset = (y + row) * stride + x * after->bytes;
+
+            if (memcmp (src + offset, dest + offset, length) != 0)
+              {
+                n++;
+                break;
+              }
+          }
+      }
+
+  return n;
+}
+
+static void
+run_benchmark (Gimp             *gimp,
+               const gchar      *name,
+               GimpMypaintBrush *myb,
+               const Trace      &trace,
+               gint              width,
+               gint              height)
+{
+  gdouble best    = G_MAXDOUBLE;
+  gdouble total   = 0.0;
+  gulong  dabs    = 0;
+  gulong  painted = 0;
+  gulong  n_tiles = 0;
+  gint64  undo    = -1;
+
+  for (gint r = 0; r < repeat; r++)
+    {
+      GimpImage          *image   = NULL;
+      GimpLayer          *layer   = NULL;
+      TempBuf            *buf     = NULL;
+      TileManager        *tiles   = NULL;
+      TempBuf            *copy    = NULL;
+      gint64              memsize = 0;
+      GimpMypaintSurface *surface;
+      GTimer             *timer;
+      gdouble             elapsed;
+      Brush               brush;
+
+      if (drawable)
+        {
+          image = gimp_image_new (gimp, width, height, GIMP_RGB);
+          layer = gimp_layer_new (image, width, height, GIMP_RGBA_IMAGE,
+                                  "Benchmark", 1.0, GIMP_NORMAL_MODE);
+          gimp_image_add_layer (image, layer, NULL, 0, FALSE);
+
+          tiles   = tile_manager_duplicate (gimp_drawable_get_tiles (GIMP_DRAWABLE (layer)));
+          memsize = gimp_object_get_memsize (GIMP_OBJECT (gimp_image_get_undo_stack (image)),
+                                             NULL);
+
+          surface = GimpMypaintSurface_new (GIMP_DRAWABLE (layer));
+        }
+      else
+        {
+          guchar color[] = { 255, 255, 255, 0 };
+
+          buf     = temp_buf_new (width, height, 4, 0, 0, color);
+          copy    = temp_buf_copy (buf, NULL);
+          surface = GimpMypaintSurface_TempBuf_new (buf);
+        }
+
+      CountingSurface counter (surface);
+
+      if (myb)
+        setup_brush (&brush, myb);
+      brush.set_seed (seed);
+      brush.new_stroke ();
+
+      timer = g_timer_new ();
+
+      counter.begin_session ();
+      for (Trace::const_iterator i = trace.begin (); i != trace.end (); i++)
+        brush.stroke_to (&counter, i->x, i->y, i->pressure,
+                         i->xtilt, i->ytilt, i->dtime);
+      counter.end_session ();
+
+      elapsed = g_timer_elapsed (timer, NULL);
+      g_timer_destroy (timer);
+
+      best   = MIN (best, elapsed);
+      total += elapsed;
+
+      dabs    = counter.dabs;
+      painted = counter.painted;
+
+      delete surface;
+
+      if (image)
+        {
+          undo = gimp_object_get_memsize (GIMP_OBJECT (gimp_image_get_undo_stack (image)),
+                                          NULL) - memsize;
+          n_tiles = count_dirty_tiles (tiles,
+                                       gimp_drawable_get_tiles (GIMP_DRAWABLE (layer)));
+
+          tile_manager_unref (tiles);
+          g_object_unref (image);
+        }
+      else
+        {
+          n_tiles = count_dirty_temp_buf_tiles (copy, buf);
+
+          temp_buf_free (copy);
+          temp_buf_free (buf);
+        }
+    }
+
+  g_print ("%-32s %8lu dabs (%lu painted) %8.1f dabs/s %10.1f ns/dab "
+           "%6lu tiles changed ",
+           name, dabs, painted,
+           best > 0.0 ? dabs / best : 0.0,
+           dabs ? best * 1e9 / dabs : 0.0,
+           n_tiles);
+
+  /*  the TempBuf surface drops its undo copy at the end of the stroke  */
+  if (undo >= 0)
+    g_print ("%10" G_GINT64_FORMAT " bytes undo ", undo);
+
+  g_print ("(best %.3f s, mean %.3f s)\n", best, total / repeat);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GOptionContext *context;
+  GError         *error  = NULL;
+  Gimp           *gimp;
+  GimpContext    *gimp_context;
+  Trace           trace;
+  gint            width  = BENCHMARK_DEFAULT_SIZE;
+  gint            height = BENCHMARK_DEFAULT_SIZE;
+
+  g_thread_init (NULL);
+  g_type_init ();
+
+  context = g_option_context_new ("[BRUSH.myb...]");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+  g_option_context_free (context);
+
+  if (size_arg && sscanf (size_arg, "%dx%d", &width, &height) != 2)
+    {
+      g_printerr ("Invalid size: %s\n", size_arg);
+      return EXIT_FAILURE;
+    }
+
+  repeat = MAX (repeat, 1);
+
+  gimp_test_utils_set_gimp2_directory ("GIMP_TESTING_ABS_TOP_SRCDIR",
+                                       "app/tests/gimpdir");
+
+  gimp         = gimp_init_for_testing ();
+  gimp_context = gimp_context_new (gimp, "Benchmark", NULL);
+
+  if (trace_file)
+    {
+      if (! load_trace (trace_file, trace, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          return EXIT_FAILURE;
+        }
+    }
+  else
+    {
+      synthesize_trace (trace, width, height);
+    }
+
+  g_print ("%lu events on %dx%d %s, %d runs, seed %d\n",
+           (gulong) trace.size (), width, height,
+           drawable ? "layer" : "TempBuf", repeat, seed);
+
+  if (! brushes)
+    run_benchmark (gimp, "(default brush)", NULL, trace, width, height);
+
+  for (gchar **file = brushes; file && *file; file++)
+    {
+      GList *list = gimp_mypaint_brush_load (gimp_context, *file, &error);
+
+      if (! list)
+        {
+          g_printerr ("%s: %s\n", *file,
+                      error ? error->message : "no brush");
+          g_clear_error (&error);
+          continue;
+        }
+
+      for (GList *l = list; l; l = g_list_next (l))
+        {
+          GimpMypaintBrush *myb = GIMP_MYPAINT_BRUSH (l->data);
+
+          run_benchmark (gimp, gimp_object_get_name (myb), myb,
+                         trace, width, height);
+          g_object_unref (myb);
+        }
+      g_list_free (list);
+    }
+
+  g_object_unref (gimp_context);
+
+  /*  Don't write files to the source dir  */
+  gimp_test_utils_set_gimp2_directory ("GIMP_TESTING_ABS_TOP_BUILDDIR",
+                                       "app/tests/gimpdir-output");
+
+  gimp_exit (gimp, TRUE);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,395 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+
+#include "core/core-types.h"
+
+#include "base/tile-manager.h"
+#include "base/tile-manager-private.h"
+
+#include "xcf-private.h"
+#include "xcf-incremental.h"
+
+/**
+ * SECTION:xcf-incremental
+ * @Short_description:Copying unchanged tile data between XCF files
+ *
+ * With the "xcf-incremental-save" option, each level loaded from or
+ * saved to an XCF file remembers where the data of its tiles is in that
+ * file, and its tile manager tracks which tiles are written to from then
+ * on. The next save copies the data of the untouched tiles from the
+ * earlier file instead of encoding them again, so saving an image where
+ * one layer was painted mostly costs the I/O.
+ *
+ * The earlier file is only used if its size and modification time are
+ * still the ones seen when the level was tracked. The modification time
+ * is compared to the nanosecond where the system records it, a file
+ * rewritten with the same size within one second is not reused then.
+ * The saver writes the new file next to the target and renames it over
+ * the target when done, so the target can be the file the tiles are
+ * copied from.
+ */
+
+struct _XcfSavedFile
+{
+  gint     ref_count;
+  gchar   *filename;
+  dev_t    device;
+  ino_t    inode;
+  off_t    size;
+  time_t   mtime;
+  glong    mtime_nsec;
+};
+
+typedef struct _XcfSavedLevel XcfSavedLevel;
+
+struct _XcfSavedLevel
+{
+  XcfSavedFile       *file;
+  TileManager        *tiles;       /* only set while pending in a save */
+  XcfCompressionType  compression;
+  guint32            *offsets;
+  guint32            *lengths;     /* 0 if the tile can not be copied */
+};
+
+struct _XcfIncremental
+{
+  GHashTable *sources;  /* XcfSavedFile -> FILE, or NULL if it changed */
+  GList      *levels;   /* the XcfSavedLevels of the new file         */
+};
+
+
+static XcfSavedLevel * xcf_saved_level_new   (XcfSavedFile       *file,
+                                              TileManager        *tiles,
+                                              XcfCompressionType  compression,
+                                              const guint32      *offsets,
+                                              const guint32      *lengths);
+static void            xcf_saved_level_free  (XcfSavedLevel      *level);
+static FILE          * xcf_incremental_open  (XcfIncremental     *incremental,
+                                              XcfSavedFile       *file);
+static void            xcf_incremental_close (FILE               *fp);
+
+
+/**
+ * xcf_saved_file_new:
+ * @filename: an XCF file which has been read or written completely
+ *
+ * Returns: a new #XcfSavedFile for the current state of @filename, or
+ * %NULL if the file does not exist.
+ */
+XcfSavedFile *
+xcf_saved_file_new (const gchar *filename)
+{
+  XcfSavedFile *file;
+  struct stat   st;
+
+  if (g_stat (filename, &st) != 0)
+    return NULL;
+
+  file = g_slice_new0 (XcfSavedFile);
+
+  file->ref_count = 1;
+  file->filename  = g_strdup (filename);
+  file->device    = st.st_dev;
+  file->inode     = st.st_ino;
+  file->size      = st.st_size;
+  file->mtime     = st.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  file->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+  return file;
+}
+
+XcfSavedFile *
+xcf_saved_file_ref (XcfSavedFile *file)
+{
+  g_return_val_if_fail (file != NULL, NULL);
+
+  file->ref_count++;
+
+  return file;
+}
+
+void
+xcf_saved_file_unref (XcfSavedFile *file)
+{
+  g_return_if_fail (file != NULL);
+
+  file->ref_count--;
+
+  if (file->ref_count < 1)
+    {
+      g_free (file->filename);
+
+      g_slice_free (XcfSavedFile, file);
+    }
+}
+
+/**
+ * xcf_saved_file_track_level:
+ * @file:        the file holding the tile data of @tiles
+ * @tiles:       the tile manager of the level
+ * @compression: the compression of the tile data
+ * @offsets:     the offsets of the tile data in @file
+ * @lengths:     the lengths of the tile data, or 0 for tiles which can
+ *               not be copied
+ *
+ * Remembers where the tile data of @tiles is in @file, and starts
+ * tracking the writes to @tiles.
+ */
+void
+xcf_saved_file_track_level (XcfSavedFile       *file,
+                            TileManager        *tiles,
+                            XcfCompressionType  compression,
+                            const guint32      *offsets,
+                            const guint32      *lengths)
+{
+  XcfSavedLevel *level;
+
+  g_return_if_fail (file != NULL);
+  g_return_if_fail (tiles != NULL);
+
+  level = xcf_saved_level_new (file, tiles, compression, offsets, lengths);
+
+  tile_manager_track_writes (tiles, level,
+                             (GDestroyNotify) xcf_saved_level_free);
+}
+
+XcfIncremental *
+xcf_incremental_new (void)
+{
+  XcfIncremental *incremental = g_slice_new0 (XcfIncremental);
+
+  incremental->sources =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           (GDestroyNotify) xcf_saved_file_unref,
+                           (GDestroyNotify) xcf_incremental_close);
+
+  return incremental;
+}
+
+void
+xcf_incremental_free (XcfIncremental *incremental)
+{
+  g_return_if_fail (incremental != NULL);
+
+  g_hash_table_destroy (incremental->sources);
+
+  g_list_free_full (incremental->levels,
+                    (GDestroyNotify) xcf_saved_level_free);
+
+  g_slice_free (XcfIncremental, incremental);
+}
+
+/**
+ * xcf_incremental_copy_tile:
+ * @incremental: the incremental state of the save
+ * @tiles:       the tile manager of the level being saved
+ * @tile_num:    the tile being saved
+ * @compression: the compression of the file being saved
+ * @data:        return location for the tile data
+ * @max_length:  the size of @data
+ *
+ * Reads the data of the tile from the file it was last loaded from or
+ * saved to, if the tile was not written to since.
+ *
+ * Returns: the length of the data read into @data, or 0 if the tile has
+ * to be encoded.
+ */
+guint32
+xcf_incremental_copy_tile (XcfIncremental     *incremental,
+                           TileManager        *tiles,
+                           gint                tile_num,
+                           XcfCompressionType  compression,
+                           guchar             *data,
+                           guint32             max_length)
+{
+  XcfSavedLevel *level;
+  FILE          *fp;
+  guint32        length;
+
+  g_return_val_if_fail (incremental != NULL, 0);
+  g_return_val_if_fail (tiles != NULL, 0);
+
+  level = tile_manager_get_tracked_data (tiles);
+
+  if (! level                             ||
+      level->compression != compression  ||
+      tile_manager_tile_written (tiles, tile_num))
+    return 0;
+
+  length = level->lengths[tile_num];
+
+  if (length == 0 || length > max_length)
+    return 0;
+
+  fp = xcf_incremental_open (incremental, level->file);
+
+  if (! fp                                                  ||
+      fseek (fp, level->offsets[tile_num], SEEK_SET) != 0  ||
+      fread (data, 1, length, fp) != length)
+    return 0;
+
+  return length;
+}
+
+/**
+ * xcf_incremental_add_level:
+ * @incremental: the incremental state of the save
+ * @tiles:       the tile manager of the saved level
+ * @compression: the compression of the file being saved
+ * @offsets:     the offsets of the tile data in the file being saved
+ * @lengths:     the lengths of the tile data
+ *
+ * Remembers the saved level, to be tracked by xcf_incremental_commit()
+ * once the file is complete.
+ */
+void
+xcf_incremental_add_level (XcfIncremental     *incremental,
+                           TileManager        *tiles,
+                           XcfCompressionType  compression,
+                           const guint32      *offsets,
+                           const guint32      *lengths)
+{
+  g_return_if_fail (incremental != NULL);
+  g_return_if_fail (tiles != NULL);
+
+  incremental->levels =
+    g_list_prepend (incremental->levels,
+                    xcf_saved_level_new (NULL, tiles, compression,
+                                         offsets, lengths));
+}
+
+/**
+ * xcf_incremental_commit:
+ * @incremental: the incremental state of the save
+ * @filename:    the name of the complete file
+ *
+ * Tracks the levels saved to @filename, the next save copies their
+ * unchanged tiles from @filename.
+ */
+void
+xcf_incremental_commit (XcfIncremental *incremental,
+                        const gchar    *filename)
+{
+  XcfSavedFile *file;
+  GList        *list;
+
+  g_return_if_fail (incremental != NULL);
+  g_return_if_fail (filename != NULL);
+
+  file = xcf_saved_file_new (filename);
+
+  if (! file)
+    return;
+
+  for (list = incremental->levels; list; list = g_list_next (list))
+    {
+      XcfSavedLevel *level = list->data;
+
+      xcf_saved_file_track_level (file, level->tiles, level->compression,
+                                  level->offsets, level->lengths);
+    }
+
+  xcf_saved_file_unref (file);
+}
+
+static XcfSavedLevel *
+xcf_saved_level_new (XcfSavedFile       *file,
+                     TileManager        *tiles,
+                     XcfCompressionType  compression,
+                     const guint32      *offsets,
+                     const guint32      *lengths)
+{
+  XcfSavedLevel *level  = g_slice_new0 (XcfSavedLevel);
+  gint           ntiles = tiles->ntile_rows * tiles->ntile_cols;
+
+  /* a tracked level is kept by its tile manager, a pending one keeps
+   * the tile manager until the save is complete
+   */
+  if (file)
+    level->file = xcf_saved_file_ref (file);
+  else
+    level->tiles = tile_manager_ref (tiles);
+
+  level->compression = compression;
+  level->offsets     = g_memdup (offsets, ntiles * sizeof (guint32));
+  level->lengths     = g_memdup (lengths, ntiles * sizeof (guint32));
+
+  return level;
+}
+
+static void
+xcf_saved_level_free (XcfSavedLevel *level)
+{
+  if (level->file)
+    xcf_saved_file_unref (level->file);
+
+  if (level->tiles)
+    tile_manager_unref (level->tiles);
+
+  g_free (level->offsets);
+  g_free (level->lengths);
+
+  g_slice_free (XcfSavedLevel, level);
+}
+
+static FILE *
+xcf_incremental_open (XcfIncremental *incremental,
+                      XcfSavedFile   *file)
+{
+  FILE        *fp = NULL;
+  gpointer     value;
+  struct stat  st;
+
+  if (g_hash_table_lookup_extended (incremental->sources, file, NULL, &value))
+    return value;
+
+  if (g_stat (file->filename, &st) == 0 &&
+      st.st_dev   == file->device      &&
+      st.st_ino   == file->inode       &&
+      st.st_size  == file->size        &&
+      st.st_mtime == file->mtime
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+      && st.st_mtim.tv_nsec == file->mtime_nsec
+#endif
+      )
+    {
+      fp = g_fopen (file->filename, "rb");
+    }
+
+  g_hash_table_insert (incremental->sources, xcf_saved_file_ref (file), fp);
+
+  return fp;
+}
+
+static void
+xcf_incremental_close (FILE *fp)
+{
+  if (fp)
+    fclose (fp);
+}
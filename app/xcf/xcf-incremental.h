@@ -0,0 +1,50 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XCF_INCREMENTAL_H__
+#define __XCF_INCREMENTAL_H__
+
+
+XcfSavedFile   * xcf_saved_file_new          (const gchar        *filename);
+XcfSavedFile   * xcf_saved_file_ref          (XcfSavedFile       *file);
+void             xcf_saved_file_unref        (XcfSavedFile       *file);
+
+void             xcf_saved_file_track_level  (XcfSavedFile       *file,
+                                              TileManager        *tiles,
+                                              XcfCompressionType  compression,
+                                              const guint32      *offsets,
+                                              const guint32      *lengths);
+
+XcfIncremental * xcf_incremental_new         (void);
+void             xcf_incremental_free        (XcfIncremental     *incremental);
+
+guint32          xcf_incremental_copy_tile   (XcfIncremental     *incremental,
+                                              TileManager        *tiles,
+                                              gint                tile_num,
+                                              XcfCompressionType  compression,
+                                              guchar             *data,
+                                              guint32             max_length);
+void             xcf_incremental_add_level   (XcfIncremental     *incremental,
+                                              TileManager        *tiles,
+                                              XcfCompressionType  compression,
+                                              const guint32      *offsets,
+                                              const guint32      *lengths);
+void             xcf_incremental_commit      (XcfIncremental     *incremental,
+                                              const gchar        *filename);
+
+
+#endif  /* __XCF_INCREMENTAL_H__ */
@@ -0,0 +1,358 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+
+#include "libgimpbase/gimpbase.h"
+
+#include "core/core-types.h"
+
+#include "base/tile.h"
+#include "base/tile-manager.h"
+#include "base/tile-manager-private.h"
+
+#include "xcf-private.h"
+#include "xcf-lazy.h"
+#include "xcf-load.h"
+
+/**
+ * SECTION:xcf-lazy
+ * @Short_description:Loading XCF tile data on demand
+ *
+ * With the "xcf-lazy-loading" option, the loader maps the XCF file into
+ * memory and only reads the tile offset tables. Each level gets a
+ * validate procedure which decodes a tile from the mapped file the first
+ * time it is locked, so the tiles of hidden or off-screen layers are
+ * never read unless something touches them.
+ *
+ * The mapping must stay intact while tiles are pending. Before an XCF
+ * file is written, xcf_lazy_materialize() reads the pending tiles of a
+ * mapping of the same file; changes of the file by other programs are
+ * not detected.
+ */
+
+typedef struct _XcfLazyLevel XcfLazyLevel;
+
+struct _XcfLazyFile
+{
+  gint          ref_count;
+  gchar        *filename;
+  GMappedFile  *mapped_file;
+  dev_t         device;
+  ino_t         inode;
+  GList        *levels;      /* levels with pending tiles */
+};
+
+struct _XcfLazyLevel
+{
+  XcfLazyFile        *file;         /* NULL once all tiles are loaded */
+  TileManager        *tiles;
+  XcfCompressionType  compression;
+  guint32            *offsets;
+  guint8             *loaded;
+  gint                n_pending;
+};
+
+
+static void  xcf_lazy_level_validate  (TileManager  *tiles,
+                                       Tile         *tile,
+                                       XcfLazyLevel *level);
+static void  xcf_lazy_level_tile_done (XcfLazyLevel *level,
+                                       gint          tile_num);
+static void  xcf_lazy_level_free      (XcfLazyLevel *level);
+
+
+/* the files with pending tiles */
+static GList *lazy_files = NULL;
+
+
+/**
+ * xcf_lazy_file_new:
+ * @filename: the XCF file being loaded
+ *
+ * Returns: a new #XcfLazyFile mapping @filename, or %NULL if the file
+ * can not be mapped.
+ */
+XcfLazyFile *
+xcf_lazy_file_new (const gchar *filename)
+{
+  XcfLazyFile *file;
+  GMappedFile *mapped_file;
+  struct stat  st;
+
+  if (g_stat (filename, &st) != 0)
+    return NULL;
+
+  mapped_file = g_mapped_file_new (filename, FALSE, NULL);
+
+  if (! mapped_file)
+    return NULL;
+
+  file = g_slice_new0 (XcfLazyFile);
+
+  file->ref_count   = 1;
+  file->filename    = g_strdup (filename);
+  file->mapped_file = mapped_file;
+  file->device      = st.st_dev;
+  file->inode       = st.st_ino;
+
+  return file;
+}
+
+XcfLazyFile *
+xcf_lazy_file_ref (XcfLazyFile *file)
+{
+  g_return_val_if_fail (file != NULL, NULL);
+
+  file->ref_count++;
+
+  return file;
+}
+
+void
+xcf_lazy_file_unref (XcfLazyFile *file)
+{
+  g_return_if_fail (file != NULL);
+
+  file->ref_count--;
+
+  if (file->ref_count < 1)
+    {
+      g_mapped_file_unref (file->mapped_file);
+      g_free (file->filename);
+
+      g_slice_free (XcfLazyFile, file);
+    }
+}
+
+/**
+ * xcf_lazy_file_add_level:
+ * @file:        the mapped XCF file
+ * @tiles:       the tile manager of the level
+ * @compression: the compression of the tile data
+ * @offsets:     the offset table of the level, terminated by 0
+ *
+ * Makes the tiles of @tiles load from @file when they are first locked.
+ * The tiles of @tiles must not have been touched yet.
+ *
+ * Returns: %FALSE if @offsets point outside of @file.
+ */
+gboolean
+xcf_lazy_file_add_level (XcfLazyFile        *file,
+                         TileManager        *tiles,
+                         XcfCompressionType  compression,
+                         const guint32      *offsets)
+{
+  XcfLazyLevel *level;
+  gsize         length;
+  gint          ntiles;
+  gint          i;
+
+  g_return_val_if_fail (file != NULL, FALSE);
+  g_return_val_if_fail (tiles != NULL, FALSE);
+
+  length = g_mapped_file_get_length (file->mapped_file);
+  ntiles = tiles->ntile_rows * tiles->ntile_cols;
+
+  for (i = 0; i < ntiles; i++)
+    if (offsets[i] >= length)
+      return FALSE;
+
+  level = g_slice_new0 (XcfLazyLevel);
+
+  level->file        = xcf_lazy_file_ref (file);
+  level->tiles       = tiles;
+  level->compression = compression;
+  level->offsets     = g_memdup (offsets, (ntiles + 1) * sizeof (guint32));
+  level->loaded      = g_new0 (guint8, ntiles);
+  level->n_pending   = ntiles;
+
+  if (! file->levels)
+    lazy_files = g_list_prepend (lazy_files, file);
+
+  file->levels = g_list_prepend (file->levels, level);
+
+  tile_manager_set_validate_proc_full (tiles,
+                                       (TileValidateProc) xcf_lazy_level_validate,
+                                       level,
+                                       (GDestroyNotify) xcf_lazy_level_free);
+
+  return TRUE;
+}
+
+/**
+ * xcf_lazy_materialize:
+ * @filename: a file about to be written
+ *
+ * Loads all pending tiles which are mapped from @filename.
+ */
+void
+xcf_lazy_materialize (const gchar *filename)
+{
+  struct stat  st;
+  GList       *list;
+
+  if (! lazy_files || g_stat (filename, &st) != 0)
+    return;
+
+  for (list = lazy_files; list; )
+    {
+      XcfLazyFile *file = list->data;
+
+      list = g_list_next (list);
+
+      if (strcmp (file->filename, filename) != 0 &&
+          (file->inode == 0 ||
+           file->device != st.st_dev || file->inode != st.st_ino))
+        continue;
+
+      /* the last level to finish drops the file from the list */
+      xcf_lazy_file_ref (file);
+
+      while (file->levels)
+        {
+          XcfLazyLevel *level  = file->levels->data;
+          gint          ntiles = level->tiles->ntile_rows * level->tiles->ntile_cols;
+          gint          i;
+
+          for (i = 0; i < ntiles && level->file; i++)
+            {
+              Tile *tile;
+
+              if (level->loaded[i])
+                continue;
+
+              tile = tile_manager_get (level->tiles, i, FALSE, FALSE);
+
+              /* a tile mapped in from elsewhere will never be loaded */
+              if (tile_is_valid (tile))
+                {
+                  xcf_lazy_level_tile_done (level, i);
+                }
+              else
+                {
+                  tile_lock (tile);
+                  tile_release (tile, FALSE);
+                }
+            }
+        }
+
+      xcf_lazy_file_unref (file);
+    }
+}
+
+static void
+xcf_lazy_level_validate (TileManager  *tiles,
+                         Tile         *tile,
+                         XcfLazyLevel *level)
+{
+  const guchar *data;
+  gsize         length;
+  guint32       offset;
+  guint32       end;
+  gint          tile_col;
+  gint          tile_row;
+  gint          tile_num;
+
+  tile_manager_get_tile_col_row (tiles, tile, &tile_col, &tile_row);
+  tile_num = tile_row * tiles->ntile_cols + tile_col;
+
+  /* an invalidated tile starts over empty, like without the level */
+  if (! level->file || level->loaded[tile_num])
+    {
+      memset (tile_data_pointer (tile, 0, 0), 0, tile_size (tile));
+      return;
+    }
+
+  data   = (const guchar *) g_mapped_file_get_contents (level->file->mapped_file);
+  length = g_mapped_file_get_length (level->file->mapped_file);
+  offset = level->offsets[tile_num];
+  end    = level->offsets[tile_num + 1];
+
+  /* the last tile's data ends somewhere before the end of the file */
+  if (end == 0 || end > length)
+    end = length;
+
+  if (end < offset ||
+      ! xcf_load_tile_data (level->compression,
+                            data + offset, end - offset,
+                            tile_data_pointer (tile, 0, 0),
+                            tile_ewidth (tile), tile_eheight (tile),
+                            tile_bpp (tile)))
+    {
+      g_warning ("xcf: failed to load tile %d of '%s'",
+                 tile_num, gimp_filename_to_utf8 (level->file->filename));
+
+      memset (tile_data_pointer (tile, 0, 0), 0, tile_size (tile));
+    }
+
+  xcf_lazy_level_tile_done (level, tile_num);
+}
+
+static void
+xcf_lazy_level_tile_done (XcfLazyLevel *level,
+                          gint          tile_num)
+{
+  XcfLazyFile *file = level->file;
+
+  level->loaded[tile_num] = TRUE;
+  level->n_pending--;
+
+  /* let go of the file once all tiles are loaded */
+  if (level->n_pending == 0)
+    {
+      file->levels = g_list_remove (file->levels, level);
+
+      if (! file->levels)
+        lazy_files = g_list_remove (lazy_files, file);
+
+      level->file = NULL;
+
+      g_free (level->offsets);
+      level->offsets = NULL;
+
+      xcf_lazy_file_unref (file);
+    }
+}
+
+static void
+xcf_lazy_level_free (XcfLazyLevel *level)
+{
+  XcfLazyFile *file = level->file;
+
+  if (file)
+    {
+      file->levels = g_list_remove (file->levels, level);
+
+      if (! file->levels)
+        lazy_files = g_list_remove (lazy_files, file);
+
+      xcf_lazy_file_unref (file);
+    }
+
+  g_free (level->offsets);
+  g_free (level->loaded);
+
+  g_slice_free (XcfLazyLevel, level);
+}
@@ -66,9 +66,13 @@
 #include "vectors/gimpvectors-compat.h"
 
 #include "xcf-private.h"
+#include "xcf-incremental.h"
+#include "xcf-lazy.h"
 #include "xcf-load.h"
 #include "xcf-read.h"
 #include "xcf-seek.h"
+#include "xcf-tile-pool.h"
+#include "xcf-zlib.h"
 
 #include "gimp-intl.h"
 
@@ -82,6 +86,26 @@
 
 #define MAX_XCF_PARASITE_DATA_LEN (256L * 1024 * 1024)
 
+/* Number of tiles read from the file before waiting for their decoding,
+ * which bounds the compressed data held in memory.
+ */
+#define XCF_LOAD_TILE_BATCH 64
+
+
+typedef struct _XcfLoadTileJob XcfLoadTileJob;
+
+struct _XcfLoadTileJob
+{
+  Tile     *tile;
+  guchar   *pixels;       /* the locked data of tile                  */
+  gint      width;
+  gint      height;
+  gint      bpp;
+  guchar   *data;         /* the compressed data read from the file   */
+  gint      data_length;
+  gboolean  success;
+};
+
 /* #define GIMP_XCF_PATH_DEBUG */
 
 
@@ -114,11 +138,17 @@ static gboolean        xcf_load_hierarchy     (XcfInfo      *info,
                                                TileManager  *tiles);
 static gboolean        xcf_load_level         (XcfInfo      *info,
                                                TileManager  *tiles);
-static gboolean        xcf_load_tile          (XcfInfo      *info,
-                                               Tile         *tile);
-static gboolean        xcf_load_tile_rle      (XcfInfo      *info,
-                                               Tile         *tile,
-                                               gint          data_length);
+static void            xcf_load_track_level   (XcfInfo      *info,
+                                               TileManager  *tiles,
+                                               const guint32 *offsets);
+static void            xcf_load_tile_decode   (XcfLoadTileJob *job,
+                                               gpointer        data);
+static gboolean        xcf_load_tile_rle      (const guchar *xcfdata,
+                                               gint          data_length,
+                                               guchar       *pixels,
+                                               gint          width,
+                                               gint          height,
+                                               gint          bpp);
 static GimpParasite  * xcf_load_parasite      (XcfInfo      *info);
 static gboolean        xcf_load_old_paths     (XcfInfo      *info,
                                                GimpImage    *image);
@@ -530,7 +560,8 @@ xcf_load_image_props (XcfInfo   *info,
             if ((compression != COMPRESS_NONE) &&
                 (compression != COMPRESS_RLE) &&
                 (compression != COMPRESS_ZLIB) &&
-                (compression != COMPRESS_FRACTAL))
+                (compression != COMPRESS_FRACTAL) &&
+                (compression != COMPRESS_ZLIB_DELTA))
               {
                 gimp_message (info->gimp, G_OBJECT (info->progress),
                               GIMP_MESSAGE_ERROR,
@@ -1798,16 +1829,18 @@ static gboolean
 xcf_load_level (XcfInfo     *info,
                 TileManager *tiles)
 {
-  guint32  saved_pos;
-  guint32  offset, offset2;
-  guint32  max_data_length;
-  guint    ntiles;
-  gint     width;
-  gint     height;
-  gint     i;
-  gint     fail;
-  Tile    *previous;
-  Tile    *tile;
+  XcfTilePool    *pool;
+  XcfLoadTileJob *jobs;
+  guint32        *offsets;
+  guint32         table_end;
+  guint32         max_data_length;
+  guint           ntiles;
+  gint            width;
+  gint            height;
+  gint            i, j;
+  gint            n_jobs;
+  gboolean        success = TRUE;
+  Tile           *previous;
 
   info->cp += xcf_read_int32 (info->fp, (guint32 *) &width, 1);
   info->cp += xcf_read_int32 (info->fp, (guint32 *) &height, 1);
@@ -1823,182 +1856,339 @@ xcf_load_level (XcfInfo     *info,
   max_data_length = TILE_WIDTH * TILE_HEIGHT * 4 *
                     XCF_TILE_MAX_DATA_LENGTH_FACTOR /* = 1.5, currently */;
 
+  ntiles  = tiles->ntile_rows * tiles->ntile_cols;
+  offsets = g_new (guint32, ntiles + 1);
+
   /* read in the first tile offset.
    *  if it is '0', then this tile level is empty
    *  and we can simply return.
    */
-  info->cp += xcf_read_int32 (info->fp, &offset, 1);
-  if (offset == 0)
-    return TRUE;
+  info->cp += xcf_read_int32 (info->fp, &offsets[0], 1);
+  if (offsets[0] == 0)
+    {
+      g_free (offsets);
+      return TRUE;
+    }
 
-  /* Initialize the reference for the in-memory tile-compression
+  /* read in the whole offset table, so that the tile data can be read
+   * in one pass while the workers decode it.
    */
-  previous = NULL;
-
-  ntiles = tiles->ntile_rows * tiles->ntile_cols;
   for (i = 0; i < ntiles; i++)
     {
-      fail = FALSE;
-
-      if (offset == 0)
+      if (offsets[i] == 0)
         {
           gimp_message_literal (info->gimp, G_OBJECT (info->progress),
 				GIMP_MESSAGE_ERROR,
 				"not enough tiles found in level");
+          g_free (offsets);
           return FALSE;
         }
 
-      /* save the current position as it is where the
-       *  next tile offset is stored.
-       */
-      saved_pos = info->cp;
+      info->cp += xcf_read_int32 (info->fp, &offsets[i + 1], 1);
+    }
 
-      /* read in the offset of the next tile so we can calculate the amount
-         of data needed for this tile*/
-      info->cp += xcf_read_int32 (info->fp, &offset2, 1);
+  if (offsets[ntiles] != 0)
+    {
+      gimp_message (info->gimp, G_OBJECT (info->progress), GIMP_MESSAGE_ERROR,
+                    "encountered garbage after reading level: %d",
+                    offsets[ntiles]);
+      g_free (offsets);
+      return FALSE;
+    }
 
-      /* if the offset is 0 then we need to read in the maximum possible
-         allowing for negative compression */
-      if (offset2 == 0)
-        offset2 = offset + max_data_length;
+  table_end = info->cp;
 
-      /* seek to the tile offset */
-      if (! xcf_seek_pos (info, offset, NULL))
-        return FALSE;
+  /* leave the tiles to be loaded when they are first used */
+  if (info->lazy_file && info->compression != COMPRESS_ZLIB &&
+      info->compression != COMPRESS_FRACTAL)
+    {
+      success = xcf_lazy_file_add_level (info->lazy_file, tiles,
+                                         info->compression, offsets);
 
-      if (offset2 < offset || offset2 - offset > max_data_length)
+      if (success)
+        xcf_load_track_level (info, tiles, offsets);
+
+      g_free (offsets);
+
+      if (! success)
         {
-          gimp_message (info->gimp, G_OBJECT (info->progress),
-                        GIMP_MESSAGE_ERROR,
-                        "invalid tile data length: %u",
-                        offset2 - offset);
+          gimp_message_literal (info->gimp, G_OBJECT (info->progress),
+                                GIMP_MESSAGE_ERROR,
+                                "invalid tile offset in level");
           return FALSE;
         }
 
-      /* get the tile from the tile manager */
-      tile = tile_manager_get (tiles, i, TRUE, TRUE);
+      return xcf_seek_pos (info, table_end, NULL);
+    }
+
+  pool = xcf_tile_pool_new (GIMP_BASE_CONFIG (info->gimp->config)->num_processors,
+                            (XcfTileFunc) xcf_load_tile_decode,
+                            GINT_TO_POINTER (info->compression));
+  jobs = g_new0 (XcfLoadTileJob, XCF_LOAD_TILE_BATCH);
+
+  /* Initialize the reference for the in-memory tile-compression
+   */
+  previous = NULL;
+
+  for (i = 0; success && i < ntiles; i += XCF_LOAD_TILE_BATCH)
+    {
+      gint n = MIN (XCF_LOAD_TILE_BATCH, ntiles - i);
 
-      /* read in the tile */
-      switch (info->compression)
+      /* read the tile data of the batch in file order, and hand it to
+       * the workers as soon as it is read.
+       */
+      for (n_jobs = 0; n_jobs < n; n_jobs++)
         {
-        case COMPRESS_NONE:
-          if (!xcf_load_tile (info, tile))
-            fail = TRUE;
-          break;
-        case COMPRESS_RLE:
-          if (!xcf_load_tile_rle (info, tile, offset2 - offset))
-            fail = TRUE;
-          break;
-        case COMPRESS_ZLIB:
-          g_warning ("xcf: zlib compression unimplemented");
-          fail = TRUE;
-          break;
-        case COMPRESS_FRACTAL:
-          g_warning ("xcf: fractal compression unimplemented");
-          fail = TRUE;
-          break;
-        default:
-          g_warning ("xcf: unknown compression");
-          fail = TRUE;
-          break;
+          XcfLoadTileJob *job     = &jobs[n_jobs];
+          guint32         offset  = offsets[i + n_jobs];
+          guint32         offset2 = offsets[i + n_jobs + 1];
+
+          /* if the offset is 0 then we need to read in the maximum possible
+             allowing for negative compression */
+          if (offset2 == 0)
+            offset2 = offset + max_data_length;
+
+          if (offset2 < offset || offset2 - offset > max_data_length)
+            {
+              gimp_message (info->gimp, G_OBJECT (info->progress),
+                            GIMP_MESSAGE_ERROR,
+                            "invalid tile data length: %u",
+                            offset2 - offset);
+              success = FALSE;
+              break;
+            }
+
+          /* seek to the tile offset */
+          if (! xcf_seek_pos (info, offset, NULL))
+            {
+              success = FALSE;
+              break;
+            }
+
+          /* get the tile from the tile manager, it stays locked until
+           * the batch is decoded.
+           */
+          job->tile        = tile_manager_get (tiles, i + n_jobs, TRUE, TRUE);
+          job->pixels      = tile_data_pointer (job->tile, 0, 0);
+          job->width       = tile_ewidth (job->tile);
+          job->height      = tile_eheight (job->tile);
+          job->bpp         = tile_bpp (job->tile);
+          job->data        = NULL;
+          job->data_length = 0;
+          job->success     = TRUE;
+
+          /* read in the tile */
+          switch (info->compression)
+            {
+            case COMPRESS_NONE:
+              info->cp += xcf_read_int8 (info->fp, job->pixels,
+                                         tile_size (job->tile));
+              break;
+            case COMPRESS_RLE:
+            case COMPRESS_ZLIB_DELTA:
+              /* Workaround for bug #357809: skip the tile as if it did
+               * not contain any data, instead of failing the whole
+               * hierarchy.
+               */
+              if (offset2 - offset > 0)
+                {
+                  job->data = g_malloc (offset2 - offset);
+
+                  /* we have to use fread instead of xcf_read_* because we
+                     may be reading past the end of the file here */
+                  job->data_length = fread ((gchar *) job->data, sizeof (gchar),
+                                            offset2 - offset, info->fp);
+                  info->cp += job->data_length;
+
+                  xcf_tile_pool_push (pool, job);
+                }
+              break;
+            case COMPRESS_ZLIB:
+              g_warning ("xcf: zlib compression unimplemented");
+              job->success = FALSE;
+              break;
+            case COMPRESS_FRACTAL:
+              g_warning ("xcf: fractal compression unimplemented");
+              job->success = FALSE;
+              break;
+            default:
+              g_warning ("xcf: unknown compression");
+              job->success = FALSE;
+              break;
+            }
+
+          if (! job->success)
+            {
+              n_jobs++;
+              break;
+            }
         }
 
-      if (fail)
+      xcf_tile_pool_wait (pool);
+
+      /* release the tiles in file order */
+      for (j = 0; j < n_jobs; j++)
         {
+          XcfLoadTileJob *job  = &jobs[j];
+          Tile           *tile = job->tile;
+
+          g_free (job->data);
+          job->data = NULL;
+
+          if (! success || ! job->success)
+            {
+              tile_release (tile, TRUE);
+              success = FALSE;
+              continue;
+            }
+
+          /* To potentially save memory, we compare the
+           *  newly-fetched tile against the last one, and
+           *  if they're the same we copy-on-write mirror one against
+           *  the other.
+           */
+          if (previous != NULL)
+            {
+              tile_lock (previous);
+              if (tile_ewidth (tile) == tile_ewidth (previous) &&
+                  tile_eheight (tile) == tile_eheight (previous) &&
+                  tile_bpp (tile) == tile_bpp (previous) &&
+                  memcmp (tile_data_pointer (tile, 0, 0),
+                          tile_data_pointer (previous, 0, 0),
+                          tile_size (tile)) == 0)
+                tile_manager_map (tiles, i + j, previous);
+              tile_release (previous, FALSE);
+            }
           tile_release (tile, TRUE);
-          return FALSE;
+          previous = tile_manager_get (tiles, i + j, FALSE, FALSE);
         }
+    }
 
-      /* To potentially save memory, we compare the
-       *  newly-fetched tile against the last one, and
-       *  if they're the same we copy-on-write mirror one against
-       *  the other.
-       */
-      if (previous != NULL)
-        {
-          tile_lock (previous);
-          if (tile_ewidth (tile) == tile_ewidth (previous) &&
-              tile_eheight (tile) == tile_eheight (previous) &&
-              tile_bpp (tile) == tile_bpp (previous) &&
-              memcmp (tile_data_pointer (tile, 0, 0),
-                      tile_data_pointer (previous, 0, 0),
-                      tile_size (tile)) == 0)
-            tile_manager_map (tiles, i, previous);
-          tile_release (previous, FALSE);
-        }
-      tile_release (tile, TRUE);
-      previous = tile_manager_get (tiles, i, FALSE, FALSE);
+  xcf_tile_pool_free (pool);
+  g_free (jobs);
 
-      /* restore the saved position so we'll be ready to
-       *  read the next offset.
-       */
-      if (!xcf_seek_pos (info, saved_pos, NULL))
-        return FALSE;
+  if (success)
+    xcf_load_track_level (info, tiles, offsets);
 
-      /* read in the offset of the next tile */
-      info->cp += xcf_read_int32 (info->fp, &offset, 1);
-    }
+  g_free (offsets);
 
-  if (offset != 0)
-    {
-      gimp_message (info->gimp, G_OBJECT (info->progress), GIMP_MESSAGE_ERROR,
-                    "encountered garbage after reading level: %d", offset);
-      return FALSE;
-    }
+  if (! success)
+    return FALSE;
 
-  return TRUE;
+  /* leave the file position after the offset table */
+  return xcf_seek_pos (info, table_end, NULL);
 }
 
-static gboolean
-xcf_load_tile (XcfInfo *info,
-               Tile    *tile)
+/* Lets the next incremental save copy the tile data from the file as
+ * long as the tiles are not changed.
+ */
+static void
+xcf_load_track_level (XcfInfo       *info,
+                      TileManager   *tiles,
+                      const guint32 *offsets)
 {
-  info->cp += xcf_read_int8 (info->fp, tile_data_pointer (tile, 0, 0),
-                             tile_size (tile));
+  guint32 *lengths;
+  gint     ntiles;
+  gint     i;
 
-  return TRUE;
+  if (! info->saved_file ||
+      info->compression == COMPRESS_ZLIB ||
+      info->compression == COMPRESS_FRACTAL)
+    return;
+
+  ntiles  = tiles->ntile_rows * tiles->ntile_cols;
+  lengths = g_new0 (guint32, ntiles);
+
+  /* the end of the last tile's data is not known */
+  for (i = 0; i < ntiles - 1; i++)
+    lengths[i] = offsets[i + 1] - offsets[i];
+
+  xcf_saved_file_track_level (info->saved_file, tiles, info->compression,
+                              offsets, lengths);
+
+  g_free (lengths);
+}
+
+/* Called in the workers of the tile pool.
+ */
+static void
+xcf_load_tile_decode (XcfLoadTileJob *job,
+                      gpointer        data)
+{
+  job->success = xcf_load_tile_data (GPOINTER_TO_INT (data),
+                                     job->data, job->data_length,
+                                     job->pixels,
+                                     job->width, job->height, job->bpp);
+}
+
+/**
+ * xcf_load_tile_data:
+ * @compression: the compression of the tile data
+ * @data:        the tile data, possibly followed by unrelated data
+ * @data_length: the length of @data
+ * @pixels:      return location for the pixels of the tile
+ * @width:       the width of the tile
+ * @height:      the height of the tile
+ * @bpp:         the bytes per pixel of the tile
+ *
+ * Decodes the data of one tile. Only touches the given memory, so it
+ * can be called from any thread.
+ *
+ * Returns: %TRUE if @data held a complete tile.
+ */
+gboolean
+xcf_load_tile_data (XcfCompressionType  compression,
+                    const guchar       *data,
+                    gint                data_length,
+                    guchar             *pixels,
+                    gint                width,
+                    gint                height,
+                    gint                bpp)
+{
+  switch (compression)
+    {
+    case COMPRESS_NONE:
+      if (data_length < width * height * bpp)
+        return FALSE;
+
+      memcpy (pixels, data, width * height * bpp);
+      return TRUE;
+
+    case COMPRESS_RLE:
+      return xcf_load_tile_rle (data, data_length, pixels,
+                                width, height, bpp);
+
+    case COMPRESS_ZLIB_DELTA:
+      return xcf_zlib_decode_tile (data, data_length, pixels,
+                                   width, height, bpp);
+
+    default:
+      return FALSE;
+    }
 }
 
 static gboolean
-xcf_load_tile_rle (XcfInfo *info,
-                   Tile    *tile,
-                   int     data_length)
+xcf_load_tile_rle (const guchar *xcfdata,
+                   gint          data_length,
+                   guchar       *pixels,
+                   gint          width,
+                   gint          height,
+                   gint          bpp)
 {
   guchar *data;
   guchar val;
   gint size;
   gint count;
   gint length;
-  gint bpp;
   gint i, j;
-  gint nmemb_read_successfully;
-  guchar *xcfdata, *xcfodata, *xcfdatalimit;
-
-  /* Workaround for bug #357809: avoid crashing on g_malloc() and skip
-   * this tile (return TRUE without storing data) as if it did not
-   * contain any data.  It is better than returning FALSE, which would
-   * skip the whole hierarchy while there may still be some valid
-   * tiles in the file.
-   */
-  if (data_length <= 0)
-    return TRUE;
-
-  bpp = tile_bpp (tile);
-
-  xcfdata = xcfodata = g_malloc (data_length);
-
-  /* we have to use fread instead of xcf_read_* because we may be
-     reading past the end of the file here */
-  nmemb_read_successfully = fread ((gchar *) xcfdata, sizeof (gchar),
-                                   data_length, info->fp);
-  info->cp += nmemb_read_successfully;
+  const guchar *xcfdatalimit;
 
-  xcfdatalimit = &xcfodata[nmemb_read_successfully - 1];
+  xcfdatalimit = &xcfdata[data_length - 1];
 
   for (i = 0; i < bpp; i++)
     {
-      data = (guchar *) tile_data_pointer (tile, 0, 0) + i;
-      size = tile_ewidth (tile) * tile_eheight (tile);
+      data = pixels + i;
+      size = width * height;
       count = 0;
 
       while (size > 0)
@@ -2081,12 +2271,9 @@ xcf_load_tile_rle (XcfInfo *info,
             }
         }
     }
-  g_free (xcfodata);
   return TRUE;
 
  bogus_rle:
-  if (xcfodata)
-    g_free (xcfodata);
   return FALSE;
 }
 
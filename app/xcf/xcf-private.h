@@ -129,15 +129,18 @@ typedef enum
  * @COMPRESS_RLE:     Run-Length-Encoding
  * @COMPRESS_ZLIB:    reserved for zlib-based compression
  * @COMPRESS_FRACTAL: reserved for fractal compression
+ * @COMPRESS_ZLIB_DELTA: deflate of delta filtered byte planes (see xcf-zlib.c)
  *
- * Enum for image compression types. Currently we only use @COMPRESS_RLE
+ * Enum for image compression types. We save @COMPRESS_RLE, or
+ * @COMPRESS_ZLIB_DELTA if the "xcf-fast-compression" option is set.
  */
 typedef enum
 {
   COMPRESS_NONE              =  0,
   COMPRESS_RLE               =  1,
   COMPRESS_ZLIB              =  2,  /* unused */
-  COMPRESS_FRACTAL           =  3   /* unused */
+  COMPRESS_FRACTAL           =  3,  /* unused */
+  COMPRESS_ZLIB_DELTA        =  4
 } XcfCompressionType;
 
 /**
@@ -214,10 +217,17 @@ typedef enum
 * @ref_count:             unused (TODO: use or remove)
 * @compression:           file compression (see @XcfCompressionType)
 * @file_version:          file format version (see xcf_save_choose_format())
+* @lazy_file:             the mapped file to load tiles from on demand, or %NULL
+* @saved_file:            the loaded file, to copy unchanged tiles from when
+*                         saving, or %NULL
+* @incremental:           the state of an incremental save, or %NULL
 *
 * XCF file information structure.
 */
-typedef struct _XcfInfo  XcfInfo;
+typedef struct _XcfInfo         XcfInfo;
+typedef struct _XcfLazyFile     XcfLazyFile;
+typedef struct _XcfSavedFile    XcfSavedFile;
+typedef struct _XcfIncremental  XcfIncremental;
 
 struct _XcfInfo
 {
@@ -236,6 +246,9 @@ struct _XcfInfo
   gint               *ref_count;
   XcfCompressionType  compression;
   gint                file_version;
+  XcfLazyFile        *lazy_file;
+  XcfSavedFile       *saved_file;
+  XcfIncremental     *incremental;
 };
 
 
@@ -32,6 +32,8 @@
 #include "base/tile-manager.h"
 #include "base/tile-manager-private.h"
 
+#include "config/gimpcoreconfig.h"
+
 #include "core/gimp.h"
 #include "core/gimpcontainer.h"
 #include "core/gimpchannel.h"
@@ -63,10 +65,13 @@
 #include "vectors/gimpvectors-compat.h"
 
 #include "xcf-private.h"
+#include "xcf-incremental.h"
 #include "xcf-read.h"
 #include "xcf-save.h"
 #include "xcf-seek.h"
+#include "xcf-tile-pool.h"
 #include "xcf-write.h"
+#include "xcf-zlib.h"
 
 #include "gimp-intl.h"
 
@@ -78,6 +83,28 @@
  * XCF file saver
  */
 
+/* Number of tiles handed to the workers before they are written, which
+ * bounds the encoded data held in memory.
+ */
+#define XCF_SAVE_TILE_BATCH 64
+
+
+typedef struct _XcfSaveTileJob XcfSaveTileJob;
+
+struct _XcfSaveTileJob
+{
+  Tile         *tile;
+  const guchar *pixels;     /* the locked data of tile           */
+  gint          width;
+  gint          height;
+  gint          bpp;
+  guchar       *rlebuf;     /* the encoded data                  */
+  gint          length;
+  gint          bad_count;  /* -1, or the count of a broken run  */
+  gboolean      copied;     /* rlebuf was copied from an earlier
+                             * file, tile is not locked          */
+};
+
 static gboolean xcf_save_image_props   (XcfInfo           *info,
                                         GimpImage         *image,
                                         GError           **error);
@@ -108,13 +135,14 @@ static gboolean xcf_save_hierarchy     (XcfInfo           *info,
 static gboolean xcf_save_level         (XcfInfo           *info,
                                         TileManager       *tiles,
                                         GError           **error);
-static gboolean xcf_save_tile          (XcfInfo           *info,
-                                        Tile              *tile,
-                                        GError           **error);
-static gboolean xcf_save_tile_rle      (XcfInfo           *info,
-                                        Tile              *tile,
+static void     xcf_save_tile_encode   (XcfSaveTileJob    *job,
+                                        gpointer           data);
+static gint     xcf_save_tile_rle      (const guchar      *pixels,
+                                        gint               width,
+                                        gint               height,
+                                        gint               bpp,
                                         guchar            *rlebuf,
-                                        GError           **error);
+                                        gint              *bad_count);
 static gboolean xcf_save_parasite      (XcfInfo           *info,
                                         GimpParasite      *parasite,
                                         GError           **error);
@@ -261,6 +289,8 @@ xcf_save_choose_format_recursive(XcfInfo* info, GimpContainer* layers) {
  *
  * 4: Image uses one of the layer modes "svg:src-in", "svg:dst-in", "svg:src-out", or "svg:dst-out".
  *    Or image contains a filter layer.
+ *
+ * 5: Tiles are saved with @COMPRESS_ZLIB_DELTA.
  */
 void
 xcf_save_choose_format (XcfInfo   *info,
@@ -324,6 +354,12 @@ xcf_save_choose_format (XcfInfo   *info,
       }
     }
 
+  /* older versions would fail on the unknown compression only after
+   * reading the image properties, make them refuse the file instead
+   */
+  if (info->compression == COMPRESS_ZLIB_DELTA)
+    save_version = 5;
+
   info->file_version = save_version;
 }
 
@@ -1652,8 +1688,8 @@ xcf_save_level (XcfInfo      *info,
   guint32  width;
   guint32  height;
   guint    ntiles;
-  gint     i;
-  guchar  *rlebuf;
+  gint     i, j;
+  gboolean success = TRUE;
 
   GError *tmp_error = NULL;
 
@@ -1670,10 +1706,6 @@ xcf_save_level (XcfInfo      *info,
   max_data_length = TILE_WIDTH * TILE_HEIGHT * tile_manager_bpp (level) *
                     XCF_TILE_MAX_DATA_LENGTH_FACTOR /* = 1.5, currently */;
 
-  /* allocate a temporary buffer to store the rle data before it is
-     written to disk */
-  rlebuf = g_malloc (max_data_length);
-
   ntiles = level->ntile_rows * level->ntile_cols;
 
   /* allocate an offset table so we don't have to seek back after each
@@ -1695,45 +1727,155 @@ xcf_save_level (XcfInfo      *info,
 
   if (level->tiles)
     {
-      for (i = 0; i < ntiles; i++)
+      XcfTilePool    *pool;
+      XcfSaveTileJob *jobs;
+      guchar         *rlebufs;
+      guint32        *lengths;
+
+      pool = xcf_tile_pool_new (GIMP_BASE_CONFIG (info->gimp->config)->num_processors,
+                                (XcfTileFunc) xcf_save_tile_encode,
+                                GINT_TO_POINTER (info->compression));
+      jobs = g_new0 (XcfSaveTileJob, XCF_SAVE_TILE_BATCH);
+
+      /* temporary buffers to store the encoded data before it is
+         written to disk */
+      rlebufs = g_malloc ((gsize) max_data_length * XCF_SAVE_TILE_BATCH);
+
+      /* the data length of each tile, for the next incremental save */
+      lengths = g_new0 (guint32, ntiles);
+
+      for (i = 0; i < ntiles; i += XCF_SAVE_TILE_BATCH)
         {
-          /* store the offset in the table and increment the next pointer */
-          *next_offset++ = offset;
+          gint n = MIN (XCF_SAVE_TILE_BATCH, ntiles - i);
 
-          /* write out the tile. */
-          switch (info->compression)
+          /* lock the tiles of the batch and encode them in the workers */
+          for (j = 0; j < n; j++)
             {
-            case COMPRESS_NONE:
-              xcf_check_error (xcf_save_tile (info, level->tiles[i], error));
-              break;
-            case COMPRESS_RLE:
-              xcf_check_error (xcf_save_tile_rle (info, level->tiles[i],
-                               rlebuf, error));
-              break;
-            case COMPRESS_ZLIB:
-              g_error ("xcf: zlib compression unimplemented");
-              break;
-            case COMPRESS_FRACTAL:
-              g_error ("xcf: fractal compression unimplemented");
-              break;
+              XcfSaveTileJob *job = &jobs[j];
+
+              job->tile      = level->tiles[i + j];
+              job->rlebuf    = rlebufs + (gsize) max_data_length * j;
+              job->length    = 0;
+              job->bad_count = -1;
+              job->copied    = FALSE;
+
+              /* take the data of unchanged tiles from the earlier file,
+               * without touching the tile
+               */
+              if (info->incremental)
+                {
+                  job->length = xcf_incremental_copy_tile (info->incremental,
+                                                           level, i + j,
+                                                           info->compression,
+                                                           job->rlebuf,
+                                                           max_data_length);
+                  job->copied = job->length > 0;
+
+                  if (job->copied)
+                    continue;
+                }
+
+              tile_lock (job->tile);
+              job->pixels    = tile_data_pointer (job->tile, 0, 0);
+              job->width     = tile_ewidth (job->tile);
+              job->height    = tile_eheight (job->tile);
+              job->bpp       = tile_bpp (job->tile);
+
+              if (info->compression == COMPRESS_RLE ||
+                  info->compression == COMPRESS_ZLIB_DELTA)
+                xcf_tile_pool_push (pool, job);
             }
 
-          /* make sure the on-disk tile data didn't end up being too big.
-           * xcf_load_level() would refuse to load the file if it did.
-           */
-          if (info->cp < offset || info->cp - offset > max_data_length)
+          xcf_tile_pool_wait (pool);
+
+          /* write out the tiles in order */
+          for (j = 0; j < n; j++)
             {
-              g_error ("xcf: invalid tile data length: %u",
-                       info->cp - offset);
-              return FALSE;
+              XcfSaveTileJob *job = &jobs[j];
+
+              if (success)
+                {
+                  /* store the offset in the table and increment the next pointer */
+                  *next_offset++ = offset;
+
+                  if (job->copied)
+                    {
+                      info->cp += xcf_write_int8 (info->fp, job->rlebuf,
+                                                  job->length, &tmp_error);
+                    }
+                  else
+                    {
+                      switch (info->compression)
+                        {
+                        case COMPRESS_NONE:
+                          info->cp += xcf_write_int8 (info->fp, job->pixels,
+                                                      tile_size (job->tile),
+                                                      &tmp_error);
+                          break;
+                        case COMPRESS_RLE:
+                          if (job->bad_count != -1)
+                            g_message ("xcf: uh oh! xcf rle tile saving error: %d",
+                                       job->bad_count);
+
+                          info->cp += xcf_write_int8 (info->fp, job->rlebuf,
+                                                      job->length, &tmp_error);
+                          break;
+                        case COMPRESS_ZLIB:
+                          g_error ("xcf: zlib compression unimplemented");
+                          break;
+                        case COMPRESS_FRACTAL:
+                          g_error ("xcf: fractal compression unimplemented");
+                          break;
+                        case COMPRESS_ZLIB_DELTA:
+                          info->cp += xcf_write_int8 (info->fp, job->rlebuf,
+                                                      job->length, &tmp_error);
+                          break;
+                        }
+                    }
+
+                  if (tmp_error)
+                    {
+                      g_propagate_error (error, tmp_error);
+                      tmp_error = NULL;
+                      success   = FALSE;
+                    }
+                  /* make sure the on-disk tile data didn't end up being too big.
+                   * xcf_load_level() would refuse to load the file if it did.
+                   */
+                  else if (info->cp < offset || info->cp - offset > max_data_length)
+                    {
+                      g_error ("xcf: invalid tile data length: %u",
+                               info->cp - offset);
+                      success = FALSE;
+                    }
+
+                  lengths[i + j] = info->cp - offset;
+
+                  /* the next tile's offset is after the tile we just wrote */
+                  offset = info->cp;
+                }
+
+              if (! job->copied)
+                tile_release (job->tile, FALSE);
             }
 
-          /* the next tile's offset is after the tile we just wrote */
-          offset = info->cp;
+          if (! success)
+            break;
         }
-    }
 
-  g_free (rlebuf);
+      xcf_tile_pool_free (pool);
+      g_free (jobs);
+      g_free (rlebufs);
+
+      if (success && info->incremental)
+        xcf_incremental_add_level (info->incremental, level,
+                                   info->compression, offset_table, lengths);
+
+      g_free (lengths);
+
+      if (! success)
+        return FALSE;
+    }
 
   /* seek back to the offset table and write it  */
   xcf_check_error (xcf_seek_pos (info, saved_pos, error));
@@ -1745,44 +1887,44 @@ xcf_save_level (XcfInfo      *info,
   return TRUE;
 }
 
-static gboolean
-xcf_save_tile (XcfInfo  *info,
-               Tile     *tile,
-               GError  **error)
+/* Called in the workers of the tile pool.
+ */
+static void
+xcf_save_tile_encode (XcfSaveTileJob *job,
+                      gpointer        data)
 {
-  GError *tmp_error = NULL;
-
-  tile_lock (tile);
-  xcf_write_int8_check_error (info, tile_data_pointer (tile, 0, 0),
-                              tile_size (tile));
-  tile_release (tile, FALSE);
-
-  return TRUE;
+  switch (GPOINTER_TO_INT (data))
+    {
+    case COMPRESS_RLE:
+      job->length = xcf_save_tile_rle (job->pixels, job->width, job->height,
+                                       job->bpp, job->rlebuf, &job->bad_count);
+      break;
+    case COMPRESS_ZLIB_DELTA:
+      job->length = xcf_zlib_encode_tile (job->pixels, job->width, job->height,
+                                          job->bpp, job->rlebuf);
+      break;
+    }
 }
 
-static gboolean
-xcf_save_tile_rle (XcfInfo  *info,
-                   Tile     *tile,
-                   guchar   *rlebuf,
-                   GError  **error)
+static gint
+xcf_save_tile_rle (const guchar *pixels,
+                   gint          width,
+                   gint          height,
+                   gint          bpp,
+                   guchar       *rlebuf,
+                   gint         *bad_count)
 {
-  GError *tmp_error = NULL;
-  gint    len       = 0;
-  gint    bpp;
-  gint    i, j;
-
-  tile_lock (tile);
-
-  bpp = tile_bpp (tile);
+  gint len = 0;
+  gint i, j;
 
   for (i = 0; i < bpp; i++)
     {
-      const guchar *data = (const guchar *) tile_data_pointer (tile, 0, 0) + i;
+      const guchar *data = pixels + i;
 
       gint  state  = 0;
       gint  length = 0;
       gint  count  = 0;
-      gint  size   = tile_ewidth (tile) * tile_eheight (tile);
+      gint  size   = width * height;
       guint last   = -1;
 
       while (size > 0)
@@ -1868,14 +2010,11 @@ xcf_save_tile_rle (XcfInfo  *info,
             }
         }
 
-      if (count != (tile_ewidth (tile) * tile_eheight (tile)))
-        g_message ("xcf: uh oh! xcf rle tile saving error: %d", count);
+      if (count != width * height)
+        *bad_count = count;
     }
 
-  xcf_write_int8_check_error (info, rlebuf, len);
-  tile_release (tile, FALSE);
-
-  return TRUE;
+  return len;
 }
 
 static gboolean
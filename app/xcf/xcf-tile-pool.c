@@ -0,0 +1,185 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <glib-object.h>
+
+#include "xcf-tile-pool.h"
+
+/**
+ * SECTION:xcf-tile-pool
+ * @Short_description:Worker threads for XCF tile data
+ *
+ * The XCF loader and saver read and write the file in a single thread,
+ * and hand the decoding and encoding of the tile data to a pool of
+ * workers. The jobs must not touch the tile manager, which is not
+ * thread safe; the caller locks the tiles before pushing their jobs and
+ * releases them in file order after xcf_tile_pool_wait().
+ *
+ * Without ENABLE_MP, or with a single processor, the jobs are run when
+ * they are pushed.
+ */
+
+struct _XcfTilePool
+{
+  XcfTileFunc  func;
+  gpointer     user_data;
+
+#ifdef ENABLE_MP
+  GThreadPool *pool;
+  GMutex      *mutex;
+  GCond       *cond;
+  gint         pending;
+#endif
+};
+
+
+#ifdef ENABLE_MP
+static void
+xcf_tile_pool_run (gpointer     job,
+                   XcfTilePool *pool)
+{
+  pool->func (job, pool->user_data);
+
+  g_mutex_lock (pool->mutex);
+
+  if (--pool->pending == 0)
+    g_cond_signal (pool->cond);
+
+  g_mutex_unlock (pool->mutex);
+}
+#endif
+
+/**
+ * xcf_tile_pool_new:
+ * @n_threads: the number of worker threads, usually the number of
+ *             processors from the preferences
+ * @func:      the function run for each job
+ * @user_data: data passed to @func
+ *
+ * Returns: a new #XcfTilePool
+ */
+XcfTilePool *
+xcf_tile_pool_new (gint         n_threads,
+                   XcfTileFunc  func,
+                   gpointer     user_data)
+{
+  XcfTilePool *pool = g_slice_new0 (XcfTilePool);
+
+  pool->func      = func;
+  pool->user_data = user_data;
+
+#ifdef ENABLE_MP
+  if (n_threads > 1)
+    {
+      GError *error = NULL;
+
+      pool->pool = g_thread_pool_new ((GFunc) xcf_tile_pool_run, pool,
+                                      n_threads, FALSE, &error);
+
+      if (pool->pool)
+        {
+          pool->mutex = g_mutex_new ();
+          pool->cond  = g_cond_new ();
+        }
+      else
+        {
+          g_warning ("thread creation failed: %s", error->message);
+          g_clear_error (&error);
+        }
+    }
+#endif
+
+  return pool;
+}
+
+/**
+ * xcf_tile_pool_push:
+ * @pool: an #XcfTilePool
+ * @job:  the job passed to the function of @pool
+ *
+ * Runs the function of @pool for @job in one of the workers.
+ */
+void
+xcf_tile_pool_push (XcfTilePool *pool,
+                    gpointer     job)
+{
+#ifdef ENABLE_MP
+  if (pool->pool)
+    {
+      GError *error = NULL;
+
+      g_mutex_lock (pool->mutex);
+      pool->pending++;
+      g_mutex_unlock (pool->mutex);
+
+      g_thread_pool_push (pool->pool, job, &error);
+
+      if (G_LIKELY (! error))
+        return;
+
+      g_warning ("thread creation failed: %s", error->message);
+      g_clear_error (&error);
+
+      g_mutex_lock (pool->mutex);
+      pool->pending--;
+      g_mutex_unlock (pool->mutex);
+    }
+#endif
+
+  pool->func (job, pool->user_data);
+}
+
+/**
+ * xcf_tile_pool_wait:
+ * @pool: an #XcfTilePool
+ *
+ * Waits until the jobs pushed to @pool are done.
+ */
+void
+xcf_tile_pool_wait (XcfTilePool *pool)
+{
+#ifdef ENABLE_MP
+  if (pool->pool)
+    {
+      g_mutex_lock (pool->mutex);
+
+      while (pool->pending > 0)
+        g_cond_wait (pool->cond, pool->mutex);
+
+      g_mutex_unlock (pool->mutex);
+    }
+#endif
+}
+
+void
+xcf_tile_pool_free (XcfTilePool *pool)
+{
+  xcf_tile_pool_wait (pool);
+
+#ifdef ENABLE_MP
+  if (pool->pool)
+    {
+      g_thread_pool_free (pool->pool, FALSE, TRUE);
+      g_mutex_free (pool->mutex);
+      g_cond_free (pool->cond);
+    }
+#endif
+
+  g_slice_free (XcfTilePool, pool);
+}
@@ -0,0 +1,37 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XCF_TILE_POOL_H__
+#define __XCF_TILE_POOL_H__
+
+
+typedef struct _XcfTilePool XcfTilePool;
+
+typedef void (* XcfTileFunc) (gpointer job,
+                              gpointer user_data);
+
+
+XcfTilePool * xcf_tile_pool_new  (gint         n_threads,
+                                  XcfTileFunc  func,
+                                  gpointer     user_data);
+void          xcf_tile_pool_push (XcfTilePool *pool,
+                                  gpointer     job);
+void          xcf_tile_pool_wait (XcfTilePool *pool);
+void          xcf_tile_pool_free (XcfTilePool *pool);
+
+
+#endif  /* __XCF_TILE_POOL_H__ */
@@ -0,0 +1,309 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "xcf-zlib.h"
+
+/**
+ * SECTION:xcf-zlib
+ * @Short_description:Tile data of the COMPRESS_ZLIB_DELTA compression
+ *
+ * The pixels of a tile are split into one plane per channel, and each
+ * byte of a plane is replaced by its difference to the byte on its left,
+ * or above it in the first column. Smooth painted and photographic
+ * content turns into small values, which deflate compresses well even
+ * at its fastest level.
+ *
+ * The tile data starts with one byte: %XCF_ZLIB_TILE_DEFLATE if the
+ * filtered planes follow as a raw deflate stream, or
+ * %XCF_ZLIB_TILE_STORED if deflate did not make the tile smaller and the
+ * pixels follow uncompressed, as with COMPRESS_NONE.
+ *
+ * The functions only touch the memory they are given, so they can run in
+ * the workers of the XCF tile pool. Each thread keeps one compressor and
+ * one decompressor, which are reset between tiles instead of setting up
+ * the deflate state for every tile.
+ */
+
+#define XCF_ZLIB_TILE_STORED  0
+#define XCF_ZLIB_TILE_DEFLATE 1
+
+/* favour speed, the delta filter does most of the work */
+#define XCF_ZLIB_LEVEL        1
+
+
+static GStaticPrivate compressor_private   = G_STATIC_PRIVATE_INIT;
+static GStaticPrivate decompressor_private = G_STATIC_PRIVATE_INIT;
+
+
+static void
+xcf_zlib_filter (const guchar *pixels,
+                 guchar       *planes,
+                 gint          width,
+                 gint          height,
+                 gint          bpp)
+{
+  gint n = width * height;
+  gint c, x, y;
+
+  for (c = 0; c < bpp; c++)
+    {
+      guchar       *plane = planes + c * n;
+      const guchar *src   = pixels + c;
+
+      for (y = 0; y < height; y++)
+        {
+          const guchar *row = src + y * width * bpp;
+
+          plane[y * width] = y > 0 ? row[0] - row[-width * bpp] : row[0];
+
+          for (x = 1; x < width; x++)
+            plane[y * width + x] = row[x * bpp] - row[(x - 1) * bpp];
+        }
+    }
+}
+
+static void
+xcf_zlib_unfilter (const guchar *planes,
+                   guchar       *pixels,
+                   gint          width,
+                   gint          height,
+                   gint          bpp)
+{
+  gint n = width * height;
+  gint c, x, y;
+
+  for (c = 0; c < bpp; c++)
+    {
+      const guchar *plane = planes + c * n;
+      guchar       *dest  = pixels + c;
+
+      for (y = 0; y < height; y++)
+        {
+          guchar *row = dest + y * width * bpp;
+
+          row[0] = y > 0 ? plane[y * width] + row[-width * bpp] : plane[0];
+
+          for (x = 1; x < width; x++)
+            row[x * bpp] = plane[y * width + x] + row[(x - 1) * bpp];
+        }
+    }
+}
+
+/* Returns the compressor of the calling thread, ready for a new tile.  */
+static GConverter *
+xcf_zlib_get_compressor (void)
+{
+  GConverter *converter = g_static_private_get (&compressor_private);
+
+  if (converter)
+    {
+      g_converter_reset (converter);
+    }
+  else
+    {
+      converter = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW,
+                                                      XCF_ZLIB_LEVEL));
+
+      g_static_private_set (&compressor_private, converter,
+                            (GDestroyNotify) g_object_unref);
+    }
+
+  return converter;
+}
+
+/* Returns the decompressor of the calling thread, ready for a new tile.  */
+static GConverter *
+xcf_zlib_get_decompressor (void)
+{
+  GConverter *converter = g_static_private_get (&decompressor_private);
+
+  if (converter)
+    {
+      g_converter_reset (converter);
+    }
+  else
+    {
+      converter = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW));
+
+      g_static_private_set (&decompressor_private, converter,
+                            (GDestroyNotify) g_object_unref);
+    }
+
+  return converter;
+}
+
+/* Runs converter over all of in, returns FALSE if it fails or if the
+ * result does not fit into out.
+ */
+static gboolean
+xcf_zlib_convert (GConverter   *converter,
+                  const guchar *in,
+                  gsize         in_length,
+                  guchar       *out,
+                  gsize         out_length,
+                  gsize        *length)
+{
+  gsize total_read    = 0;
+  gsize total_written = 0;
+
+  while (total_written < out_length)
+    {
+      GConverterResult result;
+      gsize            bytes_read;
+      gsize            bytes_written;
+
+      result = g_converter_convert (converter,
+                                    in + total_read,
+                                    in_length - total_read,
+                                    out + total_written,
+                                    out_length - total_written,
+                                    G_CONVERTER_INPUT_AT_END,
+                                    &bytes_read, &bytes_written,
+                                    NULL);
+
+      total_read    += bytes_read;
+      total_written += bytes_written;
+
+      if (result == G_CONVERTER_FINISHED)
+        {
+          *length = total_written;
+          return TRUE;
+        }
+
+      if (result == G_CONVERTER_ERROR ||
+          (bytes_read == 0 && bytes_written == 0))
+        break;
+    }
+
+  return FALSE;
+}
+
+/**
+ * xcf_zlib_encode_tile:
+ * @pixels: the pixels of the tile
+ * @width:  the width of the tile
+ * @height: the height of the tile
+ * @bpp:    the bytes per pixel of the tile
+ * @data:   return location for the tile data, of at least
+ *          1 + @width * @height * @bpp bytes
+ *
+ * Returns: the length of the tile data.
+ */
+gint
+xcf_zlib_encode_tile (const guchar *pixels,
+                      gint          width,
+                      gint          height,
+                      gint          bpp,
+                      guchar       *data)
+{
+  guchar   *planes;
+  gsize     size = width * height * bpp;
+  gsize     length;
+  gboolean  success;
+
+  planes = g_malloc (size);
+
+  xcf_zlib_filter (pixels, planes, width, height, bpp);
+
+  /* only keep the deflate stream if it is smaller than the pixels */
+  success = xcf_zlib_convert (xcf_zlib_get_compressor (),
+                              planes, size,
+                              data + 1, size - 1,
+                              &length);
+
+  g_free (planes);
+
+  if (success)
+    {
+      data[0] = XCF_ZLIB_TILE_DEFLATE;
+
+      return 1 + length;
+    }
+
+  data[0] = XCF_ZLIB_TILE_STORED;
+  memcpy (data + 1, pixels, size);
+
+  return 1 + size;
+}
+
+/**
+ * xcf_zlib_decode_tile:
+ * @data:        the tile data read from the file
+ * @data_length: the length of @data, which may include data past the
+ *               tile's end
+ * @pixels:      return location for the pixels of the tile
+ * @width:       the width of the tile
+ * @height:      the height of the tile
+ * @bpp:         the bytes per pixel of the tile
+ *
+ * Returns: %TRUE if @data held a complete tile.
+ */
+gboolean
+xcf_zlib_decode_tile (const guchar *data,
+                      gint          data_length,
+                      guchar       *pixels,
+                      gint          width,
+                      gint          height,
+                      gint          bpp)
+{
+  guchar   *planes;
+  gsize     size = width * height * bpp;
+  gsize     length;
+  gboolean  success;
+
+  if (data_length < 1)
+    return FALSE;
+
+  switch (data[0])
+    {
+    case XCF_ZLIB_TILE_STORED:
+      if (data_length - 1 < size)
+        return FALSE;
+
+      memcpy (pixels, data + 1, size);
+      return TRUE;
+
+    case XCF_ZLIB_TILE_DEFLATE:
+      break;
+
+    default:
+      return FALSE;
+    }
+
+  /* one spare byte, so that a stream longer than the tile fails */
+  planes = g_malloc (size + 1);
+
+  success = xcf_zlib_convert (xcf_zlib_get_decompressor (),
+                              data + 1, data_length - 1,
+                              planes, size + 1,
+                              &length);
+
+  success = success && length == size;
+
+  if (success)
+    xcf_zlib_unfilter (planes, pixels, width, height, bpp);
+
+  g_free (planes);
+
+  return success;
+}
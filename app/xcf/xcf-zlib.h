@@ -0,0 +1,35 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XCF_ZLIB_H__
+#define __XCF_ZLIB_H__
+
+
+gint     xcf_zlib_encode_tile (const guchar *pixels,
+                               gint          width,
+                               gint          height,
+                               gint          bpp,
+                               guchar       *data);
+gboolean xcf_zlib_decode_tile (const guchar *data,
+                               gint          data_length,
+                               guchar       *pixels,
+                               gint          width,
+                               gint          height,
+                               gint          bpp);
+
+
+#endif  /* __XCF_ZLIB_H__ */
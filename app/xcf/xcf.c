@@ -20,14 +20,23 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include <gegl.h>
 #include <glib/gstdio.h>
 
 #include "libgimpbase/gimpbase.h"
+#include "libgimpcolor/gimpcolor.h"
 
 #include "core/core-types.h"
 
+#include "config/gimpcoreconfig.h"
+
 #include "core/gimp.h"
 #include "core/gimpimage.h"
 #include "core/gimpparamspecs.h"
@@ -38,6 +47,8 @@
 
 #include "xcf.h"
 #include "xcf-private.h"
+#include "xcf-incremental.h"
+#include "xcf-lazy.h"
 #include "xcf-load.h"
 #include "xcf-read.h"
 #include "xcf-save.h"
@@ -70,6 +81,10 @@ static GValueArray * xcf_save_invoker (GimpProcedure      *procedure,
                                        GimpProgress       *progress,
                                        const GValueArray  *args,
                                        GError            **error);
+static gchar       * xcf_resolve_link (const gchar        *filename);
+static gboolean      xcf_replace_file (const gchar        *new_filename,
+                                       const gchar        *filename,
+                                       GError            **error);
 
 
 static GimpXcfLoaderFunc * const xcf_loaders[] =
@@ -78,7 +93,8 @@ static GimpXcfLoaderFunc * const xcf_loaders[] =
   xcf_load_image,   /* version 1 */
   xcf_load_image,   /* version 2 */
   xcf_load_image,   /* version 3 */
-  xcf_load_image    /* version 4 */
+  xcf_load_image,   /* version 4 */
+  xcf_load_image    /* version 5 */
 };
 
 
@@ -295,6 +311,15 @@ xcf_load_invoker (GimpProcedure      *procedure,
       info.swap_num              = 0;
       info.ref_count             = NULL;
       info.compression           = COMPRESS_NONE;
+      info.lazy_file             = NULL;
+      info.saved_file            = NULL;
+      info.incremental           = NULL;
+
+      if (GIMP_CORE_CONFIG (gimp->config)->xcf_lazy_loading)
+        info.lazy_file = xcf_lazy_file_new (filename);
+
+      if (GIMP_CORE_CONFIG (gimp->config)->xcf_incremental_save)
+        info.saved_file = xcf_saved_file_new (filename);
 
       if (progress)
         {
@@ -349,6 +374,13 @@ xcf_load_invoker (GimpProcedure      *procedure,
 
       fclose (info.fp);
 
+      /* the levels keep the mapping while they have pending tiles */
+      if (info.lazy_file)
+        xcf_lazy_file_unref (info.lazy_file);
+
+      if (info.saved_file)
+        xcf_saved_file_unref (info.saved_file);
+
       if (progress)
         gimp_progress_end (progress);
     }
@@ -380,18 +412,46 @@ xcf_save_invoker (GimpProcedure      *procedure,
                   const GValueArray  *args,
                   GError            **error)
 {
-  XcfInfo      info;
-  GValueArray *return_vals;
-  GimpImage   *image;
-  const gchar *filename;
-  gboolean     success = FALSE;
+  XcfInfo         info;
+  GValueArray    *return_vals;
+  GimpImage      *image;
+  const gchar    *filename;
+  gchar          *save_filename;
+  gchar          *target      = NULL;
+  XcfIncremental *incremental = NULL;
+  gboolean        success     = FALSE;
 
   gimp_set_busy (gimp);
 
   image    = gimp_value_get_image (&args->values[1], gimp);
   filename = g_value_get_string (&args->values[3]);
 
-  info.fp = g_fopen (filename, "wb");
+  if (GIMP_CORE_CONFIG (gimp->config)->xcf_incremental_save)
+    {
+      /* write next to the file and replace it when done, so that the
+       * unchanged tiles can be copied from the file being replaced; a
+       * symbolic link is kept, the file it points to is replaced
+       */
+      incremental   = xcf_incremental_new ();
+      target        = xcf_resolve_link (filename);
+      save_filename = g_strconcat (target, ".tmp", NULL);
+    }
+  else
+    {
+      save_filename = g_strdup (filename);
+    }
+
+#ifndef G_OS_WIN32
+  if (! incremental)
+#endif
+    {
+      /* tiles still to be loaded from the file must be read before it
+       * is truncated or replaced
+       */
+      xcf_lazy_materialize (filename);
+    }
+
+  info.fp = g_fopen (save_filename, "wb");
 
   if (info.fp)
     {
@@ -407,6 +467,12 @@ xcf_save_invoker (GimpProcedure      *procedure,
       info.swap_num              = 0;
       info.ref_count             = NULL;
       info.compression           = COMPRESS_RLE;
+      info.lazy_file             = NULL;
+      info.saved_file            = NULL;
+      info.incremental           = incremental;
+
+      if (GIMP_CORE_CONFIG (gimp->config)->xcf_fast_compression)
+        info.compression         = COMPRESS_ZLIB_DELTA;
 
       if (progress)
         {
@@ -442,6 +508,17 @@ xcf_save_invoker (GimpProcedure      *procedure,
           fclose (info.fp);
         }
 
+      if (incremental)
+        {
+          if (success)
+            success = xcf_replace_file (save_filename, target, error);
+
+          if (success)
+            xcf_incremental_commit (incremental, target);
+          else
+            g_unlink (save_filename);
+        }
+
       if (progress)
         gimp_progress_end (progress);
     }
@@ -454,6 +531,12 @@ xcf_save_invoker (GimpProcedure      *procedure,
                    gimp_filename_to_utf8 (filename), g_strerror (save_errno));
     }
 
+  if (incremental)
+    xcf_incremental_free (incremental);
+
+  g_free (save_filename);
+  g_free (target);
+
   return_vals = gimp_procedure_get_return_values (procedure, success,
                                                   error ? *error : NULL);
 
@@ -461,3 +544,81 @@ xcf_save_invoker (GimpProcedure      *procedure,
 
   return return_vals;
 }
+
+/* Returns the file filename finally points to, following symbolic
+ * links the way opening filename would.
+ */
+static gchar *
+xcf_resolve_link (const gchar *filename)
+{
+  gchar *result = g_strdup (filename);
+  gint   depth;
+
+  /* give up on loops like the system does */
+  for (depth = 0; depth < 32; depth++)
+    {
+      gchar *link = g_file_read_link (result, NULL);
+
+      if (! link)
+        break;
+
+      if (! g_path_is_absolute (link))
+        {
+          gchar *dirname = g_path_get_dirname (result);
+          gchar *path    = g_build_filename (dirname, link, NULL);
+
+          g_free (dirname);
+          g_free (link);
+
+          link = path;
+        }
+
+      g_free (result);
+      result = link;
+    }
+
+  return result;
+}
+
+/* Moves the completely written new_filename over filename, keeping the
+ * owner and the permissions of the replaced file.
+ */
+static gboolean
+xcf_replace_file (const gchar  *new_filename,
+                  const gchar  *filename,
+                  GError      **error)
+{
+  struct stat st;
+
+  if (g_stat (filename, &st) == 0)
+    {
+#ifndef G_OS_WIN32
+      /* only root may give a file away, keep at least the group then */
+      if (chown (new_filename, st.st_uid, st.st_gid) != 0 &&
+          chown (new_filename, -1, st.st_gid) != 0)
+        {
+          /* the new file keeps the owner of the saving user */
+        }
+#endif
+
+      g_chmod (new_filename, st.st_mode & 0777);
+
+#ifdef G_OS_WIN32
+      /* rename() does not replace existing files on win32 */
+      g_unlink (filename);
+#endif
+    }
+
+  if (g_rename (new_filename, filename) != 0)
+    {
+      int save_errno = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (save_errno),
+                   _("Error saving XCF file: %s"),
+                   g_strerror (save_errno));
+
+      return FALSE;
+    }
+
+  return TRUE;
+}